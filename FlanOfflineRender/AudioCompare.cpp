@@ -0,0 +1,98 @@
+#include "AudioCompare.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#define SPECTRUM_FRAME_SIZE 2048
+#define SPECTRUM_HOP_SIZE 1024
+#define SPECTRUM_FLOOR 1e-5 // -100 dB, so differences in near silence don't dominate
+
+namespace Flan {
+    namespace {
+        // In-place radix-2 FFT, the frame size is a power of two
+        void fft(std::vector<std::complex<double>>& data) {
+            const size_t n = data.size();
+            for (size_t i = 1, j = 0; i < n; ++i) {
+                size_t bit = n >> 1;
+                for (; j & bit; bit >>= 1) {
+                    j ^= bit;
+                }
+                j ^= bit;
+                if (i < j) {
+                    std::swap(data[i], data[j]);
+                }
+            }
+            for (size_t length = 2; length <= n; length <<= 1) {
+                const double angle = -2.0 * 3.14159265358979323846 / static_cast<double>(length);
+                const std::complex<double> step(cos(angle), sin(angle));
+                for (size_t i = 0; i < n; i += length) {
+                    std::complex<double> w(1.0, 0.0);
+                    for (size_t k = 0; k < length / 2; ++k) {
+                        const std::complex<double> even = data[i + k];
+                        const std::complex<double> odd = data[i + k + length / 2] * w;
+                        data[i + k] = even + odd;
+                        data[i + k + length / 2] = even - odd;
+                        w *= step;
+                    }
+                }
+            }
+        }
+
+        // Log magnitude spectrum in dB of one channel of one frame, Hann windowed
+        void spectrum(const std::vector<float>& samples, const size_t frame_start, const int channel, std::vector<double>& out) {
+            std::vector<std::complex<double>> data(SPECTRUM_FRAME_SIZE);
+            for (size_t i = 0; i < SPECTRUM_FRAME_SIZE; ++i) {
+                const size_t index = (frame_start + i) * 2 + channel;
+                const double sample = index < samples.size() ? samples[index] : 0.0;
+                const double window = 0.5 - 0.5 * cos(2.0 * 3.14159265358979323846 * static_cast<double>(i) / SPECTRUM_FRAME_SIZE);
+                data[i] = sample * window;
+            }
+            fft(data);
+            out.resize(SPECTRUM_FRAME_SIZE / 2);
+            for (size_t i = 0; i < out.size(); ++i) {
+                out[i] = 20.0 * log10(std::max(std::abs(data[i]) / (SPECTRUM_FRAME_SIZE / 4), SPECTRUM_FLOOR));
+            }
+        }
+    }
+
+    AudioDifference compare_audio(const std::vector<float>& output, const std::vector<float>& reference) {
+        AudioDifference difference;
+        difference.length_difference = static_cast<long long>(output.size() / 2) - static_cast<long long>(reference.size() / 2);
+
+        // Sample differences, the shorter one is padded with silence
+        const size_t n_samples = std::max(output.size(), reference.size());
+        double sum_squared = 0.0;
+        for (size_t i = 0; i < n_samples; ++i) {
+            const double a = i < output.size() ? output[i] : 0.0;
+            const double b = i < reference.size() ? reference[i] : 0.0;
+            const double error = std::abs(a - b);
+            difference.max_abs_error = std::max(difference.max_abs_error, error);
+            sum_squared += error * error;
+        }
+        if (n_samples > 0) {
+            difference.rms_error = sqrt(sum_squared / static_cast<double>(n_samples));
+        }
+
+        // Spectral difference, over overlapping frames of both channels
+        const size_t n_frames = n_samples / 2;
+        std::vector<double> spectrum_output;
+        std::vector<double> spectrum_reference;
+        double spectral_sum = 0.0;
+        size_t spectral_count = 0;
+        for (size_t frame_start = 0; frame_start < n_frames; frame_start += SPECTRUM_HOP_SIZE) {
+            for (int channel = 0; channel < 2; ++channel) {
+                spectrum(output, frame_start, channel, spectrum_output);
+                spectrum(reference, frame_start, channel, spectrum_reference);
+                for (size_t i = 0; i < spectrum_output.size(); ++i) {
+                    const double error = spectrum_output[i] - spectrum_reference[i];
+                    spectral_sum += error * error;
+                }
+                spectral_count += spectrum_output.size();
+            }
+        }
+        if (spectral_count > 0) {
+            difference.spectral_error = sqrt(spectral_sum / static_cast<double>(spectral_count));
+        }
+        return difference;
+    }
+}
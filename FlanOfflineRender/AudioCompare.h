@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+
+namespace Flan {
+    struct AudioDifference {
+        double max_abs_error = 0.0;     // Largest difference between two samples
+        double rms_error = 0.0;         // RMS of the difference signal
+        double spectral_error = 0.0;    // RMS difference between the log magnitude spectra, in dB
+        long long length_difference = 0; // In sample frames, the shorter render is padded with silence
+    };
+
+    struct AudioTolerance {
+        double max_abs_error = 1e-3;
+        double rms_error = 1e-4;
+        double spectral_error = 0.5;
+    };
+
+    // Compares two interleaved stereo renders. Small differences are expected whenever the DSP code changes,
+    // so it's up to the tolerances to decide whether they drifted too far
+    AudioDifference compare_audio(const std::vector<float>& output, const std::vector<float>& reference);
+
+    [[nodiscard]] inline bool within_tolerance(const AudioDifference& difference, const AudioTolerance& tolerance) {
+        return difference.max_abs_error <= tolerance.max_abs_error
+            && difference.rms_error <= tolerance.rms_error
+            && difference.spectral_error <= tolerance.spectral_error;
+    }
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Synth.h"
+
+// Loads a corpus of soundfonts with a cold and a warm page cache, and splits the load time into phases:
+//  - file I/O: reading the whole file, nothing else
+//  - parse: Soundfont::from_file minus the file I/O, so the chunk walk, hydra parse, zone flattening and sample conversion
+//  - preset list: building the names for the preset dropdown menu, like the editor does after every load
+// Results are written as JSON.
+
+struct Phases {
+    double file_io = 0.0;
+    double from_file = 0.0;
+    double parse = 0.0;
+    double preset_list = 0.0;
+};
+
+struct Result {
+    std::string path;
+    bool cold = false;
+    bool cache_dropped = false;
+    size_t file_size = 0;
+    size_t n_presets = 0;
+    size_t n_samples = 0;
+    Phases median;
+};
+
+// Asks the kernel to forget the cached pages of this file. This doesn't need root, but only drops clean pages
+static bool drop_page_cache(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return dropped;
+}
+
+static double read_whole_file(const std::string& path, size_t& file_size) {
+    const auto start = std::chrono::steady_clock::now();
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return 0.0;
+    }
+    std::vector<char> buffer(1 << 20);
+    file_size = 0;
+    size_t n_read;
+    while ((n_read = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        file_size += n_read;
+    }
+    fclose(file);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0.0 : values[values.size() / 2];
+}
+
+static bool bench_file(const std::string& path, const bool cold, const int n_runs, Result& result) {
+    result.path = path;
+    result.cold = cold;
+    result.cache_dropped = cold;
+
+    std::vector<double> file_io, from_file, parse, preset_list;
+    for (int run = 0; run < n_runs; ++run) {
+        // File I/O on its own
+        if (cold) {
+            result.cache_dropped &= drop_page_cache(path);
+        }
+        const double io_time = read_whole_file(path, result.file_size);
+
+        // The whole load, the same way the plugin does it
+        if (cold) {
+            result.cache_dropped &= drop_page_cache(path);
+        }
+        const PluginState state;
+        const Flan::Scale scale;
+        Flan::Synth synth(state, scale);
+        synth.load_soundfont(path);
+        if (synth.presets.empty()) {
+            return false;
+        }
+        result.n_presets = synth.presets.size();
+        result.n_samples = synth.soundfont.samples.size();
+
+        // Preset names, like update_preset_dropdown_menu
+        const auto list_start = std::chrono::steady_clock::now();
+        std::vector<std::wstring> names;
+        names.reserve(synth.presets.size());
+        for (const Flan::PresetEntry& preset : synth.presets) {
+            names.push_back(Flan::preset_display_name(preset));
+        }
+        const double list_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - list_start).count();
+
+        file_io.push_back(io_time);
+        from_file.push_back(synth.load_timings().from_file);
+        parse.push_back(std::max(0.0, synth.load_timings().from_file - io_time));
+        preset_list.push_back(list_time);
+    }
+
+    result.median = { median(file_io), median(from_file), median(parse), median(preset_list) };
+    return true;
+}
+
+static void write_json(FILE* file, const std::vector<Result>& results, const int n_runs) {
+    fprintf(file, "{\n  \"benchmark\": \"soundfont_load\",\n  \"runs\": %i,\n  \"results\": [\n", n_runs);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::string escaped_path;
+        for (const char c : r.path) {
+            if (c == '"' || c == '\\') escaped_path += '\\';
+            escaped_path += c;
+        }
+        fprintf(file, "    {\"path\": \"%s\", \"cache\": \"%s\", \"cache_dropped\": %s, \"file_size\": %zu, \"presets\": %zu, \"samples\": %zu, "
+            "\"file_io_ms\": %.3f, \"from_file_ms\": %.3f, \"parse_ms\": %.3f, \"preset_list_ms\": %.3f}%s\n",
+            escaped_path.c_str(), r.cold ? "cold" : "warm", r.cache_dropped ? "true" : "false", r.file_size, r.n_presets, r.n_samples,
+            r.median.file_io * 1000.0, r.median.from_file * 1000.0, r.median.parse * 1000.0, r.median.preset_list * 1000.0,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(const int argc, char** argv) {
+    const char* output_path = nullptr;
+    int n_runs = 5;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            n_runs = std::max(1, atoi(argv[++i]));
+        }
+        else {
+            paths.emplace_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        printf("usage: flan_load_benchmark [--runs <n>] [--output <results.json>] <soundfont.sf2|.dls>...\n");
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (const std::string& path : paths) {
+        for (const bool cold : { true, false }) {
+            Result result;
+            if (!bench_file(path, cold, n_runs, result)) {
+                fprintf(stderr, "could not load %s\n", path.c_str());
+                break;
+            }
+            fprintf(stderr, "%s (%s%s, %zu bytes, %zu presets, %zu samples): file I/O %.2f ms, from_file %.2f ms, parse %.2f ms, preset list %.2f ms\n",
+                path.c_str(), cold ? "cold" : "warm", cold && !result.cache_dropped ? ", cache drop failed" : "",
+                result.file_size, result.n_presets, result.n_samples,
+                result.median.file_io * 1000.0, result.median.from_file * 1000.0, result.median.parse * 1000.0, result.median.preset_list * 1000.0);
+            results.push_back(result);
+        }
+    }
+
+    FILE* file = output_path ? fopen(output_path, "w") : stdout;
+    if (file == nullptr) {
+        fprintf(stderr, "could not open %s\n", output_path);
+        return 1;
+    }
+    write_json(file, results, n_runs);
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
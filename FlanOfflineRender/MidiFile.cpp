@@ -0,0 +1,212 @@
+#include "MidiFile.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace Flan {
+    namespace {
+        // Events as they're read from the file, before the tempo map is applied
+        struct RawEvent {
+            uint64_t tick = 0;
+            size_t order = 0;       // Keeps events on the same tick in file order
+            bool is_tempo = false;
+            uint32_t tempo = 0;     // Microseconds per quarter note
+            MidiEvent event;
+        };
+
+        class Reader {
+        public:
+            Reader(const uint8_t* data, const size_t size) : m_data(data), m_size(size) {}
+
+            [[nodiscard]] bool at_end() const { return m_position >= m_size; }
+            [[nodiscard]] size_t position() const { return m_position; }
+            void skip(const size_t n_bytes) { m_position = std::min(m_size, m_position + n_bytes); }
+
+            uint8_t u8() {
+                return at_end() ? 0 : m_data[m_position++];
+            }
+
+            uint32_t u16_be() {
+                const uint32_t high = u8();
+                return (high << 8) | u8();
+            }
+
+            uint32_t u32_be() {
+                const uint32_t high = u16_be();
+                return (high << 16) | u16_be();
+            }
+
+            // Variable length quantity, 7 bits per byte, high bit set on all but the last byte
+            uint32_t vlq() {
+                uint32_t value = 0;
+                for (int i = 0; i < 4; ++i) {
+                    const uint8_t byte = u8();
+                    value = (value << 7) | (byte & 0x7F);
+                    if ((byte & 0x80) == 0) {
+                        break;
+                    }
+                }
+                return value;
+            }
+
+        private:
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_position = 0;
+        };
+
+        void read_track(Reader& reader, const size_t track_end, std::vector<RawEvent>& raw_events) {
+            uint64_t tick = 0;
+            uint8_t running_status = 0;
+
+            while (reader.position() < track_end && !reader.at_end()) {
+                tick += reader.vlq();
+
+                // Handle running status, where the status byte is left out if it's the same as the previous one
+                uint8_t status = reader.u8();
+                uint8_t first_data_byte = 0;
+                bool have_first_data_byte = false;
+                if (status < 0x80) {
+                    first_data_byte = status;
+                    have_first_data_byte = true;
+                    status = running_status;
+                }
+
+                // Meta events
+                if (status == 0xFF) {
+                    const uint8_t type = reader.u8();
+                    const uint32_t length = reader.vlq();
+                    if (type == 0x2F) {
+                        break;
+                    }
+                    if (type == 0x51 && length == 3) {
+                        RawEvent raw;
+                        raw.tick = tick;
+                        raw.order = raw_events.size();
+                        raw.is_tempo = true;
+                        raw.tempo = (static_cast<uint32_t>(reader.u8()) << 16);
+                        raw.tempo |= reader.u16_be();
+                        raw_events.push_back(raw);
+                        continue;
+                    }
+                    reader.skip(length);
+                    continue;
+                }
+
+                // System exclusive, we don't need these
+                if (status == 0xF0 || status == 0xF7) {
+                    reader.skip(reader.vlq());
+                    continue;
+                }
+
+                // Channel messages
+                running_status = status;
+                const uint8_t data1 = have_first_data_byte ? first_data_byte : reader.u8();
+                const uint8_t kind = status & 0xF0;
+                const bool has_second_data_byte = kind != 0xC0 && kind != 0xD0;
+                const uint8_t data2 = has_second_data_byte ? reader.u8() : 0;
+
+                RawEvent raw;
+                raw.tick = tick;
+                raw.order = raw_events.size();
+                raw.event.channel = status & 0x0F;
+                raw.event.status = status;
+                raw.event.data1 = data1;
+                raw.event.data2 = data2;
+                switch (kind) {
+                case 0x90:
+                    raw.event.type = data2 == 0 ? MidiEventType::note_off : MidiEventType::note_on;
+                    raw.event.key = data1;
+                    raw.event.velocity = data2;
+                    break;
+                case 0x80:
+                    raw.event.type = MidiEventType::note_off;
+                    raw.event.key = data1;
+                    break;
+                case 0xE0:
+                    raw.event.type = MidiEventType::pitch_bend;
+                    raw.event.pitch_bend = ((static_cast<int>(data2) << 7) | data1) - 8192;
+                    break;
+                case 0xB0:
+                    raw.event.type = MidiEventType::control_change;
+                    break;
+                case 0xC0:
+                    raw.event.type = MidiEventType::program_change;
+                    break;
+                default:
+                    continue;
+                }
+                raw_events.push_back(raw);
+            }
+        }
+    }
+
+    bool MidiFile::from_file(const std::string& path) {
+        events.clear();
+        length = 0.0;
+
+        // Read the whole file
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        Reader reader(data.data(), data.size());
+
+        // Header
+        char chunk_id[4];
+        for (char& c : chunk_id) c = static_cast<char>(reader.u8());
+        if (memcmp(chunk_id, "MThd", 4) != 0) {
+            return false;
+        }
+        const uint32_t header_length = reader.u32_be();
+        reader.u16_be(); // format, tracks are merged either way
+        const uint32_t n_tracks = reader.u16_be();
+        const uint32_t division = reader.u16_be();
+        reader.skip(header_length - 6);
+
+        // Tracks
+        std::vector<RawEvent> raw_events;
+        for (uint32_t track = 0; track < n_tracks && !reader.at_end(); ++track) {
+            for (char& c : chunk_id) c = static_cast<char>(reader.u8());
+            const uint32_t chunk_length = reader.u32_be();
+            const size_t chunk_end = reader.position() + chunk_length;
+            if (memcmp(chunk_id, "MTrk", 4) == 0) {
+                read_track(reader, chunk_end, raw_events);
+            }
+            reader.skip(chunk_end - std::min(chunk_end, reader.position()));
+        }
+
+        // Merge the tracks
+        std::sort(raw_events.begin(), raw_events.end(), [](const RawEvent& lhs, const RawEvent& rhs) {
+            if (lhs.tick != rhs.tick) {
+                return lhs.tick < rhs.tick;
+            }
+            return lhs.order < rhs.order;
+        });
+
+        // Convert ticks to seconds. SMPTE divisions have a fixed number of ticks per second, otherwise it depends on the tempo
+        const bool is_smpte = (division & 0x8000) != 0;
+        const double smpte_ticks_per_second = static_cast<double>(-static_cast<int8_t>(division >> 8)) * static_cast<double>(division & 0xFF);
+        const double ticks_per_quarter_note = static_cast<double>(std::max<uint32_t>(1, division));
+        double seconds_per_tick = is_smpte ? 1.0 / smpte_ticks_per_second : 0.5 / ticks_per_quarter_note;
+        uint64_t last_tick = 0;
+        double time = 0.0;
+        for (const RawEvent& raw : raw_events) {
+            time += static_cast<double>(raw.tick - last_tick) * seconds_per_tick;
+            last_tick = raw.tick;
+            if (raw.is_tempo) {
+                if (!is_smpte) {
+                    seconds_per_tick = static_cast<double>(raw.tempo) / 1000000.0 / ticks_per_quarter_note;
+                }
+                continue;
+            }
+            MidiEvent event = raw.event;
+            event.time = time;
+            events.push_back(event);
+        }
+        length = time;
+        return true;
+    }
+}
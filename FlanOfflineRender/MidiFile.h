@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Flan {
+    enum class MidiEventType {
+        note_on,
+        note_off,
+        pitch_bend,
+        control_change,
+        program_change,
+    };
+
+    struct MidiEvent {
+        double time = 0.0;          // In seconds, with all tempo changes applied
+        MidiEventType type = MidiEventType::note_on;
+        uint8_t channel = 0;
+        uint8_t key = 0;            // note_on, note_off
+        uint8_t velocity = 0;       // note_on
+        int pitch_bend = 0;         // pitch_bend, -8192..8191
+        uint8_t status = 0;         // The message as it was in the file, for passing it on as MIDI
+        uint8_t data1 = 0;
+        uint8_t data2 = 0;
+    };
+
+    // Standard MIDI File reader. All tracks are merged into one list of events, sorted by time
+    class MidiFile {
+    public:
+        bool from_file(const std::string& path);
+
+        std::vector<MidiEvent> events;
+        double length = 0.0;        // Time of the last event, in seconds
+    };
+}
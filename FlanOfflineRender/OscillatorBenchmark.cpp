@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "WavetableOscillator.h"
+
+// Measures WavetableOscillator::get_sample and Voice::get_sample in isolation, on synthetic samples and zones,
+// for every sampling mode. Results are written as JSON, so they can be compared between commits.
+
+#define BENCH_SAMPLE_RATE 44100.0
+#define BENCH_SAMPLE_LENGTH (1 << 18)   // Long enough that one-shots don't run out during a run
+#define BENCH_FRAMES_PER_RUN 8192
+#define BENCH_VOICES 32
+#define BENCH_LAYERS 4                  // Oscillators per voice for the Voice::get_sample cases
+#define BENCH_RUNS 5                    // Best run is reported
+
+struct Fixture {
+    std::string name;
+    const char* sample_type_name;
+    SampleType sample_type;
+    bool looped;
+    double pitch_ratio;
+    bool filter;
+    bool modulation;
+};
+
+struct Result {
+    Fixture fixture;
+    std::string target;     // "oscillator" or "voice"
+    int sampling_mode;
+    double ns_per_frame_per_voice;
+};
+
+// Sample data shared by all fixtures: a sine for the left/mono channel, a slightly detuned one for the linked channel
+static std::vector<i16> sample_data;
+static std::vector<i16> linked_data;
+
+static void init_sample_data() {
+    sample_data.resize(BENCH_SAMPLE_LENGTH + 4);
+    linked_data.resize(BENCH_SAMPLE_LENGTH + 4);
+    for (size_t i = 0; i < sample_data.size(); ++i) {
+        const double t = static_cast<double>(i) / BENCH_SAMPLE_RATE;
+        sample_data[i] = static_cast<i16>(sin(t * 2.0 * 3.14159265358979 * 261.63) * 16000.0);
+        linked_data[i] = static_cast<i16>(sin(t * 2.0 * 3.14159265358979 * 262.00) * 16000.0);
+    }
+}
+
+static Flan::WavetableOscillator make_oscillator(const Fixture& fixture, const Flan::VoiceParams* voice_params) {
+    Flan::WavetableOscillator osc;
+
+    // Sample
+    osc.sample.data = sample_data.data();
+    osc.sample.linked = linked_data.data();
+    osc.sample.length = BENCH_SAMPLE_LENGTH;
+    osc.sample.loop_start = 1024;
+    osc.sample.loop_end = 1024 + 44100;
+    osc.sample.base_sample_rate = static_cast<u32>(BENCH_SAMPLE_RATE);
+    osc.sample.type = fixture.sample_type;
+
+    // Zone
+    osc.preset_zone.loop_enable = fixture.looped;
+    osc.preset_zone.filter.cutoff = fixture.filter ? 1000.0f : 20000.0f;
+    if (fixture.modulation) {
+        osc.preset_zone.vib_lfo_to_pitch = 50;
+        osc.preset_zone.mod_lfo_to_pitch = 20;
+        osc.preset_zone.mod_lfo_to_volume = 3;
+        osc.preset_zone.mod_lfo_to_filter = 600;
+        osc.preset_zone.mod_env_to_pitch = 100;
+        osc.preset_zone.mod_env_to_filter = 1200;
+    }
+    osc.filter = osc.preset_zone.filter;
+
+    // Start in the sustain stage, so every frame goes through the whole path
+    osc.vol_env.stage = static_cast<double>(Flan::EnvStage::sustain);
+    osc.vol_env.value = 0.0;
+    osc.mod_env.stage = static_cast<double>(Flan::EnvStage::sustain);
+    osc.midi_key = 60;
+    osc.update_levels(voice_params->final_levels, 0.0);
+    osc.sample_delta = fixture.pitch_ratio;
+    return osc;
+}
+
+// Runs `frames` frames for every voice and returns how long that took per frame per voice
+template <typename Render>
+static double time_run(const Render& render, const size_t n_voices) {
+    double best = 1e30;
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        render();
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / static_cast<double>(BENCH_FRAMES_PER_RUN * n_voices));
+    }
+    return best;
+}
+
+static double bench_oscillators(const Fixture& fixture, const int sampling_mode, const Flan::VoiceParams* voice_params) {
+    const Flan::WavetableOscillator prototype = make_oscillator(fixture, voice_params);
+    std::vector<Flan::WavetableOscillator> oscs(BENCH_VOICES, prototype);
+    volatile float sink = 0.0f;
+
+    return time_run([&]() {
+        // Start every run from the same state, so one-shots don't end up in the cheap "off" path
+        std::fill(oscs.begin(), oscs.end(), prototype);
+        float total = 0.0f;
+        for (int frame = 0; frame < BENCH_FRAMES_PER_RUN; ++frame) {
+            for (auto& osc : oscs) {
+                const Flan::BufferSample sample = osc.get_sample(1.0 / BENCH_SAMPLE_RATE, sampling_mode);
+                total += sample.left + sample.right;
+            }
+        }
+        sink = sink + total;
+    }, oscs.size());
+}
+
+static double bench_voices(const Fixture& fixture, const int sampling_mode, const Flan::VoiceParams* voice_params) {
+    const Flan::WavetableOscillator prototype = make_oscillator(fixture, voice_params);
+    std::vector<Flan::Voice> voices(BENCH_VOICES);
+    for (auto& voice : voices) {
+        voice.voice_params = voice_params;
+        for (int layer = 0; layer < BENCH_LAYERS; ++layer) {
+            voice.wave_oscs.push_back(new Flan::WavetableOscillator(prototype));
+        }
+    }
+    volatile float sink = 0.0f;
+
+    return time_run([&]() {
+        for (auto& voice : voices) {
+            for (auto* osc : voice.wave_oscs) {
+                *osc = prototype;
+            }
+        }
+        float total = 0.0f;
+        for (int frame = 0; frame < BENCH_FRAMES_PER_RUN; ++frame) {
+            for (auto& voice : voices) {
+                const Flan::BufferSample sample = voice.get_sample(1.0 / BENCH_SAMPLE_RATE, sampling_mode);
+                total += sample.left + sample.right;
+            }
+        }
+        sink = sink + total;
+    }, voices.size());
+}
+
+static std::vector<Fixture> make_fixtures() {
+    struct SampleKind {
+        const char* name;
+        SampleType type;
+    };
+    const SampleKind kinds[] = {
+        { "mono", monoSample },
+        { "left", leftSample },
+        { "right", rightSample },
+    };
+    const double pitch_ratios[] = { 0.5, 1.0, 1.4983, 2.0 };
+
+    std::vector<Fixture> fixtures;
+    for (const auto& kind : kinds) {
+        for (const bool looped : { true, false }) {
+            for (const double ratio : pitch_ratios) {
+                for (const bool filter : { false, true }) {
+                    for (const bool modulation : { false, true }) {
+                        char name[128];
+                        snprintf(name, sizeof(name), "%s_%s_x%.2f%s%s", kind.name, looped ? "looped" : "oneshot", ratio,
+                            filter ? "_filter" : "", modulation ? "_mod" : "");
+                        fixtures.push_back({ name, kind.name, kind.type, looped, ratio, filter, modulation });
+                    }
+                }
+            }
+        }
+    }
+    return fixtures;
+}
+
+static void write_json(FILE* file, const std::vector<Result>& results) {
+    fprintf(file, "{\n  \"benchmark\": \"oscillator\",\n  \"frames_per_run\": %i,\n  \"voices\": %i,\n  \"layers\": %i,\n  \"results\": [\n",
+        BENCH_FRAMES_PER_RUN, BENCH_VOICES, BENCH_LAYERS);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"target\": \"%s\", \"sampling_mode\": %i, \"sample_type\": \"%s\", \"looped\": %s, \"pitch_ratio\": %.4f, "
+            "\"filter\": %s, \"modulation\": %s, \"ns_per_frame_per_voice\": %.3f}%s\n",
+            r.fixture.name.c_str(), r.target.c_str(), r.sampling_mode, r.fixture.sample_type_name, r.fixture.looped ? "true" : "false", r.fixture.pitch_ratio,
+            r.fixture.filter ? "true" : "false", r.fixture.modulation ? "true" : "false", r.ns_per_frame_per_voice,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(const int argc, char** argv) {
+    // Optional arguments: output path (default stdout) and a filter on the fixture name
+    const char* output_path = argc > 1 ? argv[1] : nullptr;
+    const std::string name_filter = argc > 2 ? argv[2] : "";
+
+    Flan::init_bell_curve();
+    Flan::init_sinc_tables();
+    init_sample_data();
+
+    Flan::VoiceParams voice_params{};
+    voice_params.init_levels.vol = 1.0f;
+    voice_params.final_levels.vol = 1.0f;
+
+    std::vector<Result> results;
+    for (const Fixture& fixture : make_fixtures()) {
+        if (!name_filter.empty() && fixture.name.find(name_filter) == std::string::npos) {
+            continue;
+        }
+        for (int sampling_mode = 0; sampling_mode < N_SAMPLING_MODES; ++sampling_mode) {
+            results.push_back({ fixture, "oscillator", sampling_mode, bench_oscillators(fixture, sampling_mode, &voice_params) });
+            results.push_back({ fixture, "voice", sampling_mode, bench_voices(fixture, sampling_mode, &voice_params) });
+            fprintf(stderr, "%-40s mode %i: %8.2f ns/frame/osc, %8.2f ns/frame/voice\n", fixture.name.c_str(), sampling_mode,
+                results[results.size() - 2].ns_per_frame_per_voice, results.back().ns_per_frame_per_voice);
+        }
+    }
+
+    FILE* file = output_path ? fopen(output_path, "w") : stdout;
+    if (file == nullptr) {
+        fprintf(stderr, "could not open %s\n", output_path);
+        return 1;
+    }
+    write_json(file, results);
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
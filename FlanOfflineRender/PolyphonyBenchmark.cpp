@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Synth.h"
+
+// Ramps the number of active voices and measures how much of the real-time budget a block costs, through the same
+// trigger_voice and render calls the plugin uses. From that it estimates how many voices one core can sustain,
+// per preset type, sample rate and sampling mode. Results are written as JSON.
+
+#define POLY_BLOCK_SIZE 512
+#define POLY_WARMUP_BLOCKS 8
+#define POLY_MEASURE_BLOCKS 64
+#define POLY_MAX_VOICES 1024
+#define POLY_SAMPLE_RATE 44100           // Rate the synthetic samples are recorded at
+#define POLY_LOOPED_LENGTH 44100
+#define POLY_DRUM_LENGTH 13230           // 0.3 seconds
+
+struct PresetType {
+    const char* name;
+    u16 preset_key;
+};
+
+struct Measurement {
+    int n_voices;
+    double mean_percent;    // Average block cost, in percent of the real-time budget
+    double max_percent;
+};
+
+struct Result {
+    const char* preset;
+    int sample_rate;
+    int sampling_mode;
+    std::vector<Measurement> measurements;
+    double max_voices;      // Estimated voice count that uses exactly the budget
+};
+
+static std::vector<i16> sample_storage;
+
+// Builds three presets: a single looped layer, 4 stereo layers (two left/right pairs), and a one-shot drum
+static void build_soundfont(Flan::Soundfont& soundfont) {
+    sample_storage.resize(POLY_LOOPED_LENGTH * 2 + POLY_DRUM_LENGTH + 16);
+    i16* looped_left = sample_storage.data();
+    i16* looped_right = looped_left + POLY_LOOPED_LENGTH;
+    i16* drum = looped_right + POLY_LOOPED_LENGTH;
+    for (int i = 0; i < POLY_LOOPED_LENGTH; ++i) {
+        const double t = static_cast<double>(i) / POLY_SAMPLE_RATE;
+        looped_left[i] = static_cast<i16>(sin(t * 2.0 * 3.14159265358979 * 261.63) * 12000.0);
+        looped_right[i] = static_cast<i16>(sin(t * 2.0 * 3.14159265358979 * 262.10) * 12000.0);
+    }
+    for (int i = 0; i < POLY_DRUM_LENGTH; ++i) {
+        const double t = static_cast<double>(i) / POLY_SAMPLE_RATE;
+        drum[i] = static_cast<i16>(sin(t * 2.0 * 3.14159265358979 * 80.0) * exp(-t * 12.0) * 20000.0);
+    }
+
+    auto make_sample = [](i16* data, i16* linked, const u32 length, const bool looped, const SampleType type) {
+        Sample sample{};
+        sample.data = data;
+        sample.linked = linked;
+        sample.length = length;
+        sample.loop_start = looped ? 16 : 0;
+        sample.loop_end = looped ? length - 16 : 0;
+        sample.base_sample_rate = POLY_SAMPLE_RATE;
+        sample.type = type;
+        return sample;
+    };
+    soundfont.samples.clear();
+    soundfont.samples.push_back(make_sample(looped_left, looped_right, POLY_LOOPED_LENGTH, true, monoSample));
+    soundfont.samples.push_back(make_sample(looped_left, looped_right, POLY_LOOPED_LENGTH, true, leftSample));
+    soundfont.samples.push_back(make_sample(looped_right, looped_left, POLY_LOOPED_LENGTH, true, rightSample));
+    soundfont.samples.push_back(make_sample(drum, drum, POLY_DRUM_LENGTH, false, monoSample));
+
+    auto make_zone = [](const u32 sample_index, const bool looped, const float pan) {
+        Zone zone{};
+        zone.key_range_low = 0;
+        zone.key_range_high = 127;
+        zone.vel_range_low = 0;
+        zone.vel_range_high = 127;
+        zone.vel_override = 255;
+        zone.key_override = 255;
+        zone.scale_tuning = 1;
+        zone.sample_index = sample_index;
+        zone.loop_enable = looped;
+        zone.pan = pan;
+        zone.filter.cutoff = 20000.0f;
+        return zone;
+    };
+    soundfont.presets.clear();
+
+    Preset looped;
+    looped.name = "Single layer looped";
+    looped.zones.push_back(make_zone(0, true, 0.0f));
+    soundfont.presets[0x0000] = looped;
+
+    Preset stereo;
+    stereo.name = "4 layer stereo";
+    stereo.zones.push_back(make_zone(1, true, -1.0f));
+    stereo.zones.push_back(make_zone(2, true, 1.0f));
+    stereo.zones.push_back(make_zone(1, true, -1.0f));
+    stereo.zones.push_back(make_zone(2, true, 1.0f));
+    soundfont.presets[0x0001] = stereo;
+
+    Preset drums;
+    drums.name = "Drum one-shot";
+    drums.zones.push_back(make_zone(3, false, 0.0f));
+    soundfont.presets[0x8000] = drums;
+}
+
+static Result bench_preset(const PresetType& preset, const int sample_rate, const int sampling_mode, const double budget) {
+    Result result{ preset.name, sample_rate, sampling_mode, {}, 0.0 };
+
+    // One set of voice params per key, FL Studio keeps these alive while the voice plays and so do we
+    std::vector<Flan::VoiceParams> voice_params(48);
+    for (size_t i = 0; i < voice_params.size(); ++i) {
+        voice_params[i].init_levels = { 0.0f, 0.8f, static_cast<float>((static_cast<int>(i) - 24) * 100), 0.0f, 0.0f };
+        voice_params[i].final_levels = voice_params[i].init_levels;
+    }
+
+    for (int n_voices = 1; n_voices <= POLY_MAX_VOICES; n_voices *= 2) {
+        PluginState state;
+        state.bank = static_cast<u16>(preset.preset_key >> 8);
+        state.program = static_cast<u16>(preset.preset_key & 0xFF);
+        state.sampling_mode = sampling_mode;
+        const Flan::Scale scale;
+        Flan::Synth synth(state, scale);
+        build_soundfont(synth.soundfont);
+        synth.index_presets();
+        synth.set_sample_rate(sample_rate);
+
+        // Keep the voice count up, one-shots get retriggered as soon as they're killed
+        int n_killed = 0;
+        synth.on_voice_killed = [&n_killed](const Flan::Voice* voice) {
+            delete voice;
+            ++n_killed;
+        };
+        intptr_t next_tag = 1;
+        auto trigger = [&](const int count) {
+            for (int i = 0; i < count; ++i) {
+                synth.trigger_voice(&voice_params[next_tag % voice_params.size()], next_tag);
+                ++next_tag;
+            }
+        };
+        trigger(n_voices);
+
+        std::vector<float> buffer(POLY_BLOCK_SIZE * 2);
+        const double block_seconds = static_cast<double>(POLY_BLOCK_SIZE) / sample_rate;
+        double total_percent = 0.0;
+        double max_percent = 0.0;
+        for (int block = 0; block < POLY_WARMUP_BLOCKS + POLY_MEASURE_BLOCKS; ++block) {
+            const auto start = std::chrono::steady_clock::now();
+            synth.render(buffer.data(), POLY_BLOCK_SIZE);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            trigger(n_killed);
+            n_killed = 0;
+
+            // The plugin does this on the loader thread, so it doesn't count towards the block
+            if (synth.one_shots_pending()) {
+                synth.render_one_shots();
+            }
+
+            if (block >= POLY_WARMUP_BLOCKS) {
+                const double percent = elapsed.count() / block_seconds * 100.0;
+                total_percent += percent;
+                max_percent = std::max(max_percent, percent);
+            }
+        }
+        const double mean_percent = total_percent / POLY_MEASURE_BLOCKS;
+        result.measurements.push_back({ n_voices, mean_percent, max_percent });
+        fprintf(stderr, "%-20s %6i Hz mode %i %5i voices: %7.2f%% avg, %7.2f%% max\n",
+            preset.name, sample_rate, sampling_mode, n_voices, mean_percent, max_percent);
+
+        // No need to keep going once we're well past the budget
+        if (mean_percent > budget * 200.0) {
+            break;
+        }
+    }
+
+    // Find where the average cost crosses the budget, interpolating between the measured voice counts
+    const double budget_percent = budget * 100.0;
+    const auto& m = result.measurements;
+    result.max_voices = m.back().mean_percent <= budget_percent ? m.back().n_voices : 0.0;
+    for (size_t i = 0; i < m.size(); ++i) {
+        if (m[i].mean_percent <= budget_percent) {
+            continue;
+        }
+        if (i == 0) {
+            result.max_voices = 0.0;
+            break;
+        }
+        const double t = (budget_percent - m[i - 1].mean_percent) / (m[i].mean_percent - m[i - 1].mean_percent);
+        result.max_voices = m[i - 1].n_voices + t * (m[i].n_voices - m[i - 1].n_voices);
+        break;
+    }
+    return result;
+}
+
+static void write_json(FILE* file, const std::vector<Result>& results, const double budget) {
+    fprintf(file, "{\n  \"benchmark\": \"polyphony\",\n  \"block_size\": %i,\n  \"budget\": %.3f,\n  \"results\": [\n", POLY_BLOCK_SIZE, budget);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(file, "    {\"preset\": \"%s\", \"sample_rate\": %i, \"sampling_mode\": %i, \"max_voices_per_core\": %.1f, \"measurements\": [",
+            r.preset, r.sample_rate, r.sampling_mode, r.max_voices);
+        for (size_t j = 0; j < r.measurements.size(); ++j) {
+            const Measurement& m = r.measurements[j];
+            fprintf(file, "{\"voices\": %i, \"mean_percent\": %.3f, \"max_percent\": %.3f}%s",
+                m.n_voices, m.mean_percent, m.max_percent, j + 1 < r.measurements.size() ? ", " : "");
+        }
+        fprintf(file, "]}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(const int argc, char** argv) {
+    // Optional arguments: output path (default stdout), and the fraction of a block's real-time budget we allow to be used
+    const char* output_path = argc > 1 ? argv[1] : nullptr;
+    const double budget = argc > 2 ? atof(argv[2]) : 1.0;
+
+    Flan::init_bell_curve();
+    Flan::init_sinc_tables();
+
+    const PresetType presets[] = {
+        { "looped", 0x0000 },
+        { "stereo_4_layer", 0x0001 },
+        { "drum_oneshot", 0x8000 },
+    };
+    const int sample_rates[] = { 44100, 48000, 96000 };
+
+    std::vector<Result> results;
+    for (const auto& preset : presets) {
+        for (const int sample_rate : sample_rates) {
+            for (int sampling_mode = 0; sampling_mode < N_SAMPLING_MODES; ++sampling_mode) {
+                results.push_back(bench_preset(preset, sample_rate, sampling_mode, budget));
+            }
+        }
+    }
+
+    // Summary table
+    fprintf(stderr, "\nMax sustainable voices per core at %.0f%% of the budget:\n", budget * 100.0);
+    for (const Result& r : results) {
+        fprintf(stderr, "  %-16s %6i Hz  mode %i: %7.1f\n", r.preset, r.sample_rate, r.sampling_mode, r.max_voices);
+    }
+
+    FILE* file = output_path ? fopen(output_path, "w") : stdout;
+    if (file == nullptr) {
+        fprintf(stderr, "could not open %s\n", output_path);
+        return 1;
+    }
+    write_json(file, results, budget);
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
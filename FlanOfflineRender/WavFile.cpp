@@ -0,0 +1,130 @@
+#include "WavFile.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace Flan {
+    namespace {
+        void write_u16(std::ofstream& file, const uint16_t value) {
+            const char bytes[2] = { static_cast<char>(value & 0xFF), static_cast<char>(value >> 8) };
+            file.write(bytes, 2);
+        }
+
+        void write_u32(std::ofstream& file, const uint32_t value) {
+            write_u16(file, static_cast<uint16_t>(value & 0xFFFF));
+            write_u16(file, static_cast<uint16_t>(value >> 16));
+        }
+
+        uint32_t read_u32(std::ifstream& file) {
+            uint8_t bytes[4]{};
+            file.read(reinterpret_cast<char*>(bytes), 4);
+            return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+        }
+    }
+
+    bool write_wav(const std::string& path, const std::vector<float>& samples, const int sample_rate) {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        constexpr uint16_t n_channels = 2;
+        constexpr uint16_t bytes_per_sample = sizeof(float);
+        const uint32_t data_size = static_cast<uint32_t>(samples.size() * bytes_per_sample);
+
+        // RIFF header, float formats need a fact chunk on top of the usual fmt and data chunks
+        file.write("RIFF", 4);
+        write_u32(file, 4 + (8 + 18) + (8 + 4) + (8 + data_size));
+        file.write("WAVE", 4);
+
+        // Format chunk
+        file.write("fmt ", 4);
+        write_u32(file, 18);
+        write_u16(file, 3); // WAVE_FORMAT_IEEE_FLOAT
+        write_u16(file, n_channels);
+        write_u32(file, static_cast<uint32_t>(sample_rate));
+        write_u32(file, static_cast<uint32_t>(sample_rate) * n_channels * bytes_per_sample);
+        write_u16(file, n_channels * bytes_per_sample);
+        write_u16(file, bytes_per_sample * 8);
+        write_u16(file, 0);
+
+        // Fact chunk, number of sample frames
+        file.write("fact", 4);
+        write_u32(file, 4);
+        write_u32(file, static_cast<uint32_t>(samples.size() / n_channels));
+
+        // Sample data, WAV is little endian like every machine we render on
+        file.write("data", 4);
+        write_u32(file, data_size);
+        file.write(reinterpret_cast<const char*>(samples.data()), data_size);
+
+        return file.good();
+    }
+
+    bool read_wav(const std::string& path, std::vector<float>& samples, int& sample_rate) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        char id[4];
+        file.read(id, 4);
+        read_u32(file);
+        char wave[4];
+        file.read(wave, 4);
+        if (memcmp(id, "RIFF", 4) != 0 || memcmp(wave, "WAVE", 4) != 0) {
+            return false;
+        }
+
+        // Walk the chunks until we've found both the format and the data
+        uint16_t format = 0;
+        uint16_t n_channels = 0;
+        uint16_t bits_per_sample = 0;
+        while (file.read(id, 4)) {
+            const uint32_t chunk_size = read_u32(file);
+            if (memcmp(id, "fmt ", 4) == 0) {
+                std::vector<uint8_t> fmt(std::max<uint32_t>(chunk_size, 16));
+                file.read(reinterpret_cast<char*>(fmt.data()), chunk_size);
+                format = static_cast<uint16_t>(fmt[0] | (fmt[1] << 8));
+                n_channels = static_cast<uint16_t>(fmt[2] | (fmt[3] << 8));
+                sample_rate = static_cast<int>(fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | (static_cast<uint32_t>(fmt[7]) << 24));
+                bits_per_sample = static_cast<uint16_t>(fmt[14] | (fmt[15] << 8));
+            }
+            else if (memcmp(id, "data", 4) == 0) {
+                const bool is_float = format == 3 && bits_per_sample == 32;
+                const bool is_pcm16 = format == 1 && bits_per_sample == 16;
+                if ((!is_float && !is_pcm16) || n_channels < 1 || n_channels > 2) {
+                    return false;
+                }
+                std::vector<uint8_t> data(chunk_size);
+                file.read(reinterpret_cast<char*>(data.data()), chunk_size);
+
+                // Convert to interleaved stereo floats
+                const size_t bytes_per_sample = bits_per_sample / 8;
+                const size_t n_frames = chunk_size / (bytes_per_sample * n_channels);
+                samples.resize(n_frames * 2);
+                for (size_t frame = 0; frame < n_frames; ++frame) {
+                    for (size_t channel = 0; channel < 2; ++channel) {
+                        const size_t offset = (frame * n_channels + std::min<size_t>(channel, n_channels - 1)) * bytes_per_sample;
+                        float value;
+                        if (is_float) {
+                            memcpy(&value, &data[offset], sizeof(float));
+                        }
+                        else {
+                            int16_t pcm;
+                            memcpy(&pcm, &data[offset], sizeof(int16_t));
+                            value = static_cast<float>(pcm) / 32768.0f;
+                        }
+                        samples[frame * 2 + channel] = value;
+                    }
+                }
+                return true;
+            }
+            else {
+                file.seekg(chunk_size + (chunk_size & 1), std::ios::cur);
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace Flan {
+    // Writes interleaved stereo samples to a 32-bit float WAV file, so nothing gets clipped or dithered
+    bool write_wav(const std::string& path, const std::vector<float>& samples, int sample_rate);
+
+    // Reads a 32-bit float or 16-bit PCM WAV file into interleaved stereo samples, mono files get duplicated to both channels
+    bool read_wav(const std::string& path, std::vector<float>& samples, int& sample_rate);
+}
@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Synth.h"
+#include "MidiFile.h"
+#include "WavFile.h"
+#include "AudioCompare.h"
+
+// Renders a Standard MIDI File with a soundfont, using the same engine as the plugin but without FL Studio.
+// Notes are started and stopped between blocks, exactly where they happen in the MIDI file.
+// With a reference render it doubles as a regression check, so DSP changes that alter the sound don't go unnoticed.
+
+struct Options {
+    std::string soundfont_path;
+    std::string midi_path;
+    std::string output_path;
+    std::string scale_path;
+    std::string reference_path;
+    std::string memory_report_path;
+    std::string trace_path;
+    int sample_rate = 44100;
+    int block_size = 512;
+    int bank = 0;
+    int program = 0;
+    int sampling_mode = 2;             // -1 renders every sampling mode
+    double tail = 5.0;                  // Maximum time to keep rendering after the last MIDI event, in seconds
+    double pitch_bend_range = 2.0;      // In semitones
+    double silence_floor_db = -90.0;
+    bool per_voice = false;             // Render through render_voice like a hybrid generator, instead of render
+    Flan::OutputRouting output_routing; // Outputs past the main one are written next to it, as song_out1.wav and so on
+    bool multitimbral = false;          // Pass the MIDI file to the synth as MIDI, every channel with its own program
+    bool event_offsets = false;         // Keep rendering whole blocks and start and stop notes at their frame inside one
+    bool sample_mipmaps = false;        // Read high notes from the lower rate copies of the samples
+    bool host_rate_samples = false;     // Resample the samples to the output rate before rendering
+    bool multirate = false;             // Render the voices that don't need the full rate at half of it
+    double governor_budget = 0.0;       // Fraction of the real-time budget the quality governor keeps blocks in, 0 leaves it off so renders repeat exactly
+    Flan::AudioTolerance tolerance;
+};
+
+// Stands in for FL Studio: keeps track of which notes are playing, and owns their voice params like FL would
+class OfflineHost {
+public:
+    explicit OfflineHost(Flan::Synth& synth) : m_synth(synth) {
+        m_synth.on_voice_killed = [this](Flan::Voice* voice) {
+            voice_killed(voice);
+        };
+    }
+
+    ~OfflineHost() {
+        m_synth.on_voice_killed = nullptr;
+    }
+
+    void note_on(const uint8_t channel, const uint8_t key, const uint8_t velocity, const int offset) {
+        // FL Studio passes velocity as volume, and the engine turns it back into a MIDI velocity
+        auto params = std::make_unique<Flan::VoiceParams>();
+        params->init_levels = { 0.0f, Flan::midi_velocity_to_volume(velocity), static_cast<float>((key - 60) * 100), 0.0f, 0.0f };
+        params->final_levels = params->init_levels;
+
+        Flan::Voice* voice = m_synth.trigger_voice(params.get(), m_next_voice_tag++, offset);
+        if (voice == nullptr) {
+            return;
+        }
+        m_notes.push_back({ channel, key, false, voice, std::move(params) });
+    }
+
+    void note_off(const uint8_t channel, const uint8_t key, const int offset) {
+        for (auto& note : m_notes) {
+            if (note.channel == channel && note.key == key && !note.released) {
+                Flan::trace_instant("note_off", 0, note.voice->voice_tag);
+                note.voice->release_after(offset);
+                note.released = true;
+                return;
+            }
+        }
+    }
+
+    [[nodiscard]] size_t n_notes() const { return m_notes.size(); }
+
+    // Renders every voice on its own and mixes them here, the way FL does with a hybrid generator
+    void render_voices(float* dest, const int length) {
+        std::fill_n(dest, static_cast<size_t>(length) * 2, 0.0f);
+        m_voice_buffer.resize(static_cast<size_t>(length) * 2);
+        const std::vector<Flan::Voice*> voices = m_synth.active_voices;
+        for (Flan::Voice* voice : voices) {
+            const bool playing = m_synth.render_voice(voice, m_voice_buffer.data(), length);
+            for (size_t i = 0; i < m_voice_buffer.size(); ++i) {
+                dest[i] += m_voice_buffer[i];
+            }
+            if (!playing) {
+                forget_voice(voice);
+                m_synth.kill_voice(voice);
+            }
+        }
+    }
+
+private:
+    struct Note {
+        uint8_t channel;
+        uint8_t key;
+        bool released;
+        Flan::Voice* voice;
+        std::unique_ptr<Flan::VoiceParams> params;
+    };
+
+    void forget_voice(const Flan::Voice* voice) {
+        const auto note = std::find_if(m_notes.begin(), m_notes.end(), [voice](const Note& n) {
+            return n.voice == voice;
+        });
+        if (note != m_notes.end()) {
+            m_notes.erase(note);
+        }
+    }
+
+    // The synth already removed the voice from its active voices, so it's ours to delete
+    void voice_killed(Flan::Voice* voice) {
+        forget_voice(voice);
+        delete voice;
+    }
+
+    Flan::Synth& m_synth;
+    std::vector<Note> m_notes;
+    std::vector<float> m_voice_buffer;
+    intptr_t m_next_voice_tag = 1;
+};
+
+static void print_usage() {
+    printf("usage: flan_offline_render <soundfont.sf2|.dls> <song.mid> <output.wav> [options]\n");
+    printf("  --sample-rate <hz>      default 44100\n");
+    printf("  --block-size <samples>  default 512\n");
+    printf("  --bank <n>              default 0\n");
+    printf("  --program <n>           default 0\n");
+    printf("  --sampling-mode <n>     0 = point, 1 = linear, 2 = gaussian (default), 3, 4, 5 = 8, 16, 32-point sinc, all = one file per mode\n");
+    printf("  --scale <file.scl>      default 12-TET\n");
+    printf("  --tail <seconds>        maximum release tail after the last event, default 5\n");
+    printf("  --bend-range <semis>    pitch wheel range, default 2\n");
+    printf("  --silence-floor <dB>    released notes quieter than this are stopped, default -90\n");
+    printf("  --per-voice             render every voice separately and mix them afterwards, like FL does with a hybrid generator\n");
+    printf("  --multitimbral          play every MIDI channel with its own program change, channel 10 as drums, ignores --bank and --program\n");
+    printf("  --event-offsets         render whole blocks and start and stop notes inside them, instead of splitting blocks at notes\n");
+    printf("  --mipmaps               read notes pitched up by an octave or more from filtered lower rate copies of the samples, like the plugin's Mips button\n");
+    printf("  --no-mipmaps            read every note from the full rate sample, aliasing and all, the default\n");
+    printf("  --host-rate-samples     resample every sample to --sample-rate after loading, like the plugin's Rate button\n");
+    printf("  --multirate             render the voices with nothing above a fifth of the output rate at half of it, like the plugin's Half button\n");
+    printf("  --no-multirate          render every voice at the full rate, the default\n");
+    printf("  --governor-budget <x>   let the quality governor degrade voices once blocks take more than this fraction of real-time, default off\n");
+    printf("  --routing <preset>      main (default), drums or zones, extra outputs are written as <output>_out<n>.wav\n");
+    printf("  --route <source:low-high=output>  route keys or zones to an output, like key:35-36=1 or zone:0-3=2, can be repeated\n");
+    printf("  --compare <ref.wav>     compare against a reference render, exits with 2 if it drifted too far\n");
+    printf("  --max-abs-error <x>     default 1e-3\n");
+    printf("  --max-rms-error <x>     default 1e-4\n");
+    printf("  --max-spectral-error <dB>  default 0.5\n");
+    printf("  --memory-report <file.json>  where the memory goes, measured at the end of the song\n");
+    printf("  --trace <file.json>     timeline of note-ons, renders and soundfont loading, for chrome://tracing or Perfetto\n");
+}
+
+static bool parse_options(const int argc, char** argv, Options& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+        if (arg == "--per-voice") {
+            options.per_voice = true;
+            continue;
+        }
+        if (arg == "--multitimbral") {
+            options.multitimbral = true;
+            continue;
+        }
+        if (arg == "--event-offsets") {
+            options.event_offsets = true;
+            continue;
+        }
+        if (arg == "--mipmaps") {
+            options.sample_mipmaps = true;
+            continue;
+        }
+        if (arg == "--no-mipmaps") {
+            options.sample_mipmaps = false;
+            continue;
+        }
+        if (arg == "--host-rate-samples") {
+            options.host_rate_samples = true;
+            continue;
+        }
+        if (arg == "--multirate") {
+            options.multirate = true;
+            continue;
+        }
+        if (arg == "--no-multirate") {
+            options.multirate = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf("missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--sample-rate") options.sample_rate = atoi(value);
+        else if (arg == "--block-size") options.block_size = atoi(value);
+        else if (arg == "--bank") options.bank = atoi(value);
+        else if (arg == "--program") options.program = atoi(value);
+        else if (arg == "--sampling-mode") options.sampling_mode = strcmp(value, "all") == 0 ? -1 : atoi(value);
+        else if (arg == "--scale") options.scale_path = value;
+        else if (arg == "--tail") options.tail = atof(value);
+        else if (arg == "--bend-range") options.pitch_bend_range = atof(value);
+        else if (arg == "--silence-floor") options.silence_floor_db = atof(value);
+        else if (arg == "--governor-budget") options.governor_budget = atof(value);
+        else if (arg == "--routing") {
+            if (strcmp(value, "main") == 0) options.output_routing = Flan::make_output_routing(Flan::RoutingPreset::main_only);
+            else if (strcmp(value, "drums") == 0) options.output_routing = Flan::make_output_routing(Flan::RoutingPreset::drum_groups);
+            else if (strcmp(value, "zones") == 0) options.output_routing = Flan::make_output_routing(Flan::RoutingPreset::per_zone);
+            else {
+                printf("unknown routing preset %s\n", value);
+                return false;
+            }
+        }
+        else if (arg == "--route") {
+            Flan::OutputRoute route;
+            if (!Flan::parse_output_route(value, route) || !options.output_routing.add(route)) {
+                printf("invalid route %s\n", value);
+                return false;
+            }
+            options.output_routing.preset = Flan::RoutingPreset::custom;
+        }
+        else if (arg == "--compare") options.reference_path = value;
+        else if (arg == "--memory-report") options.memory_report_path = value;
+        else if (arg == "--trace") options.trace_path = value;
+        else if (arg == "--max-abs-error") options.tolerance.max_abs_error = atof(value);
+        else if (arg == "--max-rms-error") options.tolerance.rms_error = atof(value);
+        else if (arg == "--max-spectral-error") options.tolerance.spectral_error = atof(value);
+        else {
+            printf("unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (positional.size() != 3 || options.sample_rate <= 0 || options.block_size <= 0) {
+        return false;
+    }
+    options.soundfont_path = positional[0];
+    options.midi_path = positional[1];
+    options.output_path = positional[2];
+    return true;
+}
+
+// Renders `n_samples` in blocks of at most `block_size`, appending them to `outputs`. Rendering per voice ignores the
+// routing and mixes everything into the main output, since FL does the routing itself for hybrid generators
+static void render_samples(Flan::Synth& synth, OfflineHost& host, std::vector<std::vector<float>>& outputs, size_t n_samples, const int block_size, const bool per_voice) {
+    float* blocks[MAX_OUTPUTS];
+    const int n_outputs = static_cast<int>(outputs.size());
+    while (n_samples > 0) {
+        const int length = static_cast<int>(std::min<size_t>(n_samples, block_size));
+        const size_t offset = outputs[0].size();
+        for (int output = 0; output < n_outputs; ++output) {
+            outputs[output].resize(offset + static_cast<size_t>(length) * 2);
+            blocks[output] = &outputs[output][offset];
+        }
+        if (per_voice) {
+            host.render_voices(blocks[0], length);
+            for (int output = 1; output < n_outputs; ++output) {
+                std::fill_n(blocks[output], static_cast<size_t>(length) * 2, 0.0f);
+            }
+        }
+        else {
+            synth.render(blocks, n_outputs, length);
+        }
+
+        // The plugin renders the one-shots on the loader thread, here they're ready by the next block
+        if (synth.one_shots_pending()) {
+            synth.render_one_shots();
+        }
+        n_samples -= static_cast<size_t>(length);
+    }
+}
+
+// Loads the soundfont and renders the whole MIDI file with one sampling mode, into one buffer per output
+static bool render_song(const Options& options, const Flan::MidiFile& midi, const int sampling_mode, std::vector<std::vector<float>>& outputs) {
+    // Same settings the plugin would have
+    PluginState state;
+    state.soundfont_path = std::wstring(options.soundfont_path.begin(), options.soundfont_path.end());
+    state.bank = static_cast<u16>(options.bank);
+    state.program = static_cast<u16>(options.program);
+    state.sampling_mode = sampling_mode;
+    state.silence_floor_db = options.silence_floor_db;
+    state.output_routing.set(options.output_routing);
+    state.multitimbral = options.multitimbral;
+    state.sample_mipmaps = options.sample_mipmaps;
+    state.host_rate_samples = options.host_rate_samples;
+    state.multirate = options.multirate;
+    state.adaptive_quality = options.governor_budget > 0.0;
+    Flan::Scale scale;
+    if (!options.scale_path.empty() && !scale.from_file(options.scale_path)) {
+        printf("could not load scale %s\n", options.scale_path.c_str());
+        return false;
+    }
+
+    Flan::Synth synth(state, scale);
+    synth.set_sample_rate(static_cast<double>(options.sample_rate));
+    synth.governor.budget = options.governor_budget;
+    OfflineHost host(synth);
+
+    // Load the soundfont the same way the plugin does
+    const auto load_start = std::chrono::steady_clock::now();
+    synth.load_soundfont(options.soundfont_path);
+    const std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+    if (synth.presets.empty()) {
+        printf("could not load soundfont %s\n", options.soundfont_path.c_str());
+        return false;
+    }
+    if (!options.multitimbral && !synth.presets.contains(state.preset_key())) {
+        printf("bank %i program %i does not exist in %s\n", options.bank, options.program, options.soundfont_path.c_str());
+        return false;
+    }
+    printf("Loaded %s in %.3f s\n", options.soundfont_path.c_str(), load_time.count());
+
+    // The plugin does these on the loader thread, the render waits for them here
+    if (options.sample_mipmaps) {
+        const auto mips_start = std::chrono::steady_clock::now();
+        synth.build_sample_mips();
+        const std::chrono::duration<double> mips_time = std::chrono::steady_clock::now() - mips_start;
+        printf("Built the mips in %.3f s\n", mips_time.count());
+    }
+    if (options.host_rate_samples) {
+        const auto resample_start = std::chrono::steady_clock::now();
+        synth.build_host_rate_samples();
+        const std::chrono::duration<double> resample_time = std::chrono::steady_clock::now() - resample_start;
+        printf("Resampled to %i Hz in %.3f s\n", options.sample_rate, resample_time.count());
+    }
+
+    // Render up to every event, then apply it. With event offsets, notes don't split blocks, they get the frame they fall on
+    outputs.assign(static_cast<size_t>(options.output_routing.n_outputs()), {});
+    for (auto& output : outputs) {
+        output.reserve(static_cast<size_t>((midi.length + options.tail) * options.sample_rate) * 2);
+    }
+    const auto render_start = std::chrono::steady_clock::now();
+    size_t position = 0;
+    for (const Flan::MidiEvent& event : midi.events) {
+        const auto event_position = static_cast<size_t>(llround(event.time * options.sample_rate));
+        const bool is_note = event.type == Flan::MidiEventType::note_on || event.type == Flan::MidiEventType::note_off;
+        if (options.event_offsets && is_note) {
+            // Only render the whole blocks before the one the note falls in, it starts or stops inside that one
+            const size_t n_blocks = (event_position - std::min(event_position, position)) / options.block_size;
+            if (n_blocks > 0) {
+                render_samples(synth, host, outputs, n_blocks * options.block_size, options.block_size, options.per_voice);
+                position += n_blocks * options.block_size;
+            }
+        }
+        else if (event_position > position) {
+            render_samples(synth, host, outputs, event_position - position, options.block_size, options.per_voice);
+            position = event_position;
+        }
+        const int offset = static_cast<int>(event_position - std::min(event_position, position));
+
+        // In multitimbral mode the synth gets the MIDI as is, like the plugin gets it from FL's MIDIIn
+        if (options.multitimbral) {
+            synth.process_midi(event.status, event.data1, event.data2, offset);
+            continue;
+        }
+        switch (event.type) {
+        case Flan::MidiEventType::note_on:
+            host.note_on(event.channel, event.key, event.velocity, offset);
+            break;
+        case Flan::MidiEventType::note_off:
+            host.note_off(event.channel, event.key, offset);
+            break;
+        case Flan::MidiEventType::pitch_bend:
+            synth.set_pitch_wheel(static_cast<double>(event.pitch_bend) / 8192.0 * options.pitch_bend_range);
+            break;
+        case Flan::MidiEventType::control_change:
+        case Flan::MidiEventType::program_change:
+            break;
+        }
+    }
+
+    // Measure the memory while the last notes are still playing
+    if (!options.memory_report_path.empty()) {
+        Flan::MemoryStats memory;
+        synth.measure_memory(memory);
+        const std::wstring summary = Flan::memory_summary(memory);
+        printf("%s", std::string(summary.begin(), summary.end()).c_str());
+        FILE* file = fopen(options.memory_report_path.c_str(), "w");
+        if (file == nullptr) {
+            printf("could not write %s\n", options.memory_report_path.c_str());
+            return false;
+        }
+        const std::string json = Flan::memory_report_json(memory);
+        fwrite(json.data(), 1, json.size(), file);
+        fclose(file);
+    }
+
+    // Let the release tails ring out
+    const auto max_tail_samples = static_cast<size_t>(options.tail * options.sample_rate);
+    size_t tail_samples = 0;
+    while ((host.n_notes() > 0 || !synth.active_voices.empty()) && tail_samples < max_tail_samples) {
+        const size_t length = std::min<size_t>(options.block_size, max_tail_samples - tail_samples);
+        render_samples(synth, host, outputs, length, options.block_size, options.per_voice);
+        tail_samples += length;
+    }
+    const std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_start;
+
+    // Report render speed
+    const double audio_length = static_cast<double>(outputs[0].size() / 2) / options.sample_rate;
+    const double real_time_factor = render_time.count() > 0.0 ? audio_length / render_time.count() : 0.0;
+    printf("Rendered %.2f s of audio in %.3f s (%.1fx real-time)\n", audio_length, render_time.count(), real_time_factor);
+    const std::wstring report = synth.profiler.report();
+    printf("%s\n", std::string(report.begin(), report.end()).c_str());
+    if (state.adaptive_quality) {
+        const std::wstring governor_report = synth.governor.report();
+        printf("%s\n", std::string(governor_report.begin(), governor_report.end()).c_str());
+    }
+    return true;
+}
+
+// "song.wav" becomes "song_mode2.wav"
+static std::string path_with_suffix(const std::string& path, const std::string& suffix) {
+    const size_t extension = path.rfind('.');
+    if (extension == std::string::npos || path.find('/', extension) != std::string::npos) {
+        return path + suffix;
+    }
+    return path.substr(0, extension) + suffix + path.substr(extension);
+}
+
+// The sampling mode only goes in the name when rendering every sampling mode
+static std::string path_for_mode(const std::string& path, const int sampling_mode, const bool all_modes) {
+    return all_modes ? path_with_suffix(path, "_mode" + std::to_string(sampling_mode)) : path;
+}
+
+int main(const int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+
+    Flan::init_bell_curve();
+    Flan::init_sinc_tables();
+    if (!options.trace_path.empty()) {
+        Flan::trace_thread_name("main");
+        Flan::trace_start();
+    }
+
+    Flan::MidiFile midi;
+    if (!midi.from_file(options.midi_path)) {
+        printf("could not load MIDI file %s\n", options.midi_path.c_str());
+        return 1;
+    }
+
+    const bool all_modes = options.sampling_mode < 0;
+    const int first_mode = all_modes ? 0 : options.sampling_mode;
+    const int last_mode = all_modes ? N_SAMPLING_MODES - 1 : options.sampling_mode;
+    bool drifted = false;
+    for (int sampling_mode = first_mode; sampling_mode <= last_mode; ++sampling_mode) {
+        if (all_modes) {
+            printf("Sampling mode %i\n", sampling_mode);
+        }
+
+        std::vector<std::vector<float>> outputs;
+        if (!render_song(options, midi, sampling_mode, outputs)) {
+            return 1;
+        }
+        const std::vector<float>& output = outputs[0];
+
+        const std::string output_path = path_for_mode(options.output_path, sampling_mode, all_modes);
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            const std::string path = (i == 0) ? output_path : path_with_suffix(output_path, "_out" + std::to_string(i));
+            if (!Flan::write_wav(path, outputs[i], options.sample_rate)) {
+                printf("could not write %s\n", path.c_str());
+                return 1;
+            }
+        }
+
+        // Compare against the reference render, if there is one
+        if (options.reference_path.empty()) {
+            continue;
+        }
+        const std::string reference_path = path_for_mode(options.reference_path, sampling_mode, all_modes);
+        std::vector<float> reference;
+        int reference_sample_rate = 0;
+        if (!Flan::read_wav(reference_path, reference, reference_sample_rate)) {
+            printf("could not read reference %s\n", reference_path.c_str());
+            return 1;
+        }
+        if (reference_sample_rate != options.sample_rate) {
+            printf("reference %s is %i Hz, but we rendered at %i Hz\n", reference_path.c_str(), reference_sample_rate, options.sample_rate);
+            return 1;
+        }
+        const Flan::AudioDifference difference = Flan::compare_audio(output, reference);
+        const bool passed = Flan::within_tolerance(difference, options.tolerance);
+        printf("%s sampling mode %i: max abs error %.3g, RMS error %.3g, spectral error %.3f dB, length difference %lld frames\n",
+            passed ? "PASS" : "DRIFTED", sampling_mode, difference.max_abs_error, difference.rms_error, difference.spectral_error,
+            difference.length_difference);
+        drifted |= !passed;
+    }
+
+    if (!options.trace_path.empty() && !Flan::trace_stop(options.trace_path)) {
+        printf("could not write %s\n", options.trace_path.c_str());
+        return 1;
+    }
+    return drifted ? 2 : 0;
+}
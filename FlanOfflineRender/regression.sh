@@ -0,0 +1,32 @@
+#!/bin/sh
+# Renders every case in a case list with all sampling modes, and compares them against the reference renders.
+# Each line of the case list is: <name> <soundfont> <song.mid> <bank> <program>, empty lines and # comments are skipped.
+#
+# usage: ./regression.sh <cases.txt> <reference dir> [--update] [extra flan_offline_render options]
+# With --update, the reference renders are (re)written instead of compared against.
+
+set -u
+cases=$1
+references=$2
+shift 2
+update=0
+if [ "${1:-}" = "--update" ]; then
+    update=1
+    shift
+fi
+
+mkdir -p "$references" build/regression
+failed=0
+while read -r name soundfont midi bank program; do
+    case "$name" in ""|\#*) continue ;; esac
+    if [ $update -eq 1 ]; then
+        ./flan_offline_render "$soundfont" "$midi" "$references/$name.wav" --bank "$bank" --program "$program" --sampling-mode all "$@" > /dev/null \
+            && echo "updated $name" || { echo "could not update $name"; failed=1; }
+        continue
+    fi
+    ./flan_offline_render "$soundfont" "$midi" "build/regression/$name.wav" --bank "$bank" --program "$program" --sampling-mode all \
+        --compare "$references/$name.wav" "$@" > "build/regression/$name.log"
+    [ $? -ne 0 ] && failed=1
+    grep -E "^(PASS|DRIFTED)|could not" "build/regression/$name.log" | sed "s/^/$name: /"
+done < "$cases"
+exit $failed
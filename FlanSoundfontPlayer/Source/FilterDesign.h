@@ -0,0 +1,53 @@
+#pragma once
+#include <cmath>
+#include <vector>
+
+// Filter math shared by the sinc sampling modes, the host rate resampler, the sample mips and the half rate upsampler, so
+// they can't drift apart
+namespace Flan {
+    inline constexpr double pi = 3.14159265358979323846;
+
+    // Zeroth order modified Bessel function of the first kind, for the Kaiser window
+    [[nodiscard]] inline double bessel_i0(const double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50 && term > sum * 1e-12; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Kaiser window at `t`, from -1 to 1 across the window, 0 past its edges. A higher `beta` trades a wider main lobe for
+    // lower side lobes
+    [[nodiscard]] inline double kaiser_window(const double t, const double beta) {
+        if (std::abs(t) >= 1.0) {
+            return 0.0;
+        }
+        return bessel_i0(beta * sqrt(1.0 - t * t)) / bessel_i0(beta);
+    }
+
+    // Normalized sinc, sin(pi x) / (pi x)
+    [[nodiscard]] inline double sinc(const double x) {
+        return (x == 0.0) ? 1.0 : sin(pi * x) / (pi * x);
+    }
+
+    // Blackman windowed sinc with its cutoff at a quarter of the rate, `n_taps` of them, odd. Every other tap besides the
+    // middle one is zero, and together they add up to 1
+    [[nodiscard]] inline std::vector<double> half_band_taps(const int n_taps) {
+        std::vector<double> taps(n_taps);
+        const int half = n_taps / 2;
+        double sum = 0.0;
+        for (int i = 0; i < n_taps; ++i) {
+            const int n = i - half;
+            const double lowpass = (n == 0) ? 0.5 : sin(pi * n / 2.0) / (pi * n);
+            const double window = 0.42 + 0.5 * cos(pi * n / (half + 1)) + 0.08 * cos(2.0 * pi * n / (half + 1)); // Blackman
+            taps[i] = lowpass * window;
+            sum += taps[i];
+        }
+        for (double& tap : taps) {
+            tap /= sum;
+        }
+        return taps;
+    }
+}
@@ -2,8 +2,19 @@
 #include <windows.h>
 #include <ios>
 #include <cstdio>
+#include <cstddef>
 #include "MidiNames.h"
 
+// The synth takes FL's voice params as they are, so make sure they line up
+static_assert(sizeof(TLevelParams) == sizeof(Flan::VoiceLevels));
+static_assert(sizeof(TVoiceParams) == sizeof(Flan::VoiceParams));
+static_assert(offsetof(TLevelParams, Pan) == offsetof(Flan::VoiceLevels, pan));
+static_assert(offsetof(TLevelParams, Vol) == offsetof(Flan::VoiceLevels, vol));
+static_assert(offsetof(TLevelParams, Pitch) == offsetof(Flan::VoiceLevels, pitch));
+static_assert(offsetof(TLevelParams, FCut) == offsetof(Flan::VoiceLevels, fcut));
+static_assert(offsetof(TLevelParams, FRes) == offsetof(Flan::VoiceLevels, fres));
+static_assert(offsetof(TVoiceParams, FinalLevels) == offsetof(Flan::VoiceParams, final_levels));
+
 // Plugin info struct that FL Studio wants
 TFruityPlugInfo plug_info = {
     CurrentSDKVersion,
@@ -12,7 +23,8 @@ TFruityPlugInfo plug_info = {
         FPF_Generator |
         FPF_MIDIOut |
         FPF_NewVoiceParams |
-        FPF_WantNewTick,
+        FPF_WantNewTick |
+        (FLAN_HYBRID_GENERATOR ? FPF_UseSampler : 0),
     0, // todo: update this to the actual value
     0,
     0, // todo: figure out what this means
@@ -36,14 +48,9 @@ BOOL APIENTRY DllMain(HMODULE module, DWORD reason, [[maybe_unused]] LPVOID rese
         // Store the dll handle, to be able to load resources from the dll file
         dll_handle = module;
 
-        // Generate gauss table, credit to https://problemkaputt.de/fullsnes.htm#snesaudioprocessingunitapu for providing the gauss table that is approximated below
-        // Formula was made through trial and error in geogebra
-        for (int ix = 0; ix < 512; ix++) {
-            const float x_270 = static_cast<float>(ix) / 270.f;
-            const float x_512 = static_cast<float>(ix) / 512.f;
-            const float result = powf(2.718281828f, -x_270 * x_270) * 1305.f * powf((1 - (x_512 * x_512)), 1.4f);
-            Flan::bell_curve[ix] = result / 2039.f; // magic number to make the volume similar to the other filtering modes
-        }
+        // Generate gauss and sinc tables
+        Flan::init_bell_curve();
+        Flan::init_sinc_tables();
     }
     if (reason == DLL_PROCESS_DETACH) {
         glfwTerminate();
@@ -53,74 +60,63 @@ BOOL APIENTRY DllMain(HMODULE module, DWORD reason, [[maybe_unused]] LPVOID rese
 
 // todo: add dirty/clean ui state so you dont have to render every frame and save on precious cpu time cuz there's no reason why an audio plugin should use 100% gpu time.
 void update_render(FlanSoundfontPlayer* plugin) {
-    while (plugin->not_destructing)
+    Flan::trace_thread_name("editor");
+    while (plugin->editor_running)
     {
         if (plugin->window_safe)
         {
-            std::lock_guard guard(plugin->graphics_thread_lock);
-            plugin->renderer.begin_frame();
-            const float delta_time = plugin->calculate_delta_time();
-            Flan::update_entities(plugin->scene, plugin->renderer, *plugin->input, delta_time);
-            plugin->renderer.end_frame();
-            plugin->input->update(plugin->renderer.window());
-        }
-        if (!plugin->soundfont_to_load.empty()) {
-            plugin->load_soundfont(plugin->soundfont_to_load);
-            plugin->soundfont_to_load.clear();
+            plugin->update_editor_frame();
+            continue;
         }
+
+        // Hidden, so there's nothing to draw until the window is shown again or the editor is torn down
+        std::unique_lock lock(plugin->editor_wake_mutex);
+        plugin->editor_wake.wait(lock, [plugin] { return plugin->window_safe || !plugin->editor_running; });
     }
 }
 
+void FlanSoundfontPlayer::wake_editor()
+{
+    // Taking the lock makes sure the render thread is either waiting already, or still going to check the flags
+    {
+        std::lock_guard guard(editor_wake_mutex);
+    }
+    editor_wake.notify_all();
+}
+
 FlanSoundfontPlayer::FlanSoundfontPlayer(int set_tag, TFruityPlugHost* host) : TCPPFruityPlug(set_tag, host, nullptr) {
     // Set plugin info so FL Studio knows what type of plugin this is
     Info = &plug_info;
 
-    // Initialize renderer
-    renderer.init(1280, 720, true, dll_handle);
-    input = new Flan::Input(renderer.window());
-
-    // Attach our OpenGL window to the FL plugin, by getting the HWND from our GLFWwindow and passing it to the plugin struct
-    EditorHandle = glfwGetWin32Window(renderer.window());
-
-    host->Dispatcher(set_tag, FHD_WantIdle, 0, 1);
-
-    // Create our UI elements
-    create_ui();
-
-    // Create render thread
-    m_update_render_thread = std::thread(update_render, this);
-
-    // If a soundfont is loaded
-    if (!m_soundfont.presets.empty()) {
-        update_preset_dropdown_menu();
-    }
-    // Otherwise, try to load gm.dls, I mean which Windows PC doesn't have this file, I remember having it on my Windows XP machine
-    else {
-        soundfont_to_load = "C:/Windows/System32/drivers/gm.dls";
-        update_preset_dropdown_menu();
-    }
-
-    // Init wave oscillators to off
-    for (const auto& voice : m_active_voices) {
-        for (const auto& wave_osc : voice->wave_oscs) {
-            wave_osc->vol_env.stage = static_cast<double>(Flan::EnvStage::off);
-        }
-    }
+    // We want idle messages even when the editor is hidden, so we can tear it down after a while
+    host->Dispatcher(set_tag, FHD_WantIdle, 0, 2);
+
+    // Try to load gm.dls, I mean which Windows PC doesn't have this file, I remember having it on my Windows XP machine.
+    // The editor, its window and its render thread are only created once FL shows it
+    set_soundfont_path(state.soundfont_path);
+
+    // Let FL know when a voice has finished playing. FL then calls Voice_Kill, which frees it.
+    // As a hybrid generator FL's sampler takes care of the voice volume and panning
+    m_synth.trace_instance = set_tag;
+    m_synth.host_applies_levels = FLAN_HYBRID_GENERATOR;
+    m_synth.on_voice_killed = [this](const Flan::Voice* voice) {
+        PlugHost->Voice_Kill(voice->voice_tag, true);
+    };
+    update_host_outputs();
 }
 
 FlanSoundfontPlayer::~FlanSoundfontPlayer()
 {
-    // Tell the rendering thread we're done
     not_destructing = false;
 
-    // Wait for the rendering thread to finish
-    m_update_render_thread.join();
+    // Make sure the loader thread is done with us
+    Flan::SoundfontLoader::instance().cancel(this);
+    Flan::SoundfontLoader::instance().cancel(&m_synth);
+    Flan::SoundfontLoader::instance().cancel(&m_one_shot_jobs);
+    Flan::SoundfontLoader::instance().cancel(&m_mip_jobs);
 
-    // Close the input manager
-    delete input;
-
-    // Delete the window
-    glfwDestroyWindow(renderer.window());
+    // Close the editor if it's still open
+    destroy_editor();
 }
 
 intptr_t _stdcall FlanSoundfontPlayer::Dispatcher(intptr_t id, intptr_t index, intptr_t value)
@@ -131,29 +127,49 @@ intptr_t _stdcall FlanSoundfontPlayer::Dispatcher(intptr_t id, intptr_t index, i
 
     switch (id)
     {
-        // show or hide the plugin editor 
+        // show or hide the plugin editor
     case FPD_ShowEditor:
         if (value == 0)	// hide (no parent window)
         {
+            // There's nothing to hide if the editor was never shown
+            if (renderer == nullptr) {
+                break;
+            }
+
             // Make sure the renderer stops rendering when the window is hdden
             window_safe = false;
+            wake_editor();
 
             // Hide the window
-            glfwHideWindow(renderer.window());
+            glfwHideWindow(renderer->window());
 
             // Remove the editor handle the parent
             SetParent(EditorHandle, nullptr);
+
+            // Start counting down to tearing down the editor, see Idle_Public
+            m_editor_hidden_since = std::chrono::steady_clock::now();
         }
         else // show
         {
+            // Create the editor the first time it's shown, or when it was torn down after being hidden for a while
+            if (renderer == nullptr) {
+                create_editor();
+            }
+
+            // The user wants to see the presets, so the soundfont should be loaded by now
+            if (soundfont_pending()) {
+                request_soundfont_load(Flan::LoadPriority::editor);
+            }
+
             // Parent the editor handle to the window provided by FL
             SetParent(EditorHandle, reinterpret_cast<HWND>(value));
 
             // Show the window
-            glfwShowWindow(renderer.window());
+            glfwShowWindow(renderer->window());
 
             // Let the rendering thread know we're good to go
             window_safe = true;
+            wake_editor();
         }
 
         // Set the editor plugin handle to be this plugin
@@ -164,8 +180,20 @@ intptr_t _stdcall FlanSoundfontPlayer::Dispatcher(intptr_t id, intptr_t index, i
     case FPD_SetSampleRate:
         AudioRenderer.setSmpRate(static_cast<int>(value));
         PitchMul = static_cast<float>(MiddleCMul / AudioRenderer.getSmpRate());
-        m_sample_rate = static_cast<double>(value);
-        m_sample_rate_inv = 1.0 / m_sample_rate;
+        m_synth.set_sample_rate(static_cast<double>(value));
+        if (state.host_rate_samples) {
+            request_host_rate_samples();
+        }
+        break;
+
+        // FL started or stopped rendering to a file
+    case FPD_ProcessMode:
+        m_synth.offline_rendering = (value & PM_IsRendering) != 0;
+        break;
+
+        // the mixer routing changed, so we may have more or fewer outputs now
+    case FPD_RoutingChanged:
+        update_host_outputs();
         break;
     default:
         printf("a");
@@ -177,203 +205,188 @@ intptr_t _stdcall FlanSoundfontPlayer::Dispatcher(intptr_t id, intptr_t index, i
 
 TVoiceHandle _stdcall FlanSoundfontPlayer::TriggerVoice(PVoiceParams voice_params, intptr_t set_tag)
 {
-    // Don't create a new voice if the currently selected index is -1 (invalid)
-    if (m_preset_dropdown->current_selected_index == -1) {
-        return 0;
+    // If the soundfont isn't loaded yet, make sure it gets loaded soon. The note waits in the synth until it is.
+    // This is the audio thread, so the load is requested from the next idle call
+    if (soundfont_pending()) {
+        m_load_wanted.store(true, std::memory_order_relaxed);
     }
 
-    // If a soundfont is currently loading, please don't do anything
-    if (soundfont_to_load.empty() == false) {
+    // Start note, this returns nullptr if the currently selected bank and program don't exist in the soundfont
+    const Flan::Voice* new_voice = m_synth.trigger_voice(reinterpret_cast<const Flan::VoiceParams*>(voice_params), set_tag);
+    if (new_voice == nullptr) {
         return 0;
     }
 
-    // Create new voice
-    Flan::Voice* new_voice = new Flan::Voice();
-    new_voice->voice_tag = set_tag;
-
-    // Add it to the active voices
-    m_active_voices.push_back(new_voice);
-
-    // Debug
-    swprintf_s(m_debug_buffer, L"InitLevels:\n\tPan:\t%f\n\tVol:\t%f\n\tPitch:\t%f\n\tFCut:\t%f\n\tFRes:\t%f\nFinalLevels:\n\tPan:\t%f\n\tVol:\t%f\n\tPitch:\t%f\n\tFCut:\t%f\n\tFRes:\t%f\n", 
-        voice_params->InitLevels.Pan,
-        voice_params->InitLevels.Vol,
-        voice_params->InitLevels.Pitch,
-        voice_params->InitLevels.FCut,
-        voice_params->InitLevels.FRes,      
-        voice_params->FinalLevels.Pan,
-        voice_params->FinalLevels.Vol,
-        voice_params->FinalLevels.Pitch,
-        voice_params->FinalLevels.FCut,
-        voice_params->FinalLevels.FRes
-    );
-
-    if (set_tag == 0) {
-        swprintf_s(m_debug_buffer, L"it was zero for some reason");
-    }
-    scene.value_pool.set_ptr<wchar_t>("text_debug", m_debug_buffer);
-
-    // Get preset from currently selected index
-    const Flan::Preset& preset = m_soundfont.presets[m_dropdown_indices_inverse[m_preset_dropdown->current_selected_index]];
-
-    // Get midi information
-    //int vel = std::clamp(static_cast<int>(powf(voice_params->InitLevels.Vol / 2.0f, 0.5f) * 127.0f), 0, 127);
-    int vel = std::min(127, static_cast<int>(VolumeToMIDIVelocity(voice_params->InitLevels.Vol)));
-    int key = static_cast<int>(60 + (voice_params->FinalLevels.Pitch / 100));
-    const double corrected_key = log2(scale[key]) * 12 + 60;
-
-    // Loop over all preset zones to figure out for which ones the key and the velocity are inside the range
-    for (auto& zone : preset.zones) {
-        // for the zones that fit that criteria:
-        if (static_cast<u8>(corrected_key) >= zone.key_range_low &&
-            static_cast<u8>(corrected_key) <= zone.key_range_high &&
-            vel >= zone.vel_range_low &&
-            vel <= zone.vel_range_high
-            ) {
-
-            // find a free wavetable oscillator spot in the array
-            auto p_wave_osc = new Flan::WavetableOscillator();
-            auto& wave_osc = *p_wave_osc;
-            {
-                // Lock the wavetables so we don't get any surprises from another thread
-                std::lock_guard guard{ m_note_playing_mutex };
-                new_voice->wave_oscs.push_back(p_wave_osc);
-            }
+    // Log it, this only copies the levels into the telemetry ring, the editor formats them when it needs to
+    Flan::TelemetryEvent note_on_event;
+    note_on_event.type = Flan::TelemetryEventType::note_on;
+    note_on_event.voice_tag = set_tag;
+    memcpy(&note_on_event.levels[0], &voice_params->InitLevels, sizeof(float) * 5);
+    memcpy(&note_on_event.levels[5], &voice_params->FinalLevels, sizeof(float) * 5);
+    m_telemetry.push(note_on_event);
 
-            //m_curr_wave_osc_idx = (m_curr_wave_osc_idx + 1) % N_WAVE_OSCS;
-            {
-                // init sample and preset pointers
-                wave_osc.sample = m_soundfont.samples[zone.sample_index];
-                wave_osc.preset_zone = zone;
-
-                // apply overrides
-                if (scene.value_pool.get<double>("delay") != 0.0) {
-                    wave_osc.preset_zone.vol_env.delay = 1.0 / scene.value_pool.get<double>("delay");
-                }
-                if (scene.value_pool.get<double>("attack") != 0.0) {
-                    wave_osc.preset_zone.vol_env.attack = 1.0 / scene.value_pool.get<double>("attack");
-                }
-                if (scene.value_pool.get<double>("hold") != 0.0) {
-                    wave_osc.preset_zone.vol_env.hold = 1.0 / scene.value_pool.get<double>("hold");
-                }
-                if (scene.value_pool.get<double>("decay") != 0.0) {
-                    wave_osc.preset_zone.vol_env.decay = 100.0 / scene.value_pool.get<double>("decay");
-                }
-                if (scene.value_pool.get<double>("sustain") != 0.0) {
-                    wave_osc.preset_zone.vol_env.sustain = scene.value_pool.get<double>("sustain");
-                }
-                if (scene.value_pool.get<double>("release") != 0.0) {
-                    wave_osc.preset_zone.vol_env.release = 100.0 / scene.value_pool.get<double>("release");
-                }
-
-                // init sample position and adsr_volume to 0.0
-                wave_osc.sample_position = 0.0;
-                wave_osc.vol_env.value = 0.0;
-                wave_osc.mod_env.value = 0.0;
-
-                // init adsr_stage to Delay
-                wave_osc.vol_env.stage = static_cast<double>(Flan::EnvStage::delay);
-                wave_osc.mod_env.stage = static_cast<double>(Flan::EnvStage::delay);
-
-                // init lfo
-                wave_osc.vib_lfo.time = 0.0;
-                wave_osc.vib_lfo.state = 0.0;
-                wave_osc.mod_lfo.time = 0.0;
-                wave_osc.mod_lfo.state = 0.0;
-
-                // init filter
-                wave_osc.filter = zone.filter;
-
-                // set midi key, velocity to note_on event key, velocity
-                wave_osc.midi_key = static_cast<u8>(key);
-                if (zone.vel_override < 128)
-                    vel = zone.vel_override;
-                wave_osc.initial_channel_pitch = static_cast<double>(voice_params->FinalLevels.Pitch);
-                wave_osc.voice_params = voice_params;
-                wave_osc.channel_pitch = 0.0;
-
-                // init sample_delta
-                const double pitch_correction = (wave_osc.channel_pitch / 100.0) + static_cast<double>(zone.root_key_offset) + static_cast<double>(zone.tuning);
-                if (zone.key_override < 128)
-                    key = zone.key_override;
-                const double scaled_key = 60 + static_cast<double>(key - 60) * zone.scale_tuning;
-                const double key_multiplier = Flan::lerp(
-                    scale[static_cast<size_t>(scaled_key)],
-                    scale[static_cast<size_t>(scaled_key) + 1],
-                    fmodf(scaled_key, 1.0));
-                wave_osc.sample_delta = (static_cast<double>(wave_osc.sample.base_sample_rate) * key_multiplier * (pow(2.0, pitch_correction / 12.0))) * m_sample_rate_inv;
-                wave_osc.preset_zone.vol_env.hold *= pow(2.0, wave_osc.preset_zone.key_to_vol_env_hold * static_cast<double>(key - 60) / 1200);
-                wave_osc.preset_zone.vol_env.decay *= pow(2.0, wave_osc.preset_zone.key_to_vol_env_decay * static_cast<double>(key - 60) / 1200);
-                wave_osc.preset_zone.mod_env.hold *= pow(2.0, wave_osc.preset_zone.key_to_mod_env_hold * static_cast<double>(key - 60) / 1200);
-                wave_osc.preset_zone.mod_env.decay *= pow(2.0, wave_osc.preset_zone.key_to_mod_env_decay * static_cast<double>(key - 60) / 1200);
-            }
-        }
-    }
-    // Start note
     return reinterpret_cast<TVoiceHandle>(new_voice);
 }
 
 void _stdcall FlanSoundfontPlayer::Voice_Release(TVoiceHandle handle)
 {
     if (!handle) return;
-    const Flan::Voice* voice = reinterpret_cast<Flan::Voice*>(handle);
+    Flan::Voice* voice = reinterpret_cast<Flan::Voice*>(handle);
+    Flan::trace_instant("note_off", m_synth.trace_instance, voice->voice_tag);
     voice->release();
 }
 
+void _stdcall FlanSoundfontPlayer::Voice_Kill(TVoiceHandle handle)
+{
+    // FL calls this for voices we reported as finished, but also for voices it kills itself, which may still be playing
+    if (!handle) return;
+    m_synth.kill_voice(reinterpret_cast<Flan::Voice*>(handle));
+}
+
+int _stdcall FlanSoundfontPlayer::Voice_Render(TVoiceHandle handle, PWAV32FS dest_buffer, int& length)
+{
+    // Only called when we're built as a hybrid generator. Once the voice has finished, FL kills it through Voice_Kill
+    if (!handle) return FVR_NoMoreData;
+    const bool playing = m_synth.render_voice(reinterpret_cast<Flan::Voice*>(handle), reinterpret_cast<float*>(dest_buffer), length);
+    return playing ? FVR_Ok : FVR_NoMoreData;
+}
+
+void _stdcall FlanSoundfontPlayer::MIDIIn(int& msg)
+{
+    // Hybrid generators only render the voices FL knows about, so MIDI notes would never be heard
+    if (!state.multitimbral || FLAN_HYBRID_GENERATOR) {
+        return;
+    }
+
+    // Same as with FL's notes, the note waits for the soundfont if it's not loaded yet
+    if (soundfont_pending()) {
+        m_load_wanted.store(true, std::memory_order_relaxed);
+    }
+    const auto* message = reinterpret_cast<const TMIDIOutMsg*>(&msg);
+    m_synth.process_midi(message->Status, message->Data1, message->Data2);
+
+    // We played it, so FL shouldn't also send it to the channel as a note
+    msg = MIDIMsg_Null;
+}
+
 // MIDI values here used for pitch wheel
 int _stdcall FlanSoundfontPlayer::ProcessEvent(int event_id, int event_value, [[maybe_unused]] int flags)
 {
+    Flan::TelemetryEvent event;
+    event.int_value = event_value;
     switch (event_id) {
     case FPE_Tempo:
-        swprintf_s(m_debug_buffer, L"Tempo changed to %f", *reinterpret_cast<float*>(&event_value));
+        event.type = Flan::TelemetryEventType::tempo;
+        event.levels[0] = *reinterpret_cast<float*>(&event_value);
+        m_telemetry.push(event);
         break;
     case FPE_MaxPoly:
-        swprintf_s(m_debug_buffer, L"Max polyphony changed to %i", event_value);
+        event.type = Flan::TelemetryEventType::max_poly;
+        m_telemetry.push(event);
         break;
     case FPE_MIDI_Pan:
-        swprintf_s(m_debug_buffer, L"MIDI Pan changed to %i", event_value);
+        event.type = Flan::TelemetryEventType::midi_pan;
+        m_telemetry.push(event);
         break;
     case FPE_MIDI_Vol:
-        swprintf_s(m_debug_buffer, L"MIDI Vol changed to %i", event_value);
+        event.type = Flan::TelemetryEventType::midi_vol;
+        m_telemetry.push(event);
         break;
     case FPE_MIDI_Pitch:
-        swprintf_s(m_debug_buffer, L"MIDI Pitch changed to %i", event_value);
-        m_midi_pitch = static_cast<double>(event_value) / 100.0;
+        event.type = Flan::TelemetryEventType::midi_pitch;
+        m_telemetry.push(event);
+        m_synth.set_pitch_wheel(static_cast<double>(event_value) / 100.0);
         break;
     default:
         return 0;
     }
-    scene.value_pool.set_ptr<wchar_t>("text_debug", m_debug_buffer);
     return 0;
 }
 
 void _stdcall FlanSoundfontPlayer::Gen_Render(PWAV32FS dest_buffer, int& length)
 {
-    // Lock the wavetables so we don't get any surprises from another thread
-    std::lock_guard guard{ m_note_playing_mutex };
-
-    // Fill buffer
-    float* dest = reinterpret_cast<float*>(dest_buffer);
-    for (int j = 0; j < length; j++) {
-        sample_t total_l = 0;
-        sample_t total_r = 0;
-        for (auto* voice : m_active_voices) {
-            const Flan::BufferSample sample = voice->get_sample(m_sample_rate_inv, m_midi_pitch, static_cast<int>(scene.value_pool.get<double>("sampling_mode")));
-            total_l += sample.left;
-            total_r += sample.right;
+    Flan::trace_thread_name("audio");
+
+    // As a hybrid generator, the voices are rendered in Voice_Render and FL mixes them
+    if (FLAN_HYBRID_GENERATOR) {
+        length = 0;
+        return;
+    }
+
+    // Log it when the last block made the quality governor step up or down
+    const int quality_level = m_synth.governor.level();
+    if (quality_level != m_quality_level) {
+        Flan::TelemetryEvent event;
+        event.type = Flan::TelemetryEventType::quality_level;
+        event.int_value = quality_level;
+        event.levels[0] = static_cast<float>(m_synth.governor.stats().last_load * 100.0);
+        m_telemetry.push(event);
+        m_quality_level = quality_level;
+    }
+
+    // Only render into the extra outputs if some zones are routed there, and FL actually gave us some
+    const int n_outputs = std::min(state.output_routing.get().n_outputs(), m_n_host_outputs.load(std::memory_order_acquire) + 1);
+    if (n_outputs <= 1) {
+        // Most instances are silent most of the time. Telling FL we didn't render anything lets it skip mixing us in
+        if (!m_synth.render(reinterpret_cast<float*>(dest_buffer), length)) {
+            length = 0;
         }
-        dest[(j * 2) + 0] = total_l;
-        dest[(j * 2) + 1] = total_r;
+        return;
     }
 
-    // Kill dead voices - only one per render though
-    for (int i = 0; i < m_active_voices.size(); i++) {
-        if (m_active_voices[i]->schedule_kill) {
-            PlugHost->Voice_Kill(m_active_voices[i]->voice_tag, true);
-            m_active_voices.erase(m_active_voices.begin() + i);
-            break;
+    // Our block buffers hold OUTPUT_BLOCK_FRAMES, so a longer block is rendered in parts
+    bool rendered = false;
+    for (int offset = 0; offset < length; offset += OUTPUT_BLOCK_FRAMES) {
+        const int part_length = std::min(length - offset, OUTPUT_BLOCK_FRAMES);
+        rendered = render_outputs(reinterpret_cast<float*>(dest_buffer), n_outputs, offset, part_length) || rendered;
+    }
+    if (!rendered) {
+        length = 0;
+    }
+}
+
+bool FlanSoundfontPlayer::render_outputs(float* dest, const int n_outputs, const int offset, const int length) {
+    // The main output goes straight into FL's buffer, the others into our own block buffers first
+    const size_t block_floats = static_cast<size_t>(length) * 2;
+    float* outputs[MAX_OUTPUTS];
+    outputs[0] = dest + static_cast<size_t>(offset) * 2;
+    for (int output = 1; output < n_outputs; ++output) {
+        outputs[output] = &m_output_buffers[static_cast<size_t>(OUTPUT_BLOCK_FRAMES) * 2 * (output - 1)];
+    }
+    if (!m_synth.render(outputs, n_outputs, length)) {
+        return false;
+    }
+
+    // FL's output buffers are add-only and shared with other plugins, so they're locked while we add to them.
+    // If FL doesn't have a buffer for an output after all, those zones end up in the main output instead
+    for (int output = 1; output < n_outputs; ++output) {
+        TIOBuffer buffer{ nullptr, 0 };
+        PlugHost->GetOutBuffer(HostTag, output, &buffer);
+        if (buffer.Buffer == nullptr) {
+            for (size_t i = 0; i < block_floats; ++i) {
+                outputs[0][i] += outputs[output][i];
+            }
+            continue;
+        }
+        float* host_buffer = static_cast<float*>(buffer.Buffer) + static_cast<size_t>(offset) * 2;
+        LockMix_Shared();
+        for (size_t i = 0; i < block_floats; ++i) {
+            host_buffer[i] += outputs[output][i];
         }
+        UnlockMix_Shared();
     }
+    return true;
+}
+
+void FlanSoundfontPlayer::update_host_outputs() {
+    // The block buffers are allocated the first time FL gives us extra outputs, before the audio thread can see them, and
+    // are never resized after that, so Gen_Render doesn't have to allocate or wait for us
+    const intptr_t n_outputs = PlugHost->Dispatcher(HostTag, FHD_GetNumInOut, 1, 0);
+    const int n_host_outputs = static_cast<int>(std::clamp<intptr_t>(n_outputs, 0, MAX_OUTPUTS - 1));
+    if (n_host_outputs > 0 && m_output_buffers.empty()) {
+        m_output_buffers.resize(static_cast<size_t>(OUTPUT_BLOCK_FRAMES) * 2 * (MAX_OUTPUTS - 1));
+    }
+    m_n_host_outputs.store(n_host_outputs, std::memory_order_release);
 }
 
 void FlanSoundfontPlayer::SaveRestoreState(IStream* stream, BOOL save) {
@@ -392,85 +405,125 @@ void FlanSoundfontPlayer::SaveRestoreState(IStream* stream, BOOL save) {
         u8 sampling_mode = 2;
         Flan::Scale scale;
         // todo: add scale to this struct
-    } state{};
+        bool deferred_loading = true;
+        Flan::OutputRouting output_routing; // Projects saved before this was added simply don't read this far
+        bool multitimbral = false;
+        bool host_rate_samples = false;
+        int8_t render_sampling_mode = -1;
+        bool sample_mipmaps = false;
+        bool multirate = false;
+    } saved_state{};
+
+    // The editor syncs its values with the plugin state every frame, so make sure it doesn't do that halfway through
+    std::lock_guard guard(graphics_thread_lock);
 
     // Handle saving
     if (save) {
         // Populate struct with values
         // Copy soundfont path
-        wcscpy_s(state.soundfont_path, _countof(state.soundfont_path), scene.value_pool.get<wchar_t*>("text_soundfont_path"));
+        wcscpy_s(saved_state.soundfont_path, _countof(saved_state.soundfont_path), state.soundfont_path.c_str());
 
         // Copy scale name
-        wcscpy_s(state.scale_name, _countof(state.scale_name), scene.value_pool.get<wchar_t*>("text_scale"));
+        wcscpy_s(saved_state.scale_name, _countof(saved_state.scale_name), state.scale_name.c_str());
 
         // Copy currently selected bank/program
-        state.bank_program  = static_cast<uint16_t>(scene.value_pool.get<double>("bank")) << 8;
-        state.bank_program |= static_cast<uint16_t>(scene.value_pool.get<double>("program")) & 0xFF;
+        saved_state.bank_program = state.preset_key();
 
         // Copy volume envelope override settings
-        state.volenv_delay   = scene.value_pool.get<double>("delay");
-        state.volenv_attack  = scene.value_pool.get<double>("attack");
-        state.volenv_hold    = scene.value_pool.get<double>("hold");
-        state.volenv_decay   = scene.value_pool.get<double>("decay");
-        state.volenv_sustain = scene.value_pool.get<double>("sustain");
-        state.volenv_release = scene.value_pool.get<double>("release");
+        saved_state.volenv_delay   = state.volenv_delay;
+        saved_state.volenv_attack  = state.volenv_attack;
+        saved_state.volenv_hold    = state.volenv_hold;
+        saved_state.volenv_decay   = state.volenv_decay;
+        saved_state.volenv_sustain = state.volenv_sustain;
+        saved_state.volenv_release = state.volenv_release;
 
         // Copy sampling mode
-        state.sampling_mode = static_cast<uint8_t>(scene.value_pool.get<double>("sampling_mode"));
+        saved_state.sampling_mode = static_cast<uint8_t>(state.sampling_mode);
 
         // Copy scale
-        state.scale = scale;
+        saved_state.scale = scale;
+
+        // Copy load mode
+        saved_state.deferred_loading = state.deferred_loading;
+
+        // Copy output routing
+        saved_state.output_routing = state.output_routing.get();
+
+        // Copy multitimbral mode
+        saved_state.multitimbral = state.multitimbral;
+
+        // Copy host rate samples setting
+        saved_state.host_rate_samples = state.host_rate_samples;
+
+        // Copy render sampling mode
+        saved_state.render_sampling_mode = static_cast<int8_t>(state.render_sampling_mode);
+
+        // Copy mipmap setting
+        saved_state.sample_mipmaps = state.sample_mipmaps;
+
+        // Copy half rate setting
+        saved_state.multirate = state.multirate;
 
         // Write data
         ULONG n_bytes_saved;
-        stream->Write(&state, sizeof(state), &n_bytes_saved);
+        stream->Write(&saved_state, sizeof(saved_state), &n_bytes_saved);
     }
 
     // Handle loading
     else {
         // Read data
         ULONG n_bytes_loaded;
-        stream->Read(&state, sizeof(state), &n_bytes_loaded);
+        stream->Read(&saved_state, sizeof(saved_state), &n_bytes_loaded);
 
         // Extract data from struct
-        // Copy soundfont path and delete whatever was there before
-        free(scene.value_pool.get<wchar_t*>("text_soundfont_path"));
-        wchar_t* soundfont_path = new wchar_t[260];
-        wcscpy_s(soundfont_path, _countof(state.soundfont_path), state.soundfont_path);
-        scene.value_pool.set_ptr("text_soundfont_path", soundfont_path);
-
-        // Copy scale name and delete whatever was there before
-        free(scene.value_pool.get<wchar_t*>("text_scale"));
-        wchar_t* scale_name = new wchar_t[260];
-        wcscpy_s(scale_name, _countof(state.scale_name), state.scale_name);
-        scene.value_pool.set_ptr("text_scale", scale_name);
-
-        // Load the soundfont
-        std::string soundfont_path_8;
-        const size_t length = wcslen(soundfont_path);
-        soundfont_path_8.resize(length);
-        for (size_t i = 0; i < length; ++i) {
-            soundfont_path_8[i] = static_cast<char>(soundfont_path[i]);
-        }
-        soundfont_to_load = soundfont_path_8;
+        // Copy load mode, this decides whether the soundfont gets loaded right away
+        state.deferred_loading = saved_state.deferred_loading;
+
+        // Copy soundfont path and scale name
+        set_soundfont_path(saved_state.soundfont_path);
+        state.scale_name = saved_state.scale_name;
 
         // Copy currently selected bank/program
-        scene.value_pool.set_value<double>("bank", state.bank_program >> 8);
-        scene.value_pool.set_value<double>("program", state.bank_program & 0xFF);
+        state.bank    = saved_state.bank_program >> 8;
+        state.program = saved_state.bank_program & 0xFF;
 
         // Copy volume envelope override settings
-        scene.value_pool.set_value<double>("delay",     state.volenv_delay);
-        scene.value_pool.set_value<double>("attack",    state.volenv_attack);
-        scene.value_pool.set_value<double>("hold",      state.volenv_hold);
-        scene.value_pool.set_value<double>("decay",     state.volenv_decay);
-        scene.value_pool.set_value<double>("sustain",   state.volenv_sustain);
-        scene.value_pool.set_value<double>("release",   state.volenv_release);
+        state.volenv_delay   = saved_state.volenv_delay;
+        state.volenv_attack  = saved_state.volenv_attack;
+        state.volenv_hold    = saved_state.volenv_hold;
+        state.volenv_decay   = saved_state.volenv_decay;
+        state.volenv_sustain = saved_state.volenv_sustain;
+        state.volenv_release = saved_state.volenv_release;
 
         // Copy sampling mode
-        scene.value_pool.set_value<double>("sampling_mode", state.sampling_mode);
+        state.sampling_mode = saved_state.sampling_mode;
 
         // Copy scale
-        scale = state.scale;
+        scale = saved_state.scale;
+
+        // Copy output routing, making sure a damaged project can't make us index past the table
+        if (saved_state.output_routing.n_routes > MAX_OUTPUT_ROUTES || saved_state.output_routing.preset > Flan::RoutingPreset::custom) {
+            saved_state.output_routing = Flan::OutputRouting();
+        }
+        state.output_routing.set(saved_state.output_routing);
+
+        // Copy multitimbral mode
+        set_multitimbral(saved_state.multitimbral);
+
+        // Copy host rate samples setting
+        set_host_rate_samples(saved_state.host_rate_samples);
+
+        // Copy render sampling mode
+        state.render_sampling_mode = (saved_state.render_sampling_mode < N_SAMPLING_MODES) ? saved_state.render_sampling_mode : -1;
+
+        // Copy mipmap setting
+        set_sample_mipmaps(saved_state.sample_mipmaps);
+
+        // Copy half rate setting, the notes that start from now on pick it up
+        state.multirate = saved_state.multirate;
+
+        // Let the editor know, if there is one
+        m_ui_dirty = true;
     }
 }
 
@@ -480,18 +533,18 @@ int FlanSoundfontPlayer::ProcessParam(int index, int value, int rec_flags) {
 
 void FlanSoundfontPlayer::GetName(int section, int index, int value, char* name) {
     if (section == FPN_Semitone) {
-        const auto preset_index = m_preset_dropdown->current_selected_index;
-        const auto preset_id = m_dropdown_indices_inverse[preset_index];
-        const auto preset_zones = m_soundfont.presets[preset_id].zones;
+        // The loader thread may be replacing the presets, we get asked again once it's done
+        std::shared_lock guard{ m_synth.note_playing_mutex };
+        const Flan::PresetEntry* preset_entry = m_synth.presets.find(state.preset_key());
 
         // If there's no preset selected, reset all the names to none, which will make FL remove the name (hopefully)
-        if (preset_index == -1) {
+        if (preset_entry == nullptr) {
             sprintf_s(name, 32, "");
         }
 
         // If this a drum bank, show drum note names for that
-        else if (preset_id >= 0x8000 || (preset_id & 0xFF) == 127) {
-            for (const auto& zone : preset_zones) {
+        else if (preset_entry->key >= 0x8000 || (preset_entry->key & 0xFF) == 127) {
+            for (const auto& zone : m_synth.presets.zones(*preset_entry)) {
                 if (zone.key_range_low <= index && zone.key_range_high >= index) {
                     if (index >= drum_names_start && index < static_cast<int>(drum_names_start + std::size(drum_names))) {
                         sprintf_s(name, 32, "%s", drum_names[index - drum_names_start]);
@@ -505,7 +558,7 @@ void FlanSoundfontPlayer::GetName(int section, int index, int value, char* name)
 
         // Otherwise just use regular note names
         else {
-            for (const auto& zone : preset_zones) {
+            for (const auto& zone : m_synth.presets.zones(*preset_entry)) {
                 if (zone.key_range_low <= index && zone.key_range_high >= index) {
                     //if (scale.is_default() == false) {
                         // Correct for scale
@@ -526,8 +579,314 @@ void FlanSoundfontPlayer::GetName(int section, int index, int value, char* name)
     TCPPFruityPlug::GetName(section, index, value, name);
 }
 
-void _stdcall FlanSoundfontPlayer::Idle()
+void _stdcall FlanSoundfontPlayer::Idle_Public()
+{
+    // The render thread can't start jobs itself, so it leaves flags for us
+    if (m_load_wanted.exchange(false, std::memory_order_relaxed) && soundfont_pending()) {
+        request_soundfont_load(Flan::LoadPriority::note);
+    }
+    if (m_synth.one_shots_pending()) {
+        request_one_shot_renders();
+    }
+
+    // Tear down the editor if it has been hidden for a while, it will be recreated when it's shown again
+    if (renderer != nullptr && !window_safe) {
+        const std::chrono::duration<double> hidden_time = std::chrono::steady_clock::now() - m_editor_hidden_since;
+        if (hidden_time.count() > EDITOR_TEARDOWN_DELAY_SECONDS) {
+            destroy_editor();
+        }
+    }
+}
+
+void FlanSoundfontPlayer::create_editor()
+{
+    // Initialize renderer
+    renderer = new Flan::Renderer();
+    renderer->init(1280, 720, true, dll_handle);
+    input = new Flan::Input(renderer->window());
+    scene = new Flan::Scene();
+
+    // Attach our OpenGL window to the FL plugin, by getting the HWND from our GLFWwindow and passing it to the plugin struct
+    EditorHandle = glfwGetWin32Window(renderer->window());
+
+    // Create our UI elements, they get their values from the plugin state on the first frame
+    create_ui();
+    m_ui_dirty = true;
+
+    // Create render thread
+    editor_running = true;
+    m_update_render_thread = std::thread(update_render, this);
+}
+
+void FlanSoundfontPlayer::destroy_editor()
 {
+    // Nothing to do if the editor doesn't exist
+    if (renderer == nullptr) {
+        return;
+    }
+
+    // Tell the rendering thread we're done, and wait for it to finish
+    window_safe = false;
+    editor_running = false;
+    wake_editor();
+    m_update_render_thread.join();
+
+    // Close the input manager
+    delete input;
+    input = nullptr;
+
+    // Delete the window
+    glfwDestroyWindow(renderer->window());
+    delete renderer;
+    renderer = nullptr;
+
+    // Delete the UI elements
+    delete scene;
+    scene = nullptr;
+    m_preset_dropdown = nullptr;
+    m_load_mode_dropdown = nullptr;
+    m_routing_dropdown = nullptr;
+    EditorHandle = nullptr;
+}
+
+void FlanSoundfontPlayer::update_editor_frame()
+{
+    std::lock_guard guard(graphics_thread_lock);
+    Flan::TraceScope trace("editor_frame", m_synth.trace_instance);
+
+    // Show any changes that were made outside the editor, like loading a project or a soundfont
+    if (m_ui_dirty) {
+        sync_ui_from_state();
+        m_ui_dirty = false;
+    }
+
+    // Show the latest telemetry events in the debug text, how much CPU rendering takes, and where the memory goes
+    update_debug_text();
+    set_ui_text("text_profiler", m_synth.profiler.report());
+    update_memory_text();
+
+    // Render the UI
+    renderer->begin_frame();
+    const float delta_time = calculate_delta_time();
+    Flan::update_entities(*scene, *renderer, *input, delta_time);
+    renderer->end_frame();
+    input->update(renderer->window());
+
+    // Apply any changes that were made in the editor
+    sync_state_from_ui();
+}
+
+void FlanSoundfontPlayer::update_debug_text()
+{
+    // Copy the newest events out of the ring, the audio thread can keep pushing while we do this
+    Flan::TelemetryEvent events[TELEMETRY_LINES];
+    const size_t n_events = m_telemetry.read_latest(events, TELEMETRY_LINES);
+
+    // Format them into the debug buffer, newest at the top
+    const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    size_t length = 0;
+    m_debug_buffer[0] = 0;
+    for (size_t i = 0; i < n_events; ++i) {
+        wchar_t line[160];
+        Flan::format_telemetry_event(events[i], now, line, std::size(line));
+        const int n_written = swprintf(m_debug_buffer + length, std::size(m_debug_buffer) - length, L"%ls\n", line);
+        if (n_written < 0) {
+            break;
+        }
+        length += n_written;
+    }
+}
+
+void FlanSoundfontPlayer::update_memory_text()
+{
+    // Walking the soundfont and asking the OS about every sample page isn't free, so don't do it every frame
+    const std::chrono::duration<double> since_measured = std::chrono::steady_clock::now() - m_memory_measured_at;
+    if (since_measured.count() < MEMORY_REFRESH_SECONDS) {
+        return;
+    }
+    m_memory_measured_at = std::chrono::steady_clock::now();
+    m_synth.measure_memory(m_memory_stats);
+
+    // The editor's own allocations. FlanGUI doesn't report what it allocates internally, so this is what we own,
+    // plus an estimate of the window's double buffered color and depth buffers
+    m_memory_stats.editor_open = renderer != nullptr;
+    m_memory_stats.editor_bytes = sizeof(Flan::Renderer) + sizeof(Flan::Scene) + sizeof(Flan::Input);
+    for (const auto& item : m_preset_dropdown->list_items) {
+        m_memory_stats.editor_bytes += sizeof(item) + item.capacity() * sizeof(wchar_t);
+    }
+    m_memory_stats.framebuffer_bytes = static_cast<size_t>(1280) * 720 * (4 * 2 + 4);
+    m_memory_stats.debug_bytes = sizeof(m_telemetry) + sizeof(m_debug_buffer) + sizeof(Flan::RenderProfiler);
+
+    std::wstring text = Flan::memory_summary(m_memory_stats);
+    if (state.multitimbral) {
+        text += L"Multitimbral: MIDI input plays all 16 channels\n";
+    }
+    if (state.render_sampling_mode >= SAMPLING_MODE_SINC_8) {
+        wchar_t line[80];
+        swprintf(line, std::size(line), L"Export: sinc %i-point%ls\n", Flan::sinc_table_for_mode(state.render_sampling_mode)->taps,
+            m_synth.offline_rendering ? L", rendering now" : L"");
+        text += line;
+    }
+    if (state.sample_mipmaps) {
+        text += m_memory_stats.mip_bytes > 0 ? L"Mipmaps: on\n" : L"Mipmaps: building...\n";
+    }
+    if (state.multirate) {
+        text += L"Half rate: on\n";
+    }
+    if (state.host_rate_samples) {
+        text += m_memory_stats.host_rate_bytes > 0 ? L"Host rate samples: on\n" : L"Host rate samples: resampling...\n";
+    }
+    if (m_synth.governor.stats().n_degradations > 0) {
+        text += m_synth.governor.report() + L"\n";
+    }
+    if (!m_memory_report_path.empty()) {
+        text += L"Report: " + m_memory_report_path + L"\n";
+    }
+    if (Flan::trace_enabled()) {
+        text += L"Tracing...";
+    }
+    else if (!m_trace_path.empty()) {
+        text += L"Trace: " + m_trace_path;
+    }
+    set_ui_text("text_memory", text);
+}
+
+void FlanSoundfontPlayer::write_memory_report()
+{
+    // Measure again, so the report has the voices that are playing right now
+    m_memory_measured_at = {};
+    update_memory_text();
+
+    wchar_t temp_path[MAX_PATH];
+    if (GetTempPathW(MAX_PATH, temp_path) == 0) {
+        return;
+    }
+    const std::wstring path = std::wstring(temp_path) + MEMORY_REPORT_FILE_NAME;
+    FILE* file = _wfopen(path.c_str(), L"w");
+    if (file == nullptr) {
+        return;
+    }
+    const std::string json = Flan::memory_report_json(m_memory_stats);
+    fwrite(json.data(), 1, json.size(), file);
+    fclose(file);
+
+    // Show where it went on the next refresh
+    m_memory_report_path = path;
+    m_memory_measured_at = {};
+}
+
+void FlanSoundfontPlayer::set_multitimbral(const bool enabled)
+{
+    // Let FL send us its MIDI input, or stop doing that. Notes that are still playing on the MIDI channels would never
+    // get their note off anymore, so those are stopped
+    state.multitimbral = enabled;
+    PlugHost->Dispatcher(HostTag, FHD_WantMIDIInput, 0, enabled ? 1 : 0);
+    if (!enabled) {
+        m_synth.reset_midi_channels();
+    }
+}
+
+void FlanSoundfontPlayer::set_host_rate_samples(const bool enabled)
+{
+    // Building them takes a while, throwing them away stops the notes that are playing them
+    state.host_rate_samples = enabled;
+    if (enabled) {
+        request_host_rate_samples();
+    }
+    else {
+        m_synth.clear_host_rate_samples();
+    }
+}
+
+void FlanSoundfontPlayer::set_sample_mipmaps(const bool enabled)
+{
+    // Building them takes a while, the notes that are reading them carry on without them when they're thrown away.
+    // The resampled samples have mips of their own, so those get rebuilt with or without
+    if (state.sample_mipmaps == enabled) {
+        return;
+    }
+    state.sample_mipmaps = enabled;
+    if (enabled) {
+        request_sample_mips();
+    }
+    else {
+        m_synth.clear_sample_mips();
+    }
+    if (state.host_rate_samples) {
+        m_synth.clear_host_rate_samples();
+        request_host_rate_samples();
+    }
+}
+
+void FlanSoundfontPlayer::request_sample_mips()
+{
+    // A soundfont that isn't loaded yet gets them when it is
+    if (soundfont_pending()) {
+        return;
+    }
+    Flan::SoundfontLoader::instance().request(&m_mip_jobs, Flan::LoadPriority::background, [this]() {
+        m_synth.build_sample_mips();
+    });
+}
+
+void FlanSoundfontPlayer::request_host_rate_samples()
+{
+    // Queued behind any soundfont loads, a load that comes after it builds them again anyway
+    Flan::SoundfontLoader::instance().request(&m_synth, Flan::LoadPriority::background, [this]() {
+        m_synth.build_host_rate_samples();
+    });
+}
+
+void FlanSoundfontPlayer::request_one_shot_renders()
+{
+    Flan::SoundfontLoader::instance().request(&m_one_shot_jobs, Flan::LoadPriority::background, [this]() {
+        m_synth.render_one_shots();
+    });
+}
+
+void FlanSoundfontPlayer::toggle_trace()
+{
+    // Tracing is shared by all instances, so any of them can stop a trace another one started
+    if (!Flan::trace_enabled()) {
+        Flan::trace_start();
+        m_memory_measured_at = {};
+        return;
+    }
+
+    wchar_t temp_path[MAX_PATH];
+    if (GetTempPathW(MAX_PATH, temp_path) == 0) {
+        return;
+    }
+    const std::wstring path = std::wstring(temp_path) + TRACE_FILE_NAME;
+    if (Flan::trace_stop(path)) {
+        m_trace_path = path;
+    }
+    m_memory_measured_at = {};
+}
+
+void FlanSoundfontPlayer::set_soundfont_path(const std::wstring& path)
+{
+    // Nothing to do if this soundfont is already loaded
+    state.soundfont_path = path;
+    if (path == m_loaded_soundfont_path && !soundfont_pending()) {
+        return;
+    }
+    ++m_soundfont_generation;
+
+    // Notes played from now on are for the new soundfont, they wait for it instead of starting on the old one
+    m_synth.hold_notes();
+
+    // Unless the soundfont should only be loaded when it's needed, queue it right away
+    if (!state.deferred_loading) {
+        request_soundfont_load(Flan::LoadPriority::background);
+    }
+}
+
+void FlanSoundfontPlayer::request_soundfont_load(const Flan::LoadPriority priority)
+{
+    Flan::SoundfontLoader::instance().request(this, priority, [this]() {
+        load_soundfont();
+    });
 }
 
 void FlanSoundfontPlayer::create_ui()
@@ -542,7 +901,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_bank", text_bank_transform, {
+        Flan::create_text(*scene, "text_bank", text_bank_transform, {
             L"Bank:",
             {2, 2},
             {1, 1, 1, 1},
@@ -559,25 +918,23 @@ void FlanSoundfontPlayer::create_ui()
             Flan::AnchorPoint::top_left
         };
         Flan::NumberRange nb_bank_number_range{ 0, 255, 1, 0, 0 };
-        auto entity = Flan::create_numberbox(scene, "bank", nb_bank_transform, nb_bank_number_range);
-        Flan::add_function(scene, entity, [&]() {
+        auto entity = Flan::create_numberbox(*scene, "bank", nb_bank_transform, nb_bank_number_range);
+        Flan::add_function(*scene, entity, [&]() {
             // Get current values of bank and program
-            const u16 bank = static_cast<uint16_t>(scene.value_pool.get<double>("bank"));
-            const u16 program = static_cast<uint16_t>(scene.value_pool.get<double>("program"));
+            const u16 bank = static_cast<uint16_t>(scene->value_pool.get<double>("bank"));
+            const u16 program = static_cast<uint16_t>(scene->value_pool.get<double>("program"));
             const u16 preset_key = (bank << 8) | program;
 
-            // If the soundfont does not contain a preset at this key, the selection is invalid
-            if (!m_soundfont.presets.contains(preset_key)) {
-                m_preset_dropdown->current_selected_index = -1;
+            // Apply the new bank and program right away, FL will ask for the new note names before the frame ends
+            sync_state_from_ui();
 
-                // Tell FL Studio that the note names may have changed
-                PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
-                return;
+            // Set the current index of the dropdown to match the preset. If the soundfont does not contain a preset at this
+            // key, the selection is invalid. The loader thread may be replacing the presets, so look it up locked
+            {
+                std::shared_lock guard{ m_synth.note_playing_mutex };
+                m_preset_dropdown->current_selected_index = m_synth.presets.index_of(preset_key);
             }
 
-            // Otherwise, set the current index of the dropdown to match the preset
-            m_preset_dropdown->current_selected_index = m_dropdown_indices[preset_key];
-
             // Tell FL Studio that the note names may have changed
             PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
         });
@@ -590,7 +947,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_program", text_program_transform, {
+        Flan::create_text(*scene, "text_program", text_program_transform, {
             L"Program:",
             {2, 2},
             {1, 1, 1, 1},
@@ -607,26 +964,24 @@ void FlanSoundfontPlayer::create_ui()
             Flan::AnchorPoint::top_left
         };
         Flan::NumberRange nb_program_number_range{ 0, 255, 1, 0, 0 };
-        Flan::EntityID entity = Flan::create_numberbox(scene, "program", nb_program_transform, nb_program_number_range);
+        Flan::EntityID entity = Flan::create_numberbox(*scene, "program", nb_program_transform, nb_program_number_range);
 
-        Flan::add_function(scene, entity, [&]() {
+        Flan::add_function(*scene, entity, [&]() {
             // Get current values of bank and program
-            const u16 bank = static_cast<uint16_t>(scene.value_pool.get<double>("bank"));
-            const u16 program = static_cast<uint16_t>(scene.value_pool.get<double>("program"));
+            const u16 bank = static_cast<uint16_t>(scene->value_pool.get<double>("bank"));
+            const u16 program = static_cast<uint16_t>(scene->value_pool.get<double>("program"));
             const u16 preset_key = (bank << 8) | program;
 
-            // If the soundfont does not contain a preset at this key, the selection is invalid
-            if (!m_soundfont.presets.contains(preset_key)) {
-                m_preset_dropdown->current_selected_index = -1;
+            // Apply the new bank and program right away, FL will ask for the new note names before the frame ends
+            sync_state_from_ui();
 
-                // Tell FL Studio that the note names may have changed
-                PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
-                return;
+            // Set the current index of the dropdown to match the preset. If the soundfont does not contain a preset at this
+            // key, the selection is invalid. The loader thread may be replacing the presets, so look it up locked
+            {
+                std::shared_lock guard{ m_synth.note_playing_mutex };
+                m_preset_dropdown->current_selected_index = m_synth.presets.index_of(preset_key);
             }
 
-            // Otherwise, set the current index of the dropdown to match the preset
-            m_preset_dropdown->current_selected_index = m_dropdown_indices[preset_key];
-
             // Tell FL Studio that the note names may have changed
             PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
         });
@@ -639,7 +994,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_preset", text_preset_transform, {
+        Flan::create_text(*scene, "text_preset", text_preset_transform, {
             L"Selected preset:",
             {2, 2},
             {1, 1, 1, 1},
@@ -655,14 +1010,24 @@ void FlanSoundfontPlayer::create_ui()
             0.1f,
             Flan::AnchorPoint::top_left
         };
-        auto combobox_entity = Flan::create_combobox(scene, "combobox_preset", db_program_transform, { L"000:000 - Piano 1", L"000:001 - Piano 2" });
-        m_preset_dropdown = scene.get_component<Flan::Combobox>(combobox_entity);
-        Flan::add_function(scene, combobox_entity, [&]() {
+        auto combobox_entity = Flan::create_combobox(*scene, "combobox_preset", db_program_transform, { L"000:000 - Piano 1", L"000:001 - Piano 2" });
+        m_preset_dropdown = scene->get_component<Flan::Combobox>(combobox_entity);
+        Flan::add_function(*scene, combobox_entity, [&]() {
+            // The dropdown lists the presets in the same order as the preset directory
             const auto index = m_preset_dropdown->current_selected_index;
-            const double bank = m_dropdown_indices_inverse[index] >> 8;
-            const double program = m_dropdown_indices_inverse[index] & 0xFF;
-            scene.value_pool.set_value<double>("program", program);
-            scene.value_pool.set_value<double>("bank", bank);
+            u16 preset_key;
+            {
+                std::shared_lock guard{ m_synth.note_playing_mutex };
+                if (index < 0 || index >= static_cast<int>(m_synth.presets.size())) {
+                    return;
+                }
+                preset_key = m_synth.presets[index].key;
+            }
+            const double bank = preset_key >> 8;
+            const double program = preset_key & 0xFF;
+            scene->value_pool.set_value<double>("program", program);
+            scene->value_pool.set_value<double>("bank", bank);
+            sync_state_from_ui();
 
             // Tell FL Studio that the note names may have changed
             PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
@@ -676,7 +1041,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_soundfont_path", text_soundfont_transform, {
+        Flan::create_text(*scene, "text_soundfont_path", text_soundfont_transform, {
             L"C:/Windows/System32/drivers/gm.dls",
             {2, 2},
             {1, 1, 1, 1},
@@ -692,7 +1057,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_button(scene, button_soundfont_transform, [&]()
+        Flan::create_button(*scene, button_soundfont_transform, [&]()
             {
                 // Describe file open dialog
                 OPENFILENAME ofn;
@@ -713,21 +1078,11 @@ void FlanSoundfontPlayer::create_ui()
                 // Open the dialog
                 if (GetOpenFileName(&ofn) == TRUE) {
                     // Stop all audio
-                    for (const auto* voice : m_active_voices) {
-                        for (auto* wave_osc : voice->wave_oscs) {
-                            wave_osc->vol_env.stage = Flan::EnvStage::off;
-                        }
-                    }
-
-                    // Convert path to a string
-                    std::string path;
-                    path.resize(wcslen(sz_file));
-                    for (size_t i = 0; i < path.size(); ++i) {
-                        path[i] = static_cast<char>(sz_file[i]);
-                    }
+                    m_synth.stop_all_voices();
 
                     // Load the soundfont
-                    soundfont_to_load = path;
+                    set_soundfont_path(sz_file);
+                    request_soundfont_load(Flan::LoadPriority::user);
                 }
             }, { L"...", {2, 2}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
     }
@@ -769,11 +1124,11 @@ void FlanSoundfontPlayer::create_ui()
                 {20 + stride * static_cast<float>(i), 360},
                 {20 + stride * static_cast<float>(i + 1), 640},
             };
-            Flan::create_slider(scene, names[i], slider_transform, ranges[i], true);
-            Flan::create_text(scene, "text_" + names[i], text_transform, { text[i], {2, 2}, {1, 1, 1, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center }, false);
+            Flan::create_slider(*scene, names[i], slider_transform, ranges[i], true);
+            Flan::create_text(*scene, "text_" + names[i], text_transform, { text[i], {2, 2}, {1, 1, 1, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center }, false);
         }
 
-        Flan::create_text(scene, "text_overrides", {
+        Flan::create_text(*scene, "text_overrides", {
             {20, 280},
             {640, 320},
             }, { L"Relative volume envelope overrides:", {2, 2}, {1, 1, 1, 1}, Flan::AnchorPoint::left, Flan::AnchorPoint::left }, false);
@@ -786,7 +1141,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_scale", text_scale_transform, {
+        Flan::create_text(*scene, "text_scale", text_scale_transform, {
             L"12-TET",
             {2, 2},
             {1, 1, 1, 1},
@@ -802,7 +1157,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_button(scene, button_scale_transform, [&]()
+        Flan::create_button(*scene, button_scale_transform, [&]()
             {
                 // Describe file open dialog
                 OPENFILENAME ofn;
@@ -823,11 +1178,7 @@ void FlanSoundfontPlayer::create_ui()
                 // Open the dialog
                 if (GetOpenFileName(&ofn) == TRUE) {
                     // Stop all audio
-                    for (const auto* voice : m_active_voices) {
-                        for (auto* wave_osc : voice->wave_oscs) {
-                            wave_osc->vol_env.stage = Flan::EnvStage::off;
-                        }
-                    }
+                    m_synth.stop_all_voices();
 
                     // Convert path to a string
                     std::string path;
@@ -840,10 +1191,8 @@ void FlanSoundfontPlayer::create_ui()
                     scale.from_file(path);
 
                     // Change the text in the scale text box to be the same as the scale title
-                    free(scene.value_pool.get<wchar_t*>("text_scale"));
-                    wchar_t* new_name = new wchar_t[260];
-                    memcpy_s(new_name, sizeof(wchar_t) * 260, sz_file, sizeof(sz_file));
-                    scene.value_pool.set_ptr("text_scale", new_name);
+                    state.scale_name = sz_file;
+                    set_ui_text("text_scale", state.scale_name);
 
                     // Tell FL Studio that the note names may have changed
                     PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
@@ -864,17 +1213,20 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_sampling_mode", text_sampling_transform, {
+        Flan::create_text(*scene, "text_sampling_mode", text_sampling_transform, {
             L"Sampling mode",
             {3, 3},
             {1, 1, 1, 1},
             Flan::AnchorPoint::left,
             Flan::AnchorPoint::left,
             }, false);
-        Flan::create_radio_button(scene, "sampling_mode", radio_button_sampling_transform, {
+        Flan::create_radio_button(*scene, "sampling_mode", radio_button_sampling_transform, {
             L"Point sampling (1-point)",
             L"Linear sampling (2-point)",
             L"Gaussian sampling (4-point)",
+            L"Sinc sampling (8-point)",
+            L"Sinc sampling (16-point)",
+            L"Sinc sampling (32-point)",
             }, 2);
     }
     // Debug text
@@ -885,7 +1237,7 @@ void FlanSoundfontPlayer::create_ui()
             0.5f,
             Flan::AnchorPoint::top_left
         };
-        Flan::create_text(scene, "text_debug", text_debug_transform, {
+        Flan::create_text(*scene, "text_debug", text_debug_transform, {
             L"debug text!",
             {1, 1},
             {1, 1, 1, 1},
@@ -893,79 +1245,312 @@ void FlanSoundfontPlayer::create_ui()
             Flan::AnchorPoint::left,
             }, false);
     }
+    // Render profiler text
+    {
+        Flan::Transform text_profiler_transform{
+            {760, 650},
+            {1260, 710},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_text(*scene, "text_profiler", text_profiler_transform, {
+            L"",
+            {1, 1},
+            {1, 1, 1, 1},
+            Flan::AnchorPoint::left,
+            Flan::AnchorPoint::left,
+            }, false);
+    }
+    // Memory accounting text, a button to write the full report, and one to start and stop tracing
+    {
+        Flan::Transform text_memory_transform{
+            {760, 380},
+            {1150, 640},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_text(*scene, "text_memory", text_memory_transform, {
+            L"",
+            {1, 1},
+            {1, 1, 1, 1},
+            Flan::AnchorPoint::left,
+            Flan::AnchorPoint::left,
+            }, false);
+
+        Flan::Transform button_memory_transform{
+            {1160, 380},
+            {1260, 430},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_memory_transform, [&]()
+            {
+                write_memory_report();
+            }, { L"Dump", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+
+        Flan::Transform button_trace_transform{
+            {1160, 440},
+            {1260, 490},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_trace_transform, [&]()
+            {
+                toggle_trace();
+            }, { L"Trace", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+
+        Flan::Transform button_multitimbral_transform{
+            {1160, 500},
+            {1260, 550},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_multitimbral_transform, [&]()
+            {
+                set_multitimbral(!state.multitimbral);
+                m_memory_measured_at = {};
+            }, { L"MIDI", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+
+        Flan::Transform button_host_rate_transform{
+            {1160, 560},
+            {1260, 610},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_host_rate_transform, [&]()
+            {
+                set_host_rate_samples(!state.host_rate_samples);
+                m_memory_measured_at = {};
+            }, { L"Rate", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+
+        // New notes that don't need the full rate render at half of it, see Synth::try_half_rate()
+        Flan::Transform button_multirate_transform{
+            {1050, 560},
+            {1150, 610},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_multirate_transform, [&]()
+            {
+                state.multirate = !state.multirate;
+                m_memory_measured_at = {};
+            }, { L"Half", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+
+        Flan::Transform button_mipmaps_transform{
+            {1050, 620},
+            {1150, 670},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_mipmaps_transform, [&]()
+            {
+                set_sample_mipmaps(!state.sample_mipmaps);
+                m_memory_measured_at = {};
+            }, { L"Mips", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+
+        // Cycles the sampling mode used when FL renders to a file: same as live, then sinc with 8, 16 and 32 taps
+        Flan::Transform button_render_quality_transform{
+            {1160, 620},
+            {1260, 670},
+            0.5f,
+            Flan::AnchorPoint::top_left
+        };
+        Flan::create_button(*scene, button_render_quality_transform, [&]()
+            {
+                state.render_sampling_mode = (state.render_sampling_mode < SAMPLING_MODE_SINC_8) ? SAMPLING_MODE_SINC_8
+                    : (state.render_sampling_mode < SAMPLING_MODE_SINC_32) ? state.render_sampling_mode + 1 : -1;
+                m_memory_measured_at = {};
+            }, { L"HQ", {1, 1}, {0, 0, 0, 1}, Flan::AnchorPoint::center, Flan::AnchorPoint::center });
+    }
+    // Create dropdown menu for soundfont load mode
+    {
+        Flan::Transform db_load_mode_transform{
+            {20, 650},
+            {365, 710},
+            0.1f,
+            Flan::AnchorPoint::top_left
+        };
+        auto combobox_entity = Flan::create_combobox(*scene, "combobox_load_mode", db_load_mode_transform, { L"Load soundfont when it's needed", L"Load soundfont in the background" });
+        m_load_mode_dropdown = scene->get_component<Flan::Combobox>(combobox_entity);
+        Flan::add_function(*scene, combobox_entity, [&]() {
+            state.deferred_loading = m_load_mode_dropdown->current_selected_index != 1;
+
+            // If we're switching to background loading, start loading now
+            if (!state.deferred_loading && soundfont_pending()) {
+                request_soundfont_load(Flan::LoadPriority::background);
+            }
+        });
+    }
+    // Create dropdown menu for output routing, in the same order as Flan::RoutingPreset
+    {
+        Flan::Transform db_routing_transform{
+            {375, 650},
+            {720, 710},
+            0.1f,
+            Flan::AnchorPoint::top_left
+        };
+        auto combobox_entity = Flan::create_combobox(*scene, "combobox_routing", db_routing_transform, {
+            L"Everything to the main output",
+            L"Drum groups to outputs 1-6",
+            L"Every zone to its own output",
+            });
+        m_routing_dropdown = scene->get_component<Flan::Combobox>(combobox_entity);
+        Flan::add_function(*scene, combobox_entity, [&]() {
+            state.output_routing.set(Flan::make_output_routing(static_cast<Flan::RoutingPreset>(m_routing_dropdown->current_selected_index)));
+        });
+    }
 }
 
 void FlanSoundfontPlayer::update_preset_dropdown_menu()
 {
-    // Clear the list of presets
-    m_preset_dropdown->list_items.clear();
-    m_dropdown_indices.clear();
-    m_dropdown_indices_inverse.clear();
-
-    // Loop over all the soundfont presets
-    for (auto& preset : m_soundfont.presets) {
-        // Get the bank and program for the current one
-        const auto bank = (preset.first & 0xFF00) >> 8;
-        const auto program = (preset.first & 0x00FF);
-
-        // Convert name to wstring
-        std::wstring name;
-        name.resize(preset.second.name.length() + 10);
-
-        // Add bank number and program number to the preset name
-        name[0] = L'0' + (bank / 100) % 10;
-        name[1] = L'0' + (bank / 10) % 10;
-        name[2] = L'0' + (bank / 1) % 10;
-        name[3] = ':';
-        name[4] = L'0' + (program / 100) % 10;
-        name[5] = L'0' + (program / 10) % 10;
-        name[6] = L'0' + (program / 1) % 10;
-        name[7] = ' ';
-        name[8] = '-';
-        name[9] = ' ';
-
-        // Add the actual name from the soundfont data
-        for (size_t i = 0; i < preset.second.name.length(); i++) {
-            name[i + 10] = preset.second.name[i];
+    // The synth names the presets when it loads the soundfont, in directory order, so a row in the dropdown menu is also
+    // the preset's index in the directory. This only copies them, without holding the synth's lock
+    const auto names = m_synth.preset_names();
+    if (names == nullptr) {
+        m_preset_dropdown->list_items.clear();
+        return;
+    }
+    m_preset_dropdown->list_items = *names;
+}
+
+void FlanSoundfontPlayer::load_soundfont() {
+    // Get the soundfont that should be loaded now, it may have changed since the load was requested
+    std::wstring path;
+    unsigned generation;
+    {
+        std::lock_guard guard{ graphics_thread_lock };
+        if (!soundfont_pending()) {
+            return;
         }
+        path = state.soundfont_path;
+        generation = m_soundfont_generation;
+    }
+    const std::string path_8(path.begin(), path.end());
 
-        // Add the preset to the list
-        m_preset_dropdown->list_items.push_back(name);
+    // Stop all audio and load the soundfont. The synth is locked while it loads, so take us out of FL's processing
+    // in the meantime, instead of letting the audio thread wait on the lock for as long as the load takes
+    Flan::TraceScope trace("load_soundfont", m_synth.trace_instance);
+    PlugHost->SuspendOutput(HostTag);
+    m_synth.load_soundfont(path_8);
+    PlugHost->ResumeOutput(HostTag);
 
-        // Add the index to the indices map, so we can update dropdown menu when the bank/program numberboxes update
-        m_dropdown_indices[preset.first] = static_cast<int>(m_dropdown_indices_inverse.size());
+    // The editor will update the browse box and the dropdown menu on its next frame
+    {
+        std::lock_guard guard{ graphics_thread_lock };
+        m_loaded_soundfont_path = path;
+        m_loaded_soundfont_generation = generation;
+        m_ui_dirty = true;
+    }
 
-        // Add the bank and program to the inverse list, so we can update the bank and program number boxes when the dropdown menu updates
-        m_dropdown_indices_inverse.push_back(preset.first);
+    // The path may have changed again while this one loaded, then the notes wait for that one too
+    if (soundfont_pending()) {
+        m_synth.hold_notes();
+    }
 
+    // FL may have asked for the note names while the presets were being replaced
+    PlugHost->Dispatcher(HostTag, FHD_NamesChanged, 0, FPN_Semitone);
+
+    // The notes can already play, they pick up the mips once they're built, outside the synth's lock
+    if (state.sample_mipmaps) {
+        m_synth.build_sample_mips();
+    }
+
+    // Log how long that took
+    Flan::TelemetryEvent load_event;
+    load_event.type = Flan::TelemetryEventType::soundfont_loaded;
+    load_event.int_value = static_cast<int>(m_synth.presets.size());
+    load_event.levels[0] = static_cast<float>(m_synth.load_timings().stop_voices * 1000.0);
+    load_event.levels[1] = static_cast<float>(m_synth.load_timings().from_file * 1000.0);
+    load_event.levels[2] = static_cast<float>(m_synth.load_timings().build_mips * 1000.0);
+    m_telemetry.push(load_event);
+
+    // The load threw away the resampled samples, this is the loader thread already so build them right here
+    if (state.host_rate_samples) {
+        m_synth.build_host_rate_samples();
     }
 }
 
-void FlanSoundfontPlayer::load_soundfont(const std::string& path) {
-    // Lock the wavetables so we don't surprise the audio render thread
+void FlanSoundfontPlayer::sync_ui_from_state()
+{
+    // Update the dropdown menu
     {
-        std::lock_guard guard{ m_note_playing_mutex };
-        // Load soundfont
-        m_soundfont.clear();
-        m_soundfont.from_file(path);
+        const auto start = std::chrono::steady_clock::now();
+        update_preset_dropdown_menu();
+        const auto built = std::chrono::steady_clock::now();
+        const std::chrono::duration<float, std::milli> duration = built - start;
+        Flan::trace_span("preset_list", m_synth.trace_instance, start.time_since_epoch().count(), built.time_since_epoch().count(),
+            static_cast<int64_t>(m_preset_dropdown->list_items.size()));
+
+        Flan::TelemetryEvent list_event;
+        list_event.type = Flan::TelemetryEventType::preset_list_built;
+        list_event.int_value = static_cast<int>(m_preset_dropdown->list_items.size());
+        list_event.levels[0] = duration.count();
+        m_telemetry.push(list_event);
     }
 
-    // Get text in the browse box
-    wchar_t* text_soundfont_path = reinterpret_cast<wchar_t*>(scene.value_pool.values["text_soundfont_path"]);
-
-    // Reallocate it for the new path length
-    text_soundfont_path = static_cast<wchar_t*>(realloc(text_soundfont_path, (path.size() + 1) * 2));
+    // Set the text in the browse boxes
+    set_ui_text("text_soundfont_path", state.soundfont_path);
+    set_ui_text("text_scale", state.scale_name);
 
-    // Copy the string to it
-    for (size_t i = 0; i < path.size() + 1; ++i) {
-        text_soundfont_path[i] = path[i];
+    // Set the bank/program number boxes, and select the matching preset in the dropdown menu
+    scene->value_pool.set_value<double>("bank", state.bank);
+    scene->value_pool.set_value<double>("program", state.program);
+    {
+        std::shared_lock guard{ m_synth.note_playing_mutex };
+        m_preset_dropdown->current_selected_index = m_synth.presets.index_of(state.preset_key());
     }
 
-    // Set the text in the browse box
-    scene.value_pool.set_value("text_soundfont_path", reinterpret_cast<intptr_t>(text_soundfont_path));
+    // Set the volume envelope override sliders
+    scene->value_pool.set_value<double>("delay",   state.volenv_delay);
+    scene->value_pool.set_value<double>("attack",  state.volenv_attack);
+    scene->value_pool.set_value<double>("hold",    state.volenv_hold);
+    scene->value_pool.set_value<double>("decay",   state.volenv_decay);
+    scene->value_pool.set_value<double>("sustain", state.volenv_sustain);
+    scene->value_pool.set_value<double>("release", state.volenv_release);
 
-    // Update the dropdown menu
-    update_preset_dropdown_menu();
+    // Set the sampling mode radio button
+    scene->value_pool.set_value<double>("sampling_mode", state.sampling_mode);
+
+    // Set the load mode dropdown menu
+    m_load_mode_dropdown->current_selected_index = state.deferred_loading ? 0 : 1;
+
+    // Set the output routing dropdown menu
+    const Flan::RoutingPreset routing_preset = state.output_routing.get().preset;
+    m_routing_dropdown->current_selected_index = (routing_preset == Flan::RoutingPreset::custom) ? -1 : static_cast<int>(routing_preset);
+
+    // Point the debug text at our debug buffer
+    scene->value_pool.set_ptr<wchar_t>("text_debug", m_debug_buffer);
+}
+
+void FlanSoundfontPlayer::sync_state_from_ui()
+{
+    // Copy currently selected bank/program
+    state.bank    = static_cast<u16>(scene->value_pool.get<double>("bank"));
+    state.program = static_cast<u16>(scene->value_pool.get<double>("program"));
+
+    // Copy volume envelope override settings
+    state.volenv_delay   = scene->value_pool.get<double>("delay");
+    state.volenv_attack  = scene->value_pool.get<double>("attack");
+    state.volenv_hold    = scene->value_pool.get<double>("hold");
+    state.volenv_decay   = scene->value_pool.get<double>("decay");
+    state.volenv_sustain = scene->value_pool.get<double>("sustain");
+    state.volenv_release = scene->value_pool.get<double>("release");
+
+    // Copy sampling mode
+    state.sampling_mode = static_cast<int>(scene->value_pool.get<double>("sampling_mode"));
+}
+
+void FlanSoundfontPlayer::set_ui_text(const std::string& name, const std::wstring& text) const
+{
+    // Get the text that's currently there, and reallocate it for the new length
+    auto* buffer = reinterpret_cast<wchar_t*>(scene->value_pool.values[name]);
+    buffer = static_cast<wchar_t*>(realloc(buffer, (text.size() + 1) * sizeof(wchar_t)));
+
+    // Copy the string to it
+    memcpy(buffer, text.c_str(), (text.size() + 1) * sizeof(wchar_t));
+
+    // Set the text in the value pool
+    scene->value_pool.set_value(name, reinterpret_cast<intptr_t>(buffer));
 }
 
 float FlanSoundfontPlayer::calculate_delta_time() {
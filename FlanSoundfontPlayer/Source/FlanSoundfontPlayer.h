@@ -1,16 +1,40 @@
 #pragma once
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include "Scale.h"
 #include "FruityPlug/fp_cplug.h"
 #include "../../FlanGUI/Renderer.h"
 #include "../../FlanGUI/ComponentSystem.h"
 #include "../../FlanGUI/ComponentsGUI.h"
-#include "../../SoundfontStudies/SoundfontStudies/soundfont.h"
-#include "WavetableOscillator.h"
+#include "SoundfontLoader.h"
+#include "Telemetry.h"
+#include "Synth.h"
 #define N_WAVE_OSCS 64
 
+// Build as a hybrid generator: FL asks for every voice separately through Voice_Render, and mixes, routes and processes
+// them in its own sampler, instead of us mixing all voices in Gen_Render
+#ifndef FLAN_HYBRID_GENERATOR
+#define FLAN_HYBRID_GENERATOR 0
+#endif
+
+// How long the editor can stay hidden before its window, scene and render thread are destroyed
+#define EDITOR_TEARDOWN_DELAY_SECONDS 30.0
+
+// How many events the telemetry ring keeps, and how many of the newest ones the editor shows
+#define TELEMETRY_CAPACITY 256
+#define TELEMETRY_LINES 10
+
+// How often the editor measures where the memory goes, and where the memory report gets written
+#define MEMORY_REFRESH_SECONDS 1.0
+#define MEMORY_REPORT_FILE_NAME L"FlanSoundfontPlayer_memory.json"
+#define TRACE_FILE_NAME L"FlanSoundfontPlayer_trace.json"
+
+// Frames the extra output buffers hold per output. They're allocated once, longer blocks are rendered in parts
+#define OUTPUT_BLOCK_FRAMES 1024
+
 class FlanSoundfontPlayer final : public TCPPFruityPlug
 {
 public:
@@ -19,49 +43,108 @@ public:
     intptr_t _stdcall Dispatcher(intptr_t id, intptr_t index, intptr_t value) override;
     TVoiceHandle _stdcall TriggerVoice(PVoiceParams voice_params, intptr_t set_tag) override;
     void _stdcall Voice_Release(TVoiceHandle handle) override;
+    void _stdcall Voice_Kill(TVoiceHandle handle) override;
+    int _stdcall Voice_Render(TVoiceHandle handle, PWAV32FS dest_buffer, int& length) override;
     int _stdcall ProcessEvent(int event_id, int event_value, int flags) override;
+    void _stdcall MIDIIn(int& msg) override;
     void _stdcall Gen_Render(PWAV32FS dest_buffer, int& length) override;
     void _stdcall SaveRestoreState(IStream* stream, BOOL save) override;
     int _stdcall ProcessParam(int index, int value, int rec_flags) override;
     void _stdcall GetName(int section, int index, int value, char* name) override;
-    
-    void _stdcall Idle() override;
-    Flan::Renderer renderer;
-    Flan::Scene scene;
+
+    void _stdcall Idle_Public() override;
+
+    // Editor, only exists while the editor is shown, or was hidden less than EDITOR_TEARDOWN_DELAY_SECONDS ago
+    Flan::Renderer* renderer = nullptr;
+    Flan::Scene* scene = nullptr;
     Flan::Input* input = nullptr;
+    // Both are read by the render thread, which sleeps on editor_wake while the window is hidden. Call wake_editor()
+    // after changing either of them
+    std::atomic<bool> window_safe = false;
+    std::atomic<bool> editor_running = false;
+    std::mutex editor_wake_mutex;
+    std::condition_variable editor_wake;
+    void wake_editor();
+    std::mutex graphics_thread_lock;
+    void update_editor_frame();
+
     Flan::Scale scale;
-    bool window_safe = false;
+    PluginState state;
     bool not_destructing = true;
-    std::mutex graphics_thread_lock;
-    std::string soundfont_to_load;
-    void load_soundfont(const std::string& path);
     float calculate_delta_time();
 
+    // Soundfont loading, happens on the shared loader thread so neither FL nor the audio thread have to wait for it.
+    // With deferred loading, a soundfont that's restored from a project is only loaded once it's actually needed.
+    void set_soundfont_path(const std::wstring& path);
+    void request_soundfont_load(Flan::LoadPriority priority);
+    void load_soundfont();
+    [[nodiscard]] bool soundfont_pending() const { return m_soundfont_generation != m_loaded_soundfont_generation; }
+
+    // Multitimbral mode, where the MIDI input plays all 16 channels with their own presets from this one instance
+    void set_multitimbral(bool enabled);
+
+    // Playing copies of the samples resampled to the host's rate, which get built on the loader thread
+    void set_host_rate_samples(bool enabled);
+    void request_host_rate_samples();
+
+    // Lower rate copies of the samples for high notes, also built on the loader thread. Off unless the user turns them on
+    void set_sample_mipmaps(bool enabled);
+    void request_sample_mips();
+
+    // The one-shots the render thread asked for are rendered on the loader thread too
+    void request_one_shot_renders();
+
+    // Render cost measurements, safe to read from any thread
+    [[nodiscard]] const Flan::RenderProfiler& profiler() const { return m_synth.profiler; }
+
 private:
     // UI
+    void create_editor();
+    void destroy_editor();
     void create_ui();
     void update_preset_dropdown_menu();
+    void sync_ui_from_state();
+    void sync_state_from_ui();
+    void set_ui_text(const std::string& name, const std::wstring& text) const;
+    void update_debug_text();
+    void update_memory_text();
+    void write_memory_report();
+    void toggle_trace();
     std::thread m_update_render_thread;
     Flan::Combobox* m_preset_dropdown = nullptr;
+    Flan::Combobox* m_load_mode_dropdown = nullptr;
+    Flan::Combobox* m_routing_dropdown = nullptr;
+    bool m_ui_dirty = true;
+    std::chrono::time_point<std::chrono::steady_clock> m_editor_hidden_since = std::chrono::steady_clock::now();
 
-    // Soundfont
-    Flan::Soundfont m_soundfont;
+    // Engine
+    Flan::Synth m_synth{ state, scale };
 
-    // Voices
-    std::vector<Flan::Voice*> m_active_voices;
-    std::mutex m_note_playing_mutex;
-    double m_midi_pitch = 0.0;
-    double m_sample_rate = 1.0;
-    double m_sample_rate_inv = 1.0;
+    // Extra outputs. FL tells us how many mixer tracks we can send to when the routing changes, and the zones that are
+    // routed there are rendered into these block buffers first, then added to FL's output buffers
+    void update_host_outputs();
+    bool render_outputs(float* dest, int n_outputs, int offset, int length);
+    std::atomic<int> m_n_host_outputs = 0;  // Extra outputs, not counting the main one
+    std::vector<float> m_output_buffers;    // Room for every extra output, allocated before FL's outputs are first used
 
-    // Optimizations
-    std::vector<u16> m_dropdown_indices_inverse;
-    std::map<u16, int> m_dropdown_indices;
+    // Soundfont
+    std::wstring m_loaded_soundfont_path;
+    std::atomic<unsigned> m_soundfont_generation = 0;        // Incremented every time the soundfont path changes
+    std::atomic<unsigned> m_loaded_soundfont_generation = 0; // Generation that's currently loaded in the synth
+    const char m_one_shot_jobs = 0;                          // The loader keeps one job per owner, so these need an owner of their own
+    const char m_mip_jobs = 0;                               // Same for building the mips
+    std::atomic<bool> m_load_wanted = false;                 // A note came in before the soundfont was loaded, see Idle_Public
 
     // Delta Time
     std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
     std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
 
     // Debug
-    wchar_t m_debug_buffer[1024] = { 0 };
-};
\ No newline at end of file
+    Flan::TelemetryRing<TELEMETRY_CAPACITY> m_telemetry;
+    wchar_t m_debug_buffer[2048] = { 0 };
+    Flan::MemoryStats m_memory_stats;
+    std::chrono::time_point<std::chrono::steady_clock> m_memory_measured_at;
+    std::wstring m_memory_report_path;
+    std::wstring m_trace_path;
+    int m_quality_level = 0;    // Governor level the debug text last heard about, only touched by the audio thread
+};
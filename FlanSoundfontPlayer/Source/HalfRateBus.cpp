@@ -0,0 +1,121 @@
+#include "HalfRateBus.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include "FilterDesign.h"
+
+namespace Flan {
+    // The taps of the half-band filter that fall between the half rate frames, nearest first. Each of them is used on both
+    // sides of the frame it makes, and together they add up to 1
+    static const float* upsampler_taps() {
+        static const auto taps = [] {
+            const std::vector<double> half_band = half_band_taps(MULTIRATE_TAPS);
+            constexpr int half = MULTIRATE_TAPS / 2;
+            double sum = 0.0;
+            for (int j = 0; j < MULTIRATE_HALF_TAPS; ++j) {
+                sum += half_band[half + j * 2 + 1] * 2.0;
+            }
+            std::array<float, MULTIRATE_HALF_TAPS> result{};
+            for (int j = 0; j < MULTIRATE_HALF_TAPS; ++j) {
+                result[j] = static_cast<float>(half_band[half + j * 2 + 1] / sum);
+            }
+            return result;
+        }();
+        return taps.data();
+    }
+
+    bool fits_half_rate(const WavetableOscillator& osc, const double sample_delta, const double sample_rate) {
+        const Zone& zone = osc.preset_zone;
+
+        // The highest the sample can go, as a fraction of the host rate: its own Nyquist frequency moved by its pitch, and
+        // by as much as the modulators and a pitch bend can still take it up
+        const double pitch_up_cents = std::max(static_cast<double>(zone.mod_env_to_pitch), 0.0) + std::abs(static_cast<double>(zone.mod_lfo_to_pitch))
+            + std::abs(static_cast<double>(zone.vib_lfo_to_pitch)) + MULTIRATE_BEND_HEADROOM * 100.0;
+        const double bandwidth = 0.5 * sample_delta * osc.level_pitch_mul * pow(2.0, pitch_up_cents / 1200.0);
+        if (bandwidth <= MULTIRATE_MAX_BANDWIDTH) {
+            return true;
+        }
+
+        // Above a quarter of the host rate it folds back down, which the filter takes care of if it's far enough above the
+        // cutoff. Same for what the filter lets through past the upsampler's pass band
+        const double filter_up_cents = std::max(static_cast<double>(zone.mod_env_to_filter), 0.0) + std::abs(static_cast<double>(zone.mod_lfo_to_filter));
+        const double cutoff = static_cast<double>(zone.filter.cutoff) * pow(2.0, filter_up_cents / 1200.0) / sample_rate;
+        const double lowest_alias = 0.5 - std::min(bandwidth, 0.5);
+        return cutoff * MULTIRATE_FILTER_MARGIN <= std::min(lowest_alias, MULTIRATE_MAX_BANDWIDTH);
+    }
+
+    void HalfRateBus::open_to(const int64_t end) {
+        const int64_t end_index = (end + 1) / 2;
+        for (int64_t index = std::max(m_open_end, end_index - MULTIRATE_BUS_FRAMES); index < end_index; ++index) {
+            m_frames[index & (MULTIRATE_BUS_FRAMES - 1)] = { 0.0f, 0.0f };
+            m_full_rate_frames[(index * 2) & (MULTIRATE_BUS_FRAMES * 2 - 1)] = { 0.0f, 0.0f };
+            m_full_rate_frames[(index * 2 + 1) & (MULTIRATE_BUS_FRAMES * 2 - 1)] = { 0.0f, 0.0f };
+        }
+        m_open_end = std::max(m_open_end, end_index);
+    }
+
+    void HalfRateBus::add(const int64_t frame, const BufferSample* frames, const int n) {
+        if (n <= 0) {
+            return;
+        }
+        const int64_t first = frame / 2;
+        for (int i = 0; i < n; ++i) {
+            BufferSample& dest = m_frames[(first + i) & (MULTIRATE_BUS_FRAMES - 1)];
+            dest.left += frames[i].left;
+            dest.right += frames[i].right;
+        }
+        m_live_until = std::max(m_live_until, frame + static_cast<int64_t>(n) * 2 + MULTIRATE_LOOKAHEAD);
+    }
+
+    void HalfRateBus::add_full_rate(const int64_t frame, const BufferSample* frames, const int n) {
+        if (n <= 0) {
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            BufferSample& dest = m_full_rate_frames[(frame + i) & (MULTIRATE_BUS_FRAMES * 2 - 1)];
+            dest.left += frames[i].left;
+            dest.right += frames[i].right;
+        }
+        m_full_rate_until = std::max(m_full_rate_until, frame + n);
+        m_live_until = std::max(m_live_until, m_full_rate_until);
+    }
+
+    void HalfRateBus::mix_into(float* dest, const int64_t begin, const int64_t end) const {
+        const float* taps = upsampler_taps();
+        for (int64_t frame = begin; frame < std::min(end, m_live_until); ++frame, dest += 2) {
+            if (frame < m_full_rate_until) {
+                const BufferSample& sample = m_full_rate_frames[frame & (MULTIRATE_BUS_FRAMES * 2 - 1)];
+                dest[0] += sample.left;
+                dest[1] += sample.right;
+            }
+
+            // Even frames are the half rate frames themselves
+            if ((frame & 1) == 0) {
+                const BufferSample& sample = at(frame / 2);
+                dest[0] += sample.left;
+                dest[1] += sample.right;
+                continue;
+            }
+
+            // Odd ones are halfway between two of them
+            const int64_t index = frame / 2;
+            float left = 0.0f;
+            float right = 0.0f;
+            for (int j = 0; j < MULTIRATE_HALF_TAPS; ++j) {
+                const BufferSample& before = at(index - j);
+                const BufferSample& after = at(index + 1 + j);
+                left += taps[j] * (before.left + after.left);
+                right += taps[j] * (before.right + after.right);
+            }
+            dest[0] += left;
+            dest[1] += right;
+        }
+    }
+
+    void HalfRateBus::clear() {
+        std::fill_n(m_frames, MULTIRATE_BUS_FRAMES, BufferSample{ 0.0f, 0.0f });
+        std::fill_n(m_full_rate_frames, MULTIRATE_BUS_FRAMES * 2, BufferSample{ 0.0f, 0.0f });
+        m_live_until = 0;
+        m_full_rate_until = 0;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+
+#include "WavetableOscillator.h"
+
+// Taps of the half-band filter that brings the half rate voices back up to the host rate, odd. Only the taps between
+// the half rate frames are used, the frames themselves pass straight through
+#define MULTIRATE_TAPS 47
+#define MULTIRATE_HALF_TAPS ((MULTIRATE_TAPS + 1) / 4)
+
+// How far past a frame the upsampler reads, in host frames. Half rate voices are always rendered this far ahead
+#define MULTIRATE_LOOKAHEAD (MULTIRATE_HALF_TAPS * 2)
+
+// Half rate voices are rendered and upsampled this many host frames at a time, so the bus can stay small
+#define MULTIRATE_CHUNK 256
+#define MULTIRATE_BUS_FRAMES 512
+
+// Voices that get bent up too far for the half rate go back to the full rate, fading from one to the other over this
+// many host frames
+#define MULTIRATE_FADE_FRAMES MULTIRATE_LOOKAHEAD
+
+// Oscillators only go half rate if everything they make stays under this fraction of the host rate, where the
+// upsampler's pass band ends. It leaves room for bending them up by MULTIRATE_BEND_HEADROOM semitones
+#define MULTIRATE_MAX_BANDWIDTH 0.18
+#define MULTIRATE_BEND_HEADROOM 2.0
+
+// Or if whatever folds back down at half rate lands at least this many times the filter cutoff
+#define MULTIRATE_FILTER_MARGIN 4.0
+
+namespace Flan {
+    // Whether the oscillator's content fits in half the host rate, from the sample's rate, its pitch and how far the
+    // modulators can take it up, and its filter cutoff. `sample_delta` is its delta at the full host rate
+    [[nodiscard]] bool fits_half_rate(const WavetableOscillator& osc, double sample_delta, double sample_rate);
+
+    // Voices that render at half the host rate add their frames here, and one polyphase half-band filter upsamples the
+    // sum of them all. Frames are addressed in host frames since the synth started, half rate frame i is host frame 2i.
+    // The upsampler reads MULTIRATE_LOOKAHEAD frames past the one it makes, so the voices run that far ahead. Voices
+    // that went back to the full rate can't fall back behind, so they stay ahead and add host rate frames next to it
+    class HalfRateBus {
+    public:
+        // Makes the frames before host frame `end` ready to add to, clearing the ones that weren't yet
+        void open_to(int64_t end);
+
+        // Adds `n` half rate frames, starting at host frame `frame`, which is even
+        void add(int64_t frame, const BufferSample* frames, int n);
+
+        // Adds `n` host rate frames, starting at host frame `frame`, which skip the upsampler
+        void add_full_rate(int64_t frame, const BufferSample* frames, int n);
+
+        // Adds host frames `begin` up to `end` to `dest`, interleaved stereo starting at `begin`
+        void mix_into(float* dest, int64_t begin, int64_t end) const;
+
+        // Whether there's anything left to hear at host frame `frame` or after
+        [[nodiscard]] bool live(const int64_t frame) const { return frame < m_live_until; }
+
+        void clear();
+
+    private:
+        [[nodiscard]] const BufferSample& at(const int64_t index) const { return m_frames[index & (MULTIRATE_BUS_FRAMES - 1)]; }
+
+        BufferSample m_frames[MULTIRATE_BUS_FRAMES]{};
+        BufferSample m_full_rate_frames[MULTIRATE_BUS_FRAMES * 2]{};
+        int64_t m_open_end = 0;         // Half rate frames before this one are cleared, and the host rate frames before twice it
+        int64_t m_live_until = 0;       // Host frame from which the upsampler only sees silence
+        int64_t m_full_rate_until = 0;  // Host frame from which there are no host rate frames
+    };
+}
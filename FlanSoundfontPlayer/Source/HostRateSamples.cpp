@@ -0,0 +1,126 @@
+#include "HostRateSamples.h"
+#include <algorithm>
+#include <cmath>
+#include "FilterDesign.h"
+
+namespace Flan {
+    // sinc(x) * kaiser(x / zeros) for x from 0 to the last zero crossing, one extra entry so lookups can interpolate
+    static const std::vector<double>& sinc_table() {
+        static const std::vector<double> table = [] {
+            constexpr double beta = 9.0;
+            std::vector<double> result(HOST_RATE_SINC_ZEROS * HOST_RATE_SINC_PHASES + 2, 0.0);
+            for (size_t i = 0; i <= HOST_RATE_SINC_ZEROS * HOST_RATE_SINC_PHASES; ++i) {
+                const double x = static_cast<double>(i) / HOST_RATE_SINC_PHASES;
+                result[i] = sinc(x) * kaiser_window(x / HOST_RATE_SINC_ZEROS, beta);
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    void resample(const i16* data, const u32 length, const u32 loop_start, const u32 loop_end, const double ratio, std::vector<i16>& dest) {
+        const std::vector<double>& table = sinc_table();
+        const bool looped = loop_end > loop_start && loop_end < length;
+        const double cutoff = std::min(1.0, ratio);     // Going down in rate, the sinc gets wider to filter out what won't fit
+        const double half_width = HOST_RATE_SINC_ZEROS / cutoff;
+        dest.resize(static_cast<size_t>(ceil(static_cast<double>(length) * ratio)));
+        for (size_t i = 0; i < dest.size(); ++i) {
+            const double position = static_cast<double>(i) / ratio;
+            const int64_t first = static_cast<int64_t>(ceil(position - half_width));
+            const int64_t last = static_cast<int64_t>(floor(position + half_width));
+            double sum = 0.0;
+            for (int64_t n = first; n <= last; ++n) {
+                int64_t index = n;
+                if (looped && index > loop_end) {
+                    index = loop_start + (index - loop_start) % (loop_end - loop_start);
+                }
+                if (index < 0 || index >= length) {
+                    continue;
+                }
+                const double x = std::abs(position - static_cast<double>(n)) * cutoff * HOST_RATE_SINC_PHASES;
+                const size_t step = static_cast<size_t>(x);
+                const double t = x - static_cast<double>(step);
+                sum += data[index] * std::lerp(table[step], table[step + 1], t);
+            }
+            dest[i] = static_cast<i16>(std::clamp(lround(sum * cutoff), -32768l, 32767l));
+        }
+    }
+
+    void HostRateSampleTable::build(const std::vector<Sample>& samples, const double sample_rate, const bool with_mips) {
+        m_samples.clear();
+        m_mips.clear();
+        m_sample_rate = sample_rate;
+        std::vector<Sample> resampled;
+        for (const Sample& sample : samples) {
+            if (sample.base_sample_rate == 0 || sample.length == 0 || static_cast<double>(sample.base_sample_rate) == sample_rate) {
+                continue;
+            }
+            const double ratio = sample_rate / static_cast<double>(sample.base_sample_rate);
+            for (const i16* data : { sample.data, sample.linked }) {
+                if (data == nullptr || m_samples.contains(data)) {
+                    continue;
+                }
+                HostRateSample& result = m_samples[data];
+                result.ratio = ratio;
+                result.loop_start = static_cast<u32>(lround(sample.loop_start * ratio));
+                result.loop_end = static_cast<u32>(lround(sample.loop_end * ratio));
+                resample(data, sample.length, sample.loop_start, sample.loop_end, ratio, result.data);
+
+                Sample copy = sample;
+                copy.data = result.data.data();
+                copy.linked = nullptr;
+                copy.length = static_cast<u32>(result.data.size());
+                copy.loop_start = result.loop_start;
+                copy.loop_end = result.loop_end;
+                resampled.push_back(copy);
+            }
+        }
+        if (with_mips) {
+            m_mips.build(resampled);
+        }
+    }
+
+    bool HostRateSampleTable::substitute(WavetableOscillator& osc) const {
+        const auto entry = m_samples.find(osc.sample.data);
+        if (entry == m_samples.end()) {
+            return false;
+        }
+        const HostRateSample& resampled = entry->second;
+        const double ratio = resampled.ratio;
+        const auto linked = (osc.sample.linked != nullptr) ? m_samples.find(osc.sample.linked) : m_samples.end();
+
+        osc.sample.data = const_cast<i16*>(resampled.data.data());
+        osc.sample.linked = (linked != m_samples.end()) ? const_cast<i16*>(linked->second.data.data()) : nullptr;
+        osc.sample.length = static_cast<u32>(resampled.data.size());
+        osc.sample.loop_start = resampled.loop_start;
+        osc.sample.loop_end = resampled.loop_end;
+        osc.sample.base_sample_rate = static_cast<u32>(lround(m_sample_rate));
+
+        // The zone offsets are in frames of the original sample
+        Zone& zone = osc.preset_zone;
+        zone.sample_start_offset = static_cast<i32>(lround(zone.sample_start_offset * ratio));
+        zone.sample_end_offset = static_cast<i32>(lround(zone.sample_end_offset * ratio));
+        zone.sample_loop_start_offset = static_cast<i32>(lround(zone.sample_loop_start_offset * ratio));
+        zone.sample_loop_end_offset = static_cast<i32>(lround(zone.sample_loop_end_offset * ratio));
+
+        // At the root key this lands on 1 give or take a rounding error, make it exactly 1 so the position stays whole
+        osc.sample_delta *= ratio;
+        if (std::abs(osc.sample_delta - 1.0) < 1e-9) {
+            osc.sample_delta = 1.0;
+        }
+
+        if (osc.mips != nullptr) {
+            osc.mips = m_mips.find(osc.sample.data);
+            osc.linked_mips = m_mips.find(osc.sample.linked);
+        }
+        return true;
+    }
+
+    size_t HostRateSampleTable::bytes() const {
+        size_t bytes = m_mips.bytes();
+        for (const auto& [data, sample] : m_samples) {
+            bytes += sizeof(std::pair<const i16* const, HostRateSample>) + 2 * sizeof(void*) + sample.data.capacity() * sizeof(i16);
+        }
+        return bytes;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+
+#include "WavetableOscillator.h"
+#include "SampleMips.h"
+
+// Zero crossings on each side of the windowed sinc used to resample to the host rate
+#define HOST_RATE_SINC_ZEROS 32
+
+// Kernel table resolution, in steps per zero crossing
+#define HOST_RATE_SINC_PHASES 256
+
+namespace Flan {
+    // One channel of a sample, resampled to the host's sample rate
+    struct HostRateSample {
+        std::vector<i16> data;
+        u32 loop_start = 0;
+        u32 loop_end = 0;
+        double ratio = 1.0;     // Host rate over the sample's own rate
+    };
+
+    // Every sample of a soundfont that isn't at the host's rate already, resampled to it, so notes played at their root key
+    // step through them at exactly 1 frame per frame and don't have to interpolate
+    class HostRateSampleTable {
+    public:
+        // Slow, this is meant for a background thread. `with_mips` builds the mips of the resampled samples too
+        void build(const std::vector<Sample>& samples, double sample_rate, bool with_mips);
+
+        // Points the oscillator at the resampled sample, with the zone offsets and sample delta converted to match.
+        // Returns false if there's none for its sample
+        bool substitute(WavetableOscillator& osc) const;
+
+        [[nodiscard]] double sample_rate() const { return m_sample_rate; }
+        [[nodiscard]] size_t bytes() const;
+
+    private:
+        std::unordered_map<const i16*, HostRateSample> m_samples;
+        SampleMipTable m_mips;
+        double m_sample_rate = 0.0;
+    };
+
+    // Kaiser windowed sinc resampler, low-passed at the lower of the two Nyquist frequencies. `loop_start` and `loop_end`
+    // make it wrap around the loop like the oscillator does, pass loop_end <= loop_start for samples that don't loop
+    void resample(const i16* data, u32 length, u32 loop_start, u32 loop_end, double ratio, std::vector<i16>& dest);
+}
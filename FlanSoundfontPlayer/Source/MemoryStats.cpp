@@ -0,0 +1,297 @@
+#include "MemoryStats.h"
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Flan {
+    namespace {
+        using Span = std::pair<const void*, size_t>;
+
+        size_t sample_data_bytes(const Sample& sample) {
+            return static_cast<size_t>(sample.length) * sizeof(i16);
+        }
+
+        // Adds the sample's data, and for stereo samples the other half too, since the voice plays both
+        void add_sample_spans(const Sample& sample, std::vector<Span>& spans) {
+            if (sample.data != nullptr) {
+                spans.emplace_back(sample.data, sample_data_bytes(sample));
+            }
+            if ((sample.type & (leftSample | rightSample)) != 0 && sample.linked != nullptr && sample.linked != sample.data) {
+                spans.emplace_back(sample.linked, sample_data_bytes(sample));
+            }
+        }
+
+        // Sorts the spans and merges the ones that overlap, so shared sample data only gets counted once. Returns the total size
+        size_t merge_spans(std::vector<Span>& spans) {
+            std::sort(spans.begin(), spans.end());
+            size_t n_merged = 0;
+            size_t total = 0;
+            for (const Span& span : spans) {
+                const auto* begin = static_cast<const char*>(span.first);
+                if (n_merged > 0) {
+                    Span& last = spans[n_merged - 1];
+                    const auto* last_end = static_cast<const char*>(last.first) + last.second;
+                    if (begin <= last_end) {
+                        const auto* end = std::max(last_end, begin + span.second);
+                        total += end - last_end;
+                        last.second = end - static_cast<const char*>(last.first);
+                        continue;
+                    }
+                }
+                spans[n_merged++] = span;
+                total += span.second;
+            }
+            spans.resize(n_merged);
+            return total;
+        }
+
+        // Part of the page at `page` that falls inside the span
+        size_t page_overlap(const uintptr_t page, const size_t page_size, const uintptr_t begin, const uintptr_t end) {
+            return std::min(page + page_size, end) - std::max(page, begin);
+        }
+
+        void append_json_value(std::string& out, const char* key, const size_t value, const bool comma = true) {
+            char buffer[96];
+            snprintf(buffer, sizeof(buffer), "\"%s\": %zu%s", key, value, comma ? ", " : "");
+            out += buffer;
+        }
+
+        // Names come straight from the soundfont, as whatever 8-bit bytes it holds. Quotes, backslashes and control characters
+        // are escaped, and bytes past ASCII are read as Latin-1 and escaped too, so the report is always valid JSON and UTF-8
+        void append_json_string(std::string& out, const std::string& text) {
+            out += '"';
+            for (const char c : text) {
+                const auto byte = static_cast<unsigned char>(c);
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += c;
+                }
+                else if (byte < 0x20 || byte >= 0x7F) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04X", byte);
+                    out += buffer;
+                }
+                else {
+                    out += c;
+                }
+            }
+            out += '"';
+        }
+
+        std::wstring format_bytes(const size_t bytes) {
+            wchar_t buffer[32];
+            if (bytes >= 1024 * 1024) {
+                swprintf(buffer, std::size(buffer), L"%.1f MB", static_cast<double>(bytes) / (1024.0 * 1024.0));
+            }
+            else if (bytes >= 1024) {
+                swprintf(buffer, std::size(buffer), L"%.1f KB", static_cast<double>(bytes) / 1024.0);
+            }
+            else {
+                swprintf(buffer, std::size(buffer), L"%zu B", bytes);
+            }
+            return buffer;
+        }
+    }
+
+    void measure_soundfont(const Soundfont& soundfont, const PresetDirectory& presets, MemoryStats& stats) {
+        // Sample pool and headers
+        stats.n_samples = soundfont.samples.size();
+        stats.sample_table_bytes = soundfont.samples.capacity() * sizeof(Sample);
+        stats.sample_spans.clear();
+        for (const Sample& sample : soundfont.samples) {
+            add_sample_spans(sample, stats.sample_spans);
+        }
+        stats.sample_bytes = merge_spans(stats.sample_spans);
+
+        // Presets, the directory's slot table, names and zones
+        stats.n_presets = presets.size();
+        stats.n_zones = presets.n_zones();
+        stats.preset_table_bytes = presets.bytes();
+        stats.presets.clear();
+        stats.presets.reserve(presets.size());
+        std::vector<Span> preset_spans;
+        for (const PresetEntry& preset : presets) {
+            // Sample data this preset needs to be playable
+            preset_spans.clear();
+            for (const Zone& zone : presets.zones(preset)) {
+                if (zone.sample_index < soundfont.samples.size()) {
+                    add_sample_spans(soundfont.samples[zone.sample_index], preset_spans);
+                }
+            }
+            std::sort(preset_spans.begin(), preset_spans.end());
+            preset_spans.erase(std::unique(preset_spans.begin(), preset_spans.end()), preset_spans.end());
+            PresetMemory preset_memory;
+            preset_memory.preset_key = preset.key;
+            preset_memory.name = preset.name;
+            preset_memory.n_samples = preset_spans.size();
+            preset_memory.sample_bytes = merge_spans(preset_spans);
+            stats.presets.push_back(std::move(preset_memory));
+        }
+        std::stable_sort(stats.presets.begin(), stats.presets.end(), [](const PresetMemory& a, const PresetMemory& b) {
+            return a.sample_bytes > b.sample_bytes;
+        });
+    }
+
+    void copy_soundfont_stats(const MemoryStats& from, MemoryStats& to) {
+        to.n_samples = from.n_samples;
+        to.sample_bytes = from.sample_bytes;
+        to.sample_table_bytes = from.sample_table_bytes;
+        to.n_presets = from.n_presets;
+        to.n_zones = from.n_zones;
+        to.preset_table_bytes = from.preset_table_bytes;
+        to.presets = from.presets;
+        to.sample_spans = from.sample_spans;
+    }
+
+    void measure_voices(const std::vector<Voice*>& voices, MemoryStats& stats) {
+        stats.n_voices = voices.size();
+        stats.n_oscillators = 0;
+        stats.voice_bytes = voices.capacity() * sizeof(Voice*);
+        for (const Voice* voice : voices) {
+            stats.n_oscillators += voice->wave_oscs.size();
+            stats.voice_bytes += sizeof(Voice) + voice->wave_oscs.capacity() * sizeof(WavetableOscillator*);
+            stats.voice_bytes += voice->wave_oscs.size() * sizeof(WavetableOscillator);
+        }
+    }
+
+    void measure_residency(MemoryStats& stats) {
+        stats.sample_bytes_resident = 0;
+#ifdef _WIN32
+        SYSTEM_INFO system_info;
+        GetSystemInfo(&system_info);
+        const size_t page_size = system_info.dwPageSize;
+
+        // QueryWorkingSetEx takes a list of pages, so do them in batches
+        constexpr size_t batch_size = 1024;
+        PSAPI_WORKING_SET_EX_INFORMATION pages[batch_size];
+        for (const auto& [data, size] : stats.sample_spans) {
+            const auto begin = reinterpret_cast<uintptr_t>(data);
+            const uintptr_t end = begin + size;
+            uintptr_t page = begin & ~(page_size - 1);
+            while (page < end) {
+                size_t n_pages = 0;
+                for (; n_pages < batch_size && page + n_pages * page_size < end; ++n_pages) {
+                    pages[n_pages].VirtualAddress = reinterpret_cast<PVOID>(page + n_pages * page_size);
+                }
+                if (QueryWorkingSetEx(GetCurrentProcess(), pages, static_cast<DWORD>(n_pages * sizeof(pages[0])))) {
+                    for (size_t i = 0; i < n_pages; ++i) {
+                        if (pages[i].VirtualAttributes.Valid) {
+                            stats.sample_bytes_resident += page_overlap(page + i * page_size, page_size, begin, end);
+                        }
+                    }
+                }
+                page += n_pages * page_size;
+            }
+        }
+#else
+        const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        std::vector<unsigned char> pages;
+        for (const auto& [data, size] : stats.sample_spans) {
+            const auto begin = reinterpret_cast<uintptr_t>(data);
+            const uintptr_t end = begin + size;
+            const uintptr_t first_page = begin & ~(page_size - 1);
+            const size_t n_pages = (end - first_page + page_size - 1) / page_size;
+            pages.resize(n_pages);
+            if (mincore(reinterpret_cast<void*>(first_page), end - first_page, pages.data()) != 0) {
+                continue;
+            }
+            for (size_t i = 0; i < n_pages; ++i) {
+                if (pages[i] & 1) {
+                    stats.sample_bytes_resident += page_overlap(first_page + i * page_size, page_size, begin, end);
+                }
+            }
+        }
+#endif
+    }
+
+    size_t total_bytes(const MemoryStats& stats) {
+        return stats.sample_bytes + stats.mip_bytes + stats.host_rate_bytes + stats.sample_table_bytes + stats.preset_table_bytes + stats.voice_bytes
+            + stats.one_shot_bytes + stats.editor_bytes + stats.framebuffer_bytes + stats.debug_bytes;
+    }
+
+    std::wstring memory_summary(const MemoryStats& stats) {
+        wchar_t line[160];
+        std::wstring summary;
+        swprintf(line, std::size(line), L"Memory: %ls total\n", format_bytes(total_bytes(stats)).c_str());
+        summary += line;
+        swprintf(line, std::size(line), L"Samples: %ls (%ls resident), %zu samples, mips %ls, host rate %ls\n",
+            format_bytes(stats.sample_bytes).c_str(), format_bytes(stats.sample_bytes_resident).c_str(), stats.n_samples,
+            format_bytes(stats.mip_bytes).c_str(), format_bytes(stats.host_rate_bytes).c_str());
+        summary += line;
+        swprintf(line, std::size(line), L"Tables: %ls, %zu presets, %zu zones\n",
+            format_bytes(stats.sample_table_bytes + stats.preset_table_bytes).c_str(), stats.n_presets, stats.n_zones);
+        summary += line;
+        swprintf(line, std::size(line), L"Voices: %ls, %zu voices, %zu oscillators\n",
+            format_bytes(stats.voice_bytes).c_str(), stats.n_voices, stats.n_oscillators);
+        summary += line;
+        swprintf(line, std::size(line), L"One-shot cache: %ls, %zu renders\n", format_bytes(stats.one_shot_bytes).c_str(), stats.n_one_shots);
+        summary += line;
+        swprintf(line, std::size(line), L"Editor: %ls, framebuffers ~%ls, debug %ls\n",
+            format_bytes(stats.editor_bytes).c_str(), format_bytes(stats.framebuffer_bytes).c_str(), format_bytes(stats.debug_bytes).c_str());
+        summary += line;
+
+        // Biggest presets, the ones worth trimming or streaming
+        for (size_t i = 0; i < stats.presets.size() && i < MEMORY_TOP_PRESETS; ++i) {
+            const PresetMemory& preset = stats.presets[i];
+            const std::wstring name(preset.name.begin(), preset.name.end());
+            swprintf(line, std::size(line), L"  %03i:%03i %-20ls %ls\n",
+                preset.preset_key >> 8, preset.preset_key & 0xFF, name.c_str(), format_bytes(preset.sample_bytes).c_str());
+            summary += line;
+        }
+        return summary;
+    }
+
+    std::string memory_report_json(const MemoryStats& stats) {
+        std::string json = "{\n  ";
+        append_json_value(json, "total_bytes", total_bytes(stats), false);
+        json += ",\n  \"samples\": {";
+        append_json_value(json, "count", stats.n_samples);
+        append_json_value(json, "bytes", stats.sample_bytes);
+        append_json_value(json, "resident_bytes", stats.sample_bytes_resident);
+        append_json_value(json, "mip_bytes", stats.mip_bytes);
+        append_json_value(json, "host_rate_bytes", stats.host_rate_bytes, false);
+        json += "},\n  \"tables\": {";
+        append_json_value(json, "presets", stats.n_presets);
+        append_json_value(json, "zones", stats.n_zones);
+        append_json_value(json, "sample_table_bytes", stats.sample_table_bytes);
+        append_json_value(json, "preset_table_bytes", stats.preset_table_bytes, false);
+        json += "},\n  \"voices\": {";
+        append_json_value(json, "count", stats.n_voices);
+        append_json_value(json, "oscillators", stats.n_oscillators);
+        append_json_value(json, "bytes", stats.voice_bytes, false);
+        json += "},\n  \"one_shot_cache\": {";
+        append_json_value(json, "count", stats.n_one_shots);
+        append_json_value(json, "bytes", stats.one_shot_bytes, false);
+        json += "},\n  \"editor\": {";
+        json += stats.editor_open ? "\"open\": true, " : "\"open\": false, ";
+        append_json_value(json, "bytes", stats.editor_bytes);
+        append_json_value(json, "framebuffer_bytes_estimate", stats.framebuffer_bytes);
+        append_json_value(json, "debug_bytes", stats.debug_bytes, false);
+        json += "},\n  \"presets\": [";
+        for (size_t i = 0; i < stats.presets.size(); ++i) {
+            const PresetMemory& preset = stats.presets[i];
+            char buffer[160];
+            snprintf(buffer, sizeof(buffer), "%s\n    {\"bank\": %i, \"program\": %i, \"name\": ",
+                i == 0 ? "" : ",", preset.preset_key >> 8, preset.preset_key & 0xFF);
+            json += buffer;
+            append_json_string(json, preset.name);
+            json += ", ";
+            append_json_value(json, "samples", preset.n_samples);
+            append_json_value(json, "sample_bytes", preset.sample_bytes, false);
+            json += "}";
+        }
+        json += stats.presets.empty() ? "]\n}\n" : "\n  ]\n}\n";
+        return json;
+    }
+}
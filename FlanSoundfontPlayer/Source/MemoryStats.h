@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "WavetableOscillator.h"
+#include "PresetDirectory.h"
+#include "../../SoundfontStudies/SoundfontStudies/soundfont.h"
+
+// How many of the biggest presets the editor lists
+#define MEMORY_TOP_PRESETS 3
+
+namespace Flan {
+    struct PresetMemory {
+        u16 preset_key = 0;
+        std::string name;
+        size_t n_samples = 0;       // Distinct samples the zones play, linked stereo halves included
+        size_t sample_bytes = 0;    // Sample data those take up. Samples shared between presets count for every one of them
+    };
+
+    // Where an instance's memory goes. Everything is in bytes
+    struct MemoryStats {
+        // Sample pool
+        size_t n_samples = 0;
+        size_t sample_bytes = 0;            // Sample data that's allocated, shared and linked samples only counted once
+        size_t sample_bytes_resident = 0;   // How much of that is actually in physical memory right now
+        size_t mip_bytes = 0;               // Lower rate copies of the samples for high notes
+        size_t host_rate_bytes = 0;         // Samples resampled to the host rate, and their mips
+
+        // Tables the soundfont keeps after parsing
+        size_t n_presets = 0;
+        size_t n_zones = 0;
+        size_t sample_table_bytes = 0;      // Sample headers
+        size_t preset_table_bytes = 0;      // Presets, their names and their flattened zones
+
+        // Voices
+        size_t n_voices = 0;
+        size_t n_oscillators = 0;
+        size_t voice_bytes = 0;
+
+        // Pre-rendered one-shots
+        size_t n_one_shots = 0;
+        size_t one_shot_bytes = 0;
+
+        // Editor, only filled in by the plugin
+        bool editor_open = false;
+        size_t editor_bytes = 0;            // Renderer, scene and input objects, the preset list and the text buffers
+        size_t framebuffer_bytes = 0;       // Estimate, FlanGUI doesn't tell us what the driver allocates
+        size_t debug_bytes = 0;             // Telemetry ring and debug text
+
+        // Per preset, biggest first
+        std::vector<PresetMemory> presets;
+
+        // Address ranges of the sample data, to look up residency without holding any locks
+        std::vector<std::pair<const void*, size_t>> sample_spans;
+    };
+
+    // Fills in the sample pool, tables and per preset footprint. Doesn't look at residency, that's measure_residency()
+    void measure_soundfont(const Soundfont& soundfont, const PresetDirectory& presets, MemoryStats& stats);
+
+    // Copies what measure_soundfont() filled in from `from`
+    void copy_soundfont_stats(const MemoryStats& from, MemoryStats& to);
+
+    void measure_voices(const std::vector<Voice*>& voices, MemoryStats& stats);
+
+    // Asks the OS how much of the sample data is in physical memory. This only queries the address ranges and never
+    // reads them, so it's fine if the soundfont was unloaded in the meantime
+    void measure_residency(MemoryStats& stats);
+
+    [[nodiscard]] size_t total_bytes(const MemoryStats& stats);
+
+    // Short summary for the editor
+    [[nodiscard]] std::wstring memory_summary(const MemoryStats& stats);
+
+    // Everything, as JSON
+    [[nodiscard]] std::string memory_report_json(const MemoryStats& stats);
+}
@@ -0,0 +1,201 @@
+#include "OneShotCache.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Flan {
+    static OneShotState save_state(const WavetableOscillator& osc) {
+        OneShotState state;
+        state.vol_env = osc.vol_env;
+        state.mod_env = osc.mod_env;
+        state.vib_lfo = osc.vib_lfo;
+        state.mod_lfo = osc.mod_lfo;
+        state.filter = osc.filter;
+        state.sample_position = osc.sample_position;
+        state.filter_countdown = osc.filter_countdown;
+        return state;
+    }
+
+    bool OneShotRender::record(const size_t max_frames) {
+        WavetableOscillator recorder = key;
+        while (frames.size() < max_frames) {
+            if (frames.size() % ONE_SHOT_SNAPSHOT_INTERVAL == 0) {
+                snapshots.push_back(save_state(recorder));
+            }
+            const BufferSample sample = recorder.get_sample(time_per_sample, sampling_mode);
+            if (static_cast<EnvStage>(recorder.vol_env.stage) == off) {
+                frames.shrink_to_fit();
+                snapshots.shrink_to_fit();
+                return true;
+            }
+            frames.push_back(sample);
+        }
+        return false;
+    }
+
+    WavetableOscillator OneShotRender::state_at(const size_t frame) const {
+        const OneShotState& snapshot = snapshots[std::min(frame / ONE_SHOT_SNAPSHOT_INTERVAL, snapshots.size() - 1)];
+        WavetableOscillator state = key;
+        state.vol_env = snapshot.vol_env;
+        state.mod_env = snapshot.mod_env;
+        state.vib_lfo = snapshot.vib_lfo;
+        state.mod_lfo = snapshot.mod_lfo;
+        state.filter = snapshot.filter;
+        state.sample_position = snapshot.sample_position;
+        state.filter_countdown = snapshot.filter_countdown;
+        for (size_t i = (frame / ONE_SHOT_SNAPSHOT_INTERVAL) * ONE_SHOT_SNAPSHOT_INTERVAL; i < frame; ++i) {
+            (void)state.get_sample(time_per_sample, sampling_mode);
+        }
+        return state;
+    }
+
+    size_t OneShotRender::bytes() const {
+        return sizeof(OneShotRender) + frames.capacity() * sizeof(BufferSample) + snapshots.capacity() * sizeof(OneShotState);
+    }
+
+    static uint64_t hash_bytes(uint64_t hash, const void* data, const size_t size) {
+        // FNV-1a
+        const auto* bytes = static_cast<const u8*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static uint64_t hash_key(const WavetableOscillator& osc, const int sampling_mode) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        hash = hash_bytes(hash, &osc.sample.data, sizeof(osc.sample.data));
+        hash = hash_bytes(hash, &osc.sample_delta, sizeof(osc.sample_delta));
+        hash = hash_bytes(hash, &osc.level_pitch_mul, sizeof(osc.level_pitch_mul));
+        hash = hash_bytes(hash, &osc.level_gain_l, sizeof(osc.level_gain_l));
+        hash = hash_bytes(hash, &osc.level_gain_r, sizeof(osc.level_gain_r));
+        hash = hash_bytes(hash, &sampling_mode, sizeof(sampling_mode));
+        return hash;
+    }
+
+    // Everything get_sample() reads. The zone has the envelope overrides and key scaling baked in, so changing those
+    // doesn't hit the old renders, they just age out
+    static bool same_key(const WavetableOscillator& a, const WavetableOscillator& b) {
+        return memcmp(&a.sample, &b.sample, sizeof(Sample)) == 0
+            && memcmp(&a.preset_zone, &b.preset_zone, sizeof(Zone)) == 0
+            && memcmp(&a.vol_env, &b.vol_env, sizeof(EnvState)) == 0
+            && memcmp(&a.mod_env, &b.mod_env, sizeof(EnvState)) == 0
+            && memcmp(&a.vib_lfo, &b.vib_lfo, sizeof(LfoState)) == 0
+            && memcmp(&a.mod_lfo, &b.mod_lfo, sizeof(LfoState)) == 0
+            && memcmp(&a.filter, &b.filter, sizeof(LowPassFilter)) == 0
+            && a.sample_position == b.sample_position
+            && a.sample_delta == b.sample_delta
+            && a.level_gain == b.level_gain
+            && a.level_gain_l == b.level_gain_l
+            && a.level_gain_r == b.level_gain_r
+            && a.level_pitch_mul == b.level_pitch_mul;
+    }
+
+    void OneShotCache::attach(WavetableOscillator& osc, const int sampling_mode, const double time_per_sample) {
+        // Looping zones play for as long as the note is held, only ones that end by themselves can be rendered ahead
+        const auto stage = static_cast<EnvStage>(osc.vol_env.stage);
+        if (osc.preset_zone.loop_enable || osc.one_shot != nullptr || stage == off || stage == release || osc.level_pitch_mul <= 0.0) {
+            return;
+        }
+
+        ++m_clock;
+        const uint64_t hash = hash_key(osc, sampling_mode);
+        for (const auto& render : m_renders) {
+            if (render->hash == hash && render->sampling_mode == sampling_mode && render->time_per_sample == time_per_sample
+                && same_key(render->key, osc)) {
+                render->last_used = m_clock;
+                ++render->n_users;
+                osc.one_shot = render.get();
+                osc.one_shot_position = 0;
+                osc.one_shot_env = osc.vol_env;
+                osc.one_shot_released = false;
+                return;
+            }
+        }
+
+        // Not rendered yet, so this one plays live, and the next ones can use the render once it's there
+        for (int i = 0; i < m_n_requests; ++i) {
+            const Request& request = m_requests[i];
+            if (request.hash == hash && request.sampling_mode == sampling_mode && request.time_per_sample == time_per_sample
+                && same_key(request.osc, osc)) {
+                return;
+            }
+        }
+        if (m_n_requests == ONE_SHOT_MAX_REQUESTS) {
+            return;
+        }
+        Request& request = m_requests[m_n_requests++];
+        request.osc = osc;
+        request.sampling_mode = sampling_mode;
+        request.time_per_sample = time_per_sample;
+        request.hash = hash;
+        m_pending.store(true, std::memory_order_relaxed);
+    }
+
+    std::vector<std::unique_ptr<OneShotRender>> OneShotCache::take_requests(uint64_t& generation) {
+        std::vector<std::unique_ptr<OneShotRender>> renders;
+        renders.reserve(m_n_requests);
+        for (int i = 0; i < m_n_requests; ++i) {
+            auto render = std::make_unique<OneShotRender>();
+            render->key = m_requests[i].osc;
+            render->sampling_mode = m_requests[i].sampling_mode;
+            render->time_per_sample = m_requests[i].time_per_sample;
+            render->hash = m_requests[i].hash;
+            renders.push_back(std::move(render));
+        }
+        m_n_requests = 0;
+        m_pending.store(false, std::memory_order_relaxed);
+        generation = m_generation;
+        return renders;
+    }
+
+    void OneShotCache::add(std::unique_ptr<OneShotRender> render, const uint64_t generation, std::vector<std::unique_ptr<OneShotRender>>& evicted) {
+        if (generation != m_generation) {
+            evicted.push_back(std::move(render));
+            return;
+        }
+
+        // Evict the renders nobody is playing, least recently used first, until this one fits in the budget
+        const size_t needed = render->bytes();
+        size_t used = bytes();
+        while (used + needed > ONE_SHOT_CACHE_BUDGET) {
+            auto oldest = m_renders.end();
+            for (auto it = m_renders.begin(); it != m_renders.end(); ++it) {
+                if ((*it)->n_users == 0 && (oldest == m_renders.end() || (*it)->last_used < (*oldest)->last_used)) {
+                    oldest = it;
+                }
+            }
+            // Everything that's left is playing
+            if (oldest == m_renders.end()) {
+                evicted.push_back(std::move(render));
+                return;
+            }
+            used -= (*oldest)->bytes();
+            evicted.push_back(std::move(*oldest));
+            m_renders.erase(oldest);
+        }
+        render->last_used = ++m_clock;
+        m_renders.push_back(std::move(render));
+    }
+
+    void OneShotCache::clear(const std::vector<Voice*>& voices) {
+        for (const auto* voice : voices) {
+            for (auto* osc : voice->wave_oscs) {
+                if (osc->one_shot != nullptr) {
+                    osc->leave_one_shot();
+                }
+            }
+        }
+        m_renders.clear();
+        m_n_requests = 0;
+        m_pending.store(false, std::memory_order_relaxed);
+        ++m_generation;
+    }
+
+    size_t OneShotCache::bytes() const {
+        size_t bytes = 0;
+        for (const auto& render : m_renders) {
+            bytes += render->bytes();
+        }
+        return bytes;
+    }
+}
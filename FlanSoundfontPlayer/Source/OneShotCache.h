@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "WavetableOscillator.h"
+
+// How much memory the cached one-shots of one instance can take up, the least recently used ones are evicted past this
+#define ONE_SHOT_CACHE_BUDGET (32 * 1024 * 1024)
+
+// How often the oscillator state is saved while a one-shot is rendered, so a voice can carry on live from any frame
+// by replaying at most this many frames
+#define ONE_SHOT_SNAPSHOT_INTERVAL 64
+
+// How many one-shots can wait to be rendered at once. Notes past that just play live
+#define ONE_SHOT_MAX_REQUESTS 16
+
+namespace Flan {
+    // What get_sample() moves forward, saved every ONE_SHOT_SNAPSHOT_INTERVAL frames of a render
+    struct OneShotState {
+        EnvState vol_env{};
+        EnvState mod_env{};
+        LfoState vib_lfo{};
+        LfoState mod_lfo{};
+        LowPassFilter filter{};
+        double sample_position = 0.0;
+        u16 filter_countdown = 0;
+    };
+
+    // A one-shot zone rendered from the start to the end of its sample, exactly like a live oscillator would render it
+    // while the note is held. It's rendered in the background, and hits with the same zone, pitch and levels copy the frames.
+    struct OneShotRender {
+        WavetableOscillator key;                    // The oscillator right before its first frame
+        std::vector<BufferSample> frames;
+        std::vector<OneShotState> snapshots;        // State right before frame i * ONE_SHOT_SNAPSHOT_INTERVAL
+        int sampling_mode = 0;
+        double time_per_sample = 0.0;
+        uint64_t hash = 0;
+        uint64_t last_used = 0;
+        std::atomic<int> n_users = 0;               // Oscillators playing this, it can't be evicted while they do
+
+        // Renders the whole one-shot. Returns false if it doesn't end within `max_frames`
+        bool record(size_t max_frames);
+
+        // State of the oscillator right before `frame` was rendered
+        [[nodiscard]] WavetableOscillator state_at(size_t frame) const;
+
+        [[nodiscard]] size_t bytes() const;
+    };
+
+    // Per instance cache of one-shot renders. The render thread only looks renders up and queues the missing ones, with the
+    // synth locked and without allocating. Another thread renders them and adds them, see Synth::render_one_shots()
+    class OneShotCache {
+    public:
+        // Makes the oscillator play from the cache if it's a one-shot that's been rendered, and asks for a render if it
+        // hasn't been yet. Has to be called before its first frame, after its levels are set
+        void attach(WavetableOscillator& osc, int sampling_mode, double time_per_sample);
+
+        // Whether attach() asked for renders that nobody took yet. Safe to call from any thread
+        [[nodiscard]] bool pending() const { return m_pending.load(std::memory_order_relaxed); }
+
+        // Takes the queued requests, as renders that only have their key filled in. `generation` is what add() wants back
+        std::vector<std::unique_ptr<OneShotRender>> take_requests(uint64_t& generation);
+
+        // Adds a finished render, evicting the least recently used ones nobody is playing to make room. Those are moved
+        // into `evicted`, so they can be freed after the synth is unlocked. Renders from before a clear() are dropped
+        void add(std::unique_ptr<OneShotRender> render, uint64_t generation, std::vector<std::unique_ptr<OneShotRender>>& evicted);
+
+        // Throws away every render and request. Oscillators still playing one carry on live
+        void clear(const std::vector<Voice*>& voices);
+
+        [[nodiscard]] size_t bytes() const;
+        [[nodiscard]] size_t size() const { return m_renders.size(); }
+
+    private:
+        struct Request {
+            WavetableOscillator osc;
+            int sampling_mode = 0;
+            double time_per_sample = 0.0;
+            uint64_t hash = 0;
+        };
+
+        std::vector<std::unique_ptr<OneShotRender>> m_renders;
+        Request m_requests[ONE_SHOT_MAX_REQUESTS];
+        int m_n_requests = 0;
+        std::atomic<bool> m_pending = false;
+        uint64_t m_generation = 0;      // Counts clear() calls
+        uint64_t m_clock = 0;
+    };
+}
@@ -0,0 +1,87 @@
+#include "OutputRouting.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace Flan {
+    int OutputRouting::output_for(const u8 key, const size_t zone_index) const {
+        for (u8 i = 0; i < n_routes; ++i) {
+            const OutputRoute& route = routes[i];
+            const size_t value = (route.source == RouteSource::key) ? key : zone_index;
+            if (value >= route.low && value <= route.high) {
+                return route.output;
+            }
+        }
+        return 0;
+    }
+
+    int OutputRouting::n_outputs() const {
+        int n = 1;
+        for (u8 i = 0; i < n_routes; ++i) {
+            n = std::max(n, routes[i].output + 1);
+        }
+        return n;
+    }
+
+    bool OutputRouting::add(const OutputRoute& route) {
+        if (n_routes >= MAX_OUTPUT_ROUTES || route.output >= MAX_OUTPUTS) {
+            return false;
+        }
+        routes[n_routes++] = route;
+        return true;
+    }
+
+    OutputRouting make_output_routing(const RoutingPreset preset) {
+        OutputRouting routing;
+        routing.preset = preset;
+        switch (preset) {
+        case RoutingPreset::drum_groups:
+            // The hi-hats sit in between the toms, and the crash in between the high toms, so those go first
+            routing.add({ RouteSource::key, 35, 36, 1 });   // Kicks
+            routing.add({ RouteSource::key, 37, 40, 2 });   // Snares, side stick and clap
+            routing.add({ RouteSource::key, 42, 42, 3 });   // Hi-hats
+            routing.add({ RouteSource::key, 44, 44, 3 });
+            routing.add({ RouteSource::key, 46, 46, 3 });
+            routing.add({ RouteSource::key, 49, 49, 5 });   // Cymbals
+            routing.add({ RouteSource::key, 41, 50, 4 });   // Toms
+            routing.add({ RouteSource::key, 51, 59, 5 });
+            routing.add({ RouteSource::key, 60, 81, 6 });   // Percussion
+            break;
+        case RoutingPreset::per_zone:
+            for (u8 zone = 0; zone < MAX_OUTPUTS - 1; ++zone) {
+                routing.add({ RouteSource::zone, zone, zone, static_cast<u8>(zone + 1) });
+            }
+            break;
+        case RoutingPreset::main_only:
+        case RoutingPreset::custom:
+            break;
+        }
+        return routing;
+    }
+
+    bool parse_output_route(const std::string& text, OutputRoute& route) {
+        char source[8]{};
+        int low = 0;
+        int high = 0;
+        int output = 0;
+        if (sscanf(text.c_str(), "%7[a-z]:%i-%i=%i", source, &low, &high, &output) != 4) {
+            return false;
+        }
+        if (low < 0 || high > 255 || low > high || output < 0 || output >= MAX_OUTPUTS) {
+            return false;
+        }
+        const std::string source_name = source;
+        if (source_name == "key") {
+            route.source = RouteSource::key;
+        }
+        else if (source_name == "zone") {
+            route.source = RouteSource::zone;
+        }
+        else {
+            return false;
+        }
+        route.low = static_cast<u8>(low);
+        route.high = static_cast<u8>(high);
+        route.output = static_cast<u8>(output);
+        return true;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+#include "../../SoundfontStudies/SoundfontStudies/structs.h"
+
+// How many outputs zones can be routed to, the main output included
+#define MAX_OUTPUTS 16
+#define MAX_OUTPUT_ROUTES 32
+
+namespace Flan {
+    enum class RouteSource : u8 {
+        key,    // The key that was played
+        zone,   // Index of the zone within the preset
+    };
+
+    // Sends the zones that match to one of the plugin's outputs. Output 0 is the main output, the rest are FL's extra
+    // outputs, which it mixes into the mixer tracks after the one the channel is routed to
+    struct OutputRoute {
+        RouteSource source = RouteSource::key;
+        u8 low = 0;
+        u8 high = 127;
+        u8 output = 0;
+    };
+
+    enum class RoutingPreset : u8 {
+        main_only,      // Everything goes to the main output
+        drum_groups,    // General MIDI drum kit: kick, snare, hats, toms, cymbals and percussion each get an output
+        per_zone,       // Every zone of the preset gets its own output, for drum kits that don't follow General MIDI
+        custom,         // Routes added by hand
+    };
+
+    // Routing table from keys or zones to outputs. It's a fixed size plain struct so it can go into the saved state as is,
+    // and the audio thread can read it without locking
+    struct OutputRouting {
+        OutputRoute routes[MAX_OUTPUT_ROUTES]{};
+        u8 n_routes = 0;
+        RoutingPreset preset = RoutingPreset::main_only;
+
+        // First route that matches wins, zones that no route matches go to the main output
+        [[nodiscard]] int output_for(u8 key, size_t zone_index) const;
+
+        // How many outputs the routes use, the main output included
+        [[nodiscard]] int n_outputs() const;
+
+        // Returns false if the table is full
+        bool add(const OutputRoute& route);
+    };
+
+    // Two routing tables, the editor fills in the one the audio thread isn't reading and then swaps them. The audio thread
+    // only looks at it for a moment at a time, when a note starts or a block does
+    class SharedOutputRouting {
+    public:
+        [[nodiscard]] const OutputRouting& get() const { return m_tables[m_current.load(std::memory_order_acquire)]; }
+
+        void set(const OutputRouting& routing) {
+            const int next = 1 - m_current.load(std::memory_order_relaxed);
+            m_tables[next] = routing;
+            m_current.store(next, std::memory_order_release);
+        }
+
+    private:
+        OutputRouting m_tables[2]{};
+        std::atomic<int> m_current = 0;
+    };
+
+    [[nodiscard]] OutputRouting make_output_routing(RoutingPreset preset);
+
+    // Parses a route like "key:36-36=1" or "zone:0-3=2"
+    bool parse_output_route(const std::string& text, OutputRoute& route);
+}
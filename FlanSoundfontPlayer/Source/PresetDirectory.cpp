@@ -0,0 +1,46 @@
+#include "PresetDirectory.h"
+#include <algorithm>
+
+namespace Flan {
+    void PresetDirectory::build(std::map<u16, Preset>& presets) {
+        clear();
+
+        // Size everything up front, so it's one allocation per array
+        size_t n_zones = 0;
+        for (const auto& [key, preset] : presets) {
+            n_zones += preset.zones.size();
+        }
+        m_entries.reserve(std::min<size_t>(presets.size(), NO_PRESET));
+        m_zones.reserve(n_zones);
+
+        // The map is already in key order, which the entries keep
+        for (auto& [key, preset] : presets) {
+            if (m_entries.size() == NO_PRESET) {
+                break;
+            }
+            PresetEntry entry;
+            entry.name = std::move(preset.name);
+            entry.key = key;
+            entry.first_zone = static_cast<u32>(m_zones.size());
+            entry.n_zones = static_cast<u32>(preset.zones.size());
+            m_zones.insert(m_zones.end(), preset.zones.begin(), preset.zones.end());
+            m_slots[key] = static_cast<u16>(m_entries.size());
+            m_entries.push_back(std::move(entry));
+        }
+        presets.clear();
+    }
+
+    void PresetDirectory::clear() {
+        std::fill(m_slots.begin(), m_slots.end(), static_cast<u16>(NO_PRESET));
+        m_entries.clear();
+        m_zones.clear();
+    }
+
+    size_t PresetDirectory::bytes() const {
+        size_t bytes = m_slots.capacity() * sizeof(u16) + m_entries.capacity() * sizeof(PresetEntry) + m_zones.capacity() * sizeof(Zone);
+        for (const PresetEntry& entry : m_entries) {
+            bytes += entry.name.capacity();
+        }
+        return bytes;
+    }
+}
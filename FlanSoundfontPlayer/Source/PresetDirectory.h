@@ -0,0 +1,62 @@
+#pragma once
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "../../SoundfontStudies/SoundfontStudies/structs.h"
+
+// One slot per bank and program combination, (bank << 8) | program
+#define PRESET_DIRECTORY_KEYS 65536
+
+// Slot value for keys without a preset. A soundfont would need a preset at every single key for one to clash with it
+#define NO_PRESET 0xFFFF
+
+namespace Flan {
+    // A preset in the directory. Its zones are the directory's zones from `first_zone` on
+    struct PresetEntry {
+        std::string name;
+        u16 key = 0;
+        u32 first_zone = 0;
+        u32 n_zones = 0;
+    };
+
+    // Every preset of the loaded soundfont, in bank and program order, with all of their zones in one array. Looking a
+    // preset up is a single index into a table with a slot for every key, so the note and name paths never walk a tree
+    // or allocate, and the position of a preset in this order is also its row in the editor's dropdown menu.
+    class PresetDirectory {
+    public:
+        PresetDirectory() : m_slots(PRESET_DIRECTORY_KEYS, NO_PRESET) {}
+
+        // Takes the presets out of the soundfont's map, leaving it empty, and replaces what was here
+        void build(std::map<u16, Preset>& presets);
+        void clear();
+
+        // nullptr if there's no preset at this key
+        [[nodiscard]] const PresetEntry* find(const u16 key) const {
+            const u16 slot = m_slots[key];
+            return (slot == NO_PRESET) ? nullptr : &m_entries[slot];
+        }
+        [[nodiscard]] bool contains(const u16 key) const { return m_slots[key] != NO_PRESET; }
+
+        // Where the preset is in bank and program order, -1 if there's none at this key
+        [[nodiscard]] int index_of(const u16 key) const { return (m_slots[key] == NO_PRESET) ? -1 : m_slots[key]; }
+
+        [[nodiscard]] std::span<const Zone> zones(const PresetEntry& entry) const { return { m_zones.data() + entry.first_zone, entry.n_zones }; }
+
+        [[nodiscard]] const PresetEntry& operator[](const size_t index) const { return m_entries[index]; }
+        [[nodiscard]] size_t size() const { return m_entries.size(); }
+        [[nodiscard]] bool empty() const { return m_entries.empty(); }
+        [[nodiscard]] size_t n_zones() const { return m_zones.size(); }
+        [[nodiscard]] std::vector<PresetEntry>::const_iterator begin() const { return m_entries.begin(); }
+        [[nodiscard]] std::vector<PresetEntry>::const_iterator end() const { return m_entries.end(); }
+
+        // The slot table, the entries with their names, and the zones
+        [[nodiscard]] size_t bytes() const;
+
+    private:
+        std::vector<u16> m_slots;
+        std::vector<PresetEntry> m_entries;
+        std::vector<Zone> m_zones;
+    };
+}
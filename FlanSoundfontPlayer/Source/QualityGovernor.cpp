@@ -0,0 +1,73 @@
+#include "QualityGovernor.h"
+#include "SincTable.h"
+#include <algorithm>
+#include <cwchar>
+
+namespace Flan {
+    void QualityGovernor::end_block(const double percent) {
+        const double load = percent / (budget * 100.0);
+        m_last_load.store(load, std::memory_order_relaxed);
+        const int level = m_level.load(std::memory_order_relaxed);
+
+        // Step down right away, a spike has to be dealt with in the next block already
+        if (load > GOVERNOR_DEGRADE_LOAD) {
+            m_calm_blocks = 0;
+            if (level < GOVERNOR_MAX_LEVEL) {
+                m_level.store(level + 1, std::memory_order_relaxed);
+                m_n_degradations.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        // But only step back up once there's been plenty of headroom for a while, so it doesn't flip back and forth
+        if (load >= GOVERNOR_RESTORE_LOAD) {
+            m_calm_blocks = 0;
+            return;
+        }
+        if (level > 0 && ++m_calm_blocks >= GOVERNOR_RESTORE_BLOCKS) {
+            m_calm_blocks = 0;
+            m_level.store(level - 1, std::memory_order_relaxed);
+            m_n_restores.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void QualityGovernor::reset() {
+        m_level.store(0, std::memory_order_relaxed);
+        m_calm_blocks = 0;
+    }
+
+    int QualityGovernor::steps(const bool background) const {
+        const int level = m_level.load(std::memory_order_relaxed);
+        if (background) {
+            return level;
+        }
+        return std::max(level - GOVERNOR_FOREGROUND_LEVEL + 1, 0);
+    }
+
+    int QualityGovernor::degrade(int sampling_mode, const int steps) {
+        for (int i = 0; i < steps && sampling_mode > 0; ++i) {
+            // Sinc costs several times what gaussian does, so it goes there directly
+            sampling_mode = (sampling_mode >= SAMPLING_MODE_SINC_8) ? 2 : sampling_mode - 1;
+        }
+        return sampling_mode;
+    }
+
+    QualityGovernorStats QualityGovernor::stats() const {
+        QualityGovernorStats stats;
+        stats.level = m_level.load(std::memory_order_relaxed);
+        stats.n_degradations = m_n_degradations.load(std::memory_order_relaxed);
+        stats.n_restores = m_n_restores.load(std::memory_order_relaxed);
+        stats.n_degraded_voices = m_n_degraded_voices.load(std::memory_order_relaxed);
+        stats.last_load = m_last_load.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    std::wstring QualityGovernor::report() const {
+        const QualityGovernorStats s = stats();
+        wchar_t buffer[160];
+        swprintf(buffer, std::size(buffer), L"Quality level %i/%i, %llu step downs, %llu step ups, %llu degraded voice blocks",
+            s.level, GOVERNOR_MAX_LEVEL, static_cast<unsigned long long>(s.n_degradations),
+            static_cast<unsigned long long>(s.n_restores), static_cast<unsigned long long>(s.n_degraded_voices));
+        return buffer;
+    }
+}
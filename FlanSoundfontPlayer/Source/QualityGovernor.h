@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// A block that takes more than this fraction of its real-time budget steps the quality down by one level
+#define GOVERNOR_DEGRADE_LOAD 0.75
+
+// Blocks have to stay under this fraction of the budget for GOVERNOR_RESTORE_BLOCKS in a row before it steps back up
+#define GOVERNOR_RESTORE_LOAD 0.40
+#define GOVERNOR_RESTORE_BLOCKS 64
+
+// Level 1 and up degrade released and quiet voices by that many steps. From GOVERNOR_FOREGROUND_LEVEL on, the other
+// voices get degraded too, one step at that level and one more for every level past it
+#define GOVERNOR_MAX_LEVEL 4
+#define GOVERNOR_FOREGROUND_LEVEL 3
+
+// Held notes quieter than this count as background, in dB
+#define GOVERNOR_QUIET_DB -24.0
+
+// Degraded oscillators only recompute their filter cutoff once every this many samples
+#define GOVERNOR_FILTER_INTERVAL 16
+
+namespace Flan {
+    struct QualityGovernorStats {
+        int level = 0;                  // 0 is full quality
+        uint64_t n_degradations = 0;    // Times it stepped down a level
+        uint64_t n_restores = 0;        // Times it stepped back up
+        uint64_t n_degraded_voices = 0; // Voices rendered below the selected quality, summed over every block
+        double last_load = 0.0;         // Cost of the last block, as a fraction of the budget
+    };
+
+    // Watches what every block costs, and when rendering gets close to the real-time budget, tells the synth to render
+    // the voices nobody will miss much with cheaper interpolation and filter modulation, before it drops out. The audio
+    // thread feeds it, and any other thread can read the stats.
+    class QualityGovernor {
+    public:
+        // Called after every block with what it cost, in percent of the real-time budget, like RenderProfiler measures it
+        void end_block(double percent);
+
+        // Back to full quality, without counting it as a restore. For when nothing's being governed
+        void reset();
+
+        // How many steps below the selected sampling mode a voice should be rendered. `background` is for released
+        // and quiet voices, which are degraded first
+        [[nodiscard]] int steps(bool background) const;
+
+        // `sampling_mode` taken down by `steps`: sinc to gaussian, then linear, then point
+        [[nodiscard]] static int degrade(int sampling_mode, int steps);
+
+        void count_degraded_voices(size_t n_voices) { m_n_degraded_voices.fetch_add(n_voices, std::memory_order_relaxed); }
+
+        [[nodiscard]] int level() const { return m_level.load(std::memory_order_relaxed); }
+        [[nodiscard]] QualityGovernorStats stats() const;
+
+        // One line for the editor and for headless builds
+        [[nodiscard]] std::wstring report() const;
+
+        // Fraction of the real-time budget blocks should fit in. Lower it to leave room for the rest of the project,
+        // or to try the governor out in an offline render
+        double budget = 1.0;
+
+    private:
+        std::atomic<int> m_level = 0;
+        int m_calm_blocks = 0;
+        std::atomic<uint64_t> m_n_degradations = 0;
+        std::atomic<uint64_t> m_n_restores = 0;
+        std::atomic<uint64_t> m_n_degraded_voices = 0;
+        std::atomic<double> m_last_load = 0.0;
+    };
+}
@@ -0,0 +1,120 @@
+#include "RenderProfiler.h"
+#include <algorithm>
+#include <bit>
+#include <cwchar>
+
+namespace Flan {
+    void RenderProfiler::begin_block() {
+        m_block_start = std::chrono::steady_clock::now();
+    }
+
+    double RenderProfiler::end_block(const int n_samples, const double sample_rate, const size_t n_voices) {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_block_start;
+        if (n_samples <= 0 || sample_rate <= 0.0) {
+            return 0.0;
+        }
+
+        // Express the cost as a percentage of how long this block lasts in real-time
+        const double budget = static_cast<double>(n_samples) / sample_rate;
+        const double percent = elapsed.count() / budget * 100.0;
+
+        // Swap the oldest block in the history out of the histogram for this one
+        const int bin = std::clamp(static_cast<int>(percent * PROFILER_BINS_PER_PERCENT), 0, PROFILER_N_BINS - 1);
+        const uint64_t n_blocks = m_n_blocks.fetch_add(1, std::memory_order_relaxed);
+        if (n_blocks >= PROFILER_WINDOW_BLOCKS) {
+            m_histogram[m_history[m_history_cursor]].fetch_sub(1, std::memory_order_relaxed);
+        }
+        m_histogram[bin].fetch_add(1, std::memory_order_relaxed);
+        m_history[m_history_cursor] = static_cast<uint16_t>(bin);
+        m_history_cursor = (m_history_cursor + 1) % PROFILER_WINDOW_BLOCKS;
+
+        // Keep track of overruns and the worst block ever
+        if (percent > 100.0) {
+            m_n_overruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (percent > m_peak.load(std::memory_order_relaxed)) {
+            m_peak.store(percent, std::memory_order_relaxed);
+        }
+
+        // Add it to the cost curve for this voice count
+        const int bucket = std::min(static_cast<int>(std::bit_width(n_voices)), PROFILER_N_VOICE_BUCKETS - 1);
+        m_voice_cost_sum[bucket].fetch_add(percent, std::memory_order_relaxed);
+        m_voice_cost_blocks[bucket].fetch_add(1, std::memory_order_relaxed);
+        return percent;
+    }
+
+    RenderProfileStats RenderProfiler::stats() const {
+        RenderProfileStats stats;
+        stats.n_blocks = m_n_blocks.load(std::memory_order_relaxed);
+        stats.n_overruns = m_n_overruns.load(std::memory_order_relaxed);
+        stats.p50 = percentile(0.50);
+        stats.p99 = percentile(0.99);
+        stats.max = percentile(1.00);
+        stats.peak = m_peak.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    VoiceCostBucket RenderProfiler::voice_cost(const int bucket) const {
+        VoiceCostBucket result;
+        result.min_voices = bucket == 0 ? 0 : 1 << (bucket - 1);
+        result.max_voices = bucket == PROFILER_N_VOICE_BUCKETS - 1 ? -1 : std::max(0, (1 << bucket) - 1);
+        result.n_blocks = m_voice_cost_blocks[bucket].load(std::memory_order_relaxed);
+        if (result.n_blocks > 0) {
+            result.average = m_voice_cost_sum[bucket].load(std::memory_order_relaxed) / static_cast<double>(result.n_blocks);
+        }
+        return result;
+    }
+
+    double RenderProfiler::percentile(const double fraction) const {
+        // Copy the histogram first, the audio thread might be updating it while we're reading
+        uint32_t histogram[PROFILER_N_BINS];
+        uint64_t total = 0;
+        for (int i = 0; i < PROFILER_N_BINS; ++i) {
+            histogram[i] = m_histogram[i].load(std::memory_order_relaxed);
+            total += histogram[i];
+        }
+        if (total == 0) {
+            return 0.0;
+        }
+
+        // Walk up the bins until we've seen enough blocks, and report the upper edge of that bin
+        const uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * static_cast<double>(total) + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < PROFILER_N_BINS; ++i) {
+            seen += histogram[i];
+            if (seen >= target) {
+                return static_cast<double>(i + 1) / PROFILER_BINS_PER_PERCENT;
+            }
+        }
+        return PROFILER_MAX_PERCENT;
+    }
+
+    std::wstring RenderProfiler::report() const {
+        const RenderProfileStats s = stats();
+        wchar_t buffer[256];
+        swprintf(buffer, std::size(buffer), L"CPU p50 %.1f%%, p99 %.1f%%, max %.1f%% (peak %.1f%%), %llu overruns in %llu blocks\n",
+            s.p50, s.p99, s.max, s.peak,
+            static_cast<unsigned long long>(s.n_overruns), static_cast<unsigned long long>(s.n_blocks));
+        std::wstring result = buffer;
+
+        // Cost curve, only for the voice counts we've actually seen
+        result += L"Per voice count:";
+        for (int i = 0; i < PROFILER_N_VOICE_BUCKETS; ++i) {
+            const VoiceCostBucket bucket = voice_cost(i);
+            if (bucket.n_blocks == 0) {
+                continue;
+            }
+            if (bucket.max_voices < 0) {
+                swprintf(buffer, std::size(buffer), L" %i+: %.1f%%", bucket.min_voices, bucket.average);
+            }
+            else if (bucket.min_voices == bucket.max_voices) {
+                swprintf(buffer, std::size(buffer), L" %i: %.1f%%", bucket.min_voices, bucket.average);
+            }
+            else {
+                swprintf(buffer, std::size(buffer), L" %i-%i: %.1f%%", bucket.min_voices, bucket.max_voices, bucket.average);
+            }
+            result += buffer;
+        }
+        return result;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Block cost histogram resolution, in bins per percent of the real-time budget. Anything over the last bin gets clamped into it
+#define PROFILER_BINS_PER_PERCENT 2
+#define PROFILER_MAX_PERCENT 200
+#define PROFILER_N_BINS (PROFILER_MAX_PERCENT * PROFILER_BINS_PER_PERCENT + 1)
+
+// How many of the most recent blocks the percentiles are taken over
+#define PROFILER_WINDOW_BLOCKS 4096
+
+// Voice counts are grouped per power of two: 0, 1, 2-3, 4-7, ... 128+
+#define PROFILER_N_VOICE_BUCKETS 9
+
+namespace Flan {
+    struct RenderProfileStats {
+        uint64_t n_blocks = 0;      // Total blocks measured
+        uint64_t n_overruns = 0;    // Blocks that took longer than they last in real-time
+        double p50 = 0.0;           // Percentiles of the recent blocks, in percent of the real-time budget
+        double p99 = 0.0;
+        double max = 0.0;           // Most expensive recent block
+        double peak = 0.0;          // Most expensive block ever
+    };
+
+    struct VoiceCostBucket {
+        int min_voices = 0;
+        int max_voices = 0;         // -1 if there's no upper limit
+        uint64_t n_blocks = 0;
+        double average = 0.0;       // Average block cost, in percent of the real-time budget
+    };
+
+    // Measures how much of the real-time budget every rendered block uses. The audio thread calls begin_block() and
+    // end_block(), which only touch atomics and a fixed-size history, and any other thread can read the results at any time.
+    class RenderProfiler {
+    public:
+        void begin_block();
+
+        // Returns what the block cost, in percent of the real-time budget
+        double end_block(int n_samples, double sample_rate, size_t n_voices);
+
+        [[nodiscard]] RenderProfileStats stats() const;
+        [[nodiscard]] VoiceCostBucket voice_cost(int bucket) const;
+
+        // Human readable summary, for the editor and for headless builds
+        [[nodiscard]] std::wstring report() const;
+
+    private:
+        [[nodiscard]] double percentile(double fraction) const;
+
+        std::chrono::steady_clock::time_point m_block_start;
+
+        // Rolling histogram over the last PROFILER_WINDOW_BLOCKS blocks. The history is only touched by the audio thread
+        std::atomic<uint32_t> m_histogram[PROFILER_N_BINS]{};
+        uint16_t m_history[PROFILER_WINDOW_BLOCKS]{};
+        size_t m_history_cursor = 0;
+
+        std::atomic<uint64_t> m_n_blocks = 0;
+        std::atomic<uint64_t> m_n_overruns = 0;
+        std::atomic<double> m_peak = 0.0;
+
+        // Cost per voice count, summed so it can be averaged when it's read
+        std::atomic<double> m_voice_cost_sum[PROFILER_N_VOICE_BUCKETS]{};
+        std::atomic<uint64_t> m_voice_cost_blocks[PROFILER_N_VOICE_BUCKETS]{};
+    };
+}
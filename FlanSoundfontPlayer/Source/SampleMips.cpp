@@ -0,0 +1,75 @@
+#include "SampleMips.h"
+#include <algorithm>
+#include <cmath>
+#include "FilterDesign.h"
+
+namespace Flan {
+    static const std::vector<double>& mip_taps() {
+        static const std::vector<double> taps = half_band_taps(SAMPLE_MIP_TAPS);
+        return taps;
+    }
+
+    static void decimate(const i16* source, const u32 length, const u32 loop_start, const u32 loop_end, std::vector<i16>& dest) {
+        const std::vector<double>& taps = mip_taps();
+        constexpr int half = SAMPLE_MIP_TAPS / 2;
+        const bool looped = loop_end > loop_start && loop_end <= length;
+        dest.resize((length + 1) / 2);
+        for (u32 i = 0; i < dest.size(); ++i) {
+            double sum = 0.0;
+            for (int tap = 0; tap < SAMPLE_MIP_TAPS; ++tap) {
+                int64_t index = static_cast<int64_t>(i) * 2 + tap - half;
+                if (looped && index > loop_end) {
+                    index = loop_start + (index - loop_start) % (loop_end - loop_start);
+                }
+                if (index < 0 || index >= length) {
+                    continue;
+                }
+                sum += taps[tap] * source[index];
+            }
+            dest[i] = static_cast<i16>(std::clamp(lround(sum), -32768l, 32767l));
+        }
+    }
+
+    size_t SampleMips::bytes() const {
+        size_t bytes = 0;
+        for (const auto& level : levels) {
+            bytes += level.capacity() * sizeof(i16);
+        }
+        return bytes;
+    }
+
+    void build_sample_mips(const i16* data, u32 length, u32 loop_start, u32 loop_end, SampleMips& mips) {
+        for (auto& level : mips.levels) {
+            decimate(data, length, loop_start, loop_end, level);
+            data = level.data();
+            length = static_cast<u32>(level.size());
+            loop_start /= 2;
+            loop_end /= 2;
+        }
+    }
+
+    void SampleMipTable::build(const std::vector<Sample>& samples) {
+        m_mips.clear();
+        for (const Sample& sample : samples) {
+            for (const i16* data : { sample.data, sample.linked }) {
+                if (data == nullptr || sample.length == 0 || m_mips.contains(data)) {
+                    continue;
+                }
+                build_sample_mips(data, sample.length, sample.loop_start, sample.loop_end, m_mips[data]);
+            }
+        }
+    }
+
+    const SampleMips* SampleMipTable::find(const i16* data) const {
+        const auto entry = m_mips.find(data);
+        return (entry == m_mips.end()) ? nullptr : &entry->second;
+    }
+
+    size_t SampleMipTable::bytes() const {
+        size_t bytes = 0;
+        for (const auto& [data, mips] : m_mips) {
+            bytes += sizeof(std::pair<const i16* const, SampleMips>) + 2 * sizeof(void*) + mips.bytes();
+        }
+        return bytes;
+    }
+}
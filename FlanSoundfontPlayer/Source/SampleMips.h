@@ -0,0 +1,42 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+
+#include "../../SoundfontStudies/SoundfontStudies/structs.h"
+
+// How many lower rate copies every sample gets: half rate, quarter rate
+#define SAMPLE_MIP_LEVELS 2
+
+// Taps of the half-band filter used to make each level from the one above it, odd
+#define SAMPLE_MIP_TAPS 31
+
+namespace Flan {
+    // One channel of a sample, low-pass filtered and decimated by 2 for every level. An oscillator pitched up by an
+    // octave or more reads from these instead, so it steps through memory at less than 2 frames per output frame and
+    // doesn't alias the content above its new Nyquist frequency
+    struct SampleMips {
+        std::vector<i16> levels[SAMPLE_MIP_LEVELS];   // levels[0] is half rate, frame i lines up with frame 2i of the sample
+
+        [[nodiscard]] size_t bytes() const;
+    };
+
+    // Mips of every distinct block of sample data in a soundfont, stereo halves included
+    class SampleMipTable {
+    public:
+        // Builds them for the samples, replacing what was there
+        void build(const std::vector<Sample>& samples);
+        void clear() { m_mips.clear(); }
+
+        // nullptr if there are none for this data
+        [[nodiscard]] const SampleMips* find(const i16* data) const;
+
+        [[nodiscard]] size_t bytes() const;
+
+    private:
+        std::unordered_map<const i16*, SampleMips> m_mips;
+    };
+
+    // Filters and decimates one channel. `loop_start` and `loop_end` make the filter wrap around the loop, so looped
+    // samples stay seamless in the lower levels too. Pass loop_end <= loop_start for samples that don't loop
+    void build_sample_mips(const i16* data, u32 length, u32 loop_start, u32 loop_end, SampleMips& mips);
+}
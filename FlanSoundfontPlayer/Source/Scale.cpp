@@ -1,6 +1,9 @@
 #include "Scale.h"
 #include <vector>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 
 bool Flan::Scale::is_current_scale_default() const {
     for (int note = 0; note <= 127; ++note) {
@@ -52,10 +55,10 @@ bool Flan::Scale::from_file(const std::string& path) {
         std::string filtered_line = line;
 
         auto s_end = filtered_line.end();
-        s_end = remove(filtered_line.begin(), s_end, ' ');
-        s_end = remove(filtered_line.begin(), s_end, '\t');
-        s_end = remove(filtered_line.begin(), s_end, '\r');
-        s_end = remove(filtered_line.begin(), s_end, '\n');
+        s_end = std::remove(filtered_line.begin(), s_end, ' ');
+        s_end = std::remove(filtered_line.begin(), s_end, '\t');
+        s_end = std::remove(filtered_line.begin(), s_end, '\r');
+        s_end = std::remove(filtered_line.begin(), s_end, '\n');
 
         filtered_line.resize(s_end - filtered_line.begin());
 
@@ -71,7 +74,7 @@ bool Flan::Scale::from_file(const std::string& path) {
 
         // Store description
         if (line_number == 0) {
-            strcpy_s(m_description, line.c_str());
+            snprintf(m_description, sizeof(m_description), "%s", line.c_str());
             line_number++;
             continue;
         }
@@ -166,5 +169,5 @@ void Flan::Scale::init_default() {
     m_is_default = true;
 
     // Set the description
-    strcpy_s(m_description, "12-tone equal temperament");
+    snprintf(m_description, sizeof(m_description), "%s", "12-tone equal temperament");
 }
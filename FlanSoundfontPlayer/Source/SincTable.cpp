@@ -0,0 +1,94 @@
+#include "SincTable.h"
+#include <cmath>
+#include "FilterDesign.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLAN_SINC_SSE2 1
+#endif
+
+namespace Flan {
+    static SincTable make_sinc_table(const int taps, const double beta) {
+        const double half = taps / 2.0;
+        SincTable table;
+        table.taps = taps;
+        table.coefficients.resize(static_cast<size_t>(SINC_PHASES + 1) * taps);
+        for (int phase = 0; phase <= SINC_PHASES; ++phase) {
+            const double fraction = static_cast<double>(phase) / SINC_PHASES;
+            float* row = table.coefficients.data() + static_cast<size_t>(phase) * taps;
+            double sum = 0.0;
+            for (int tap = 0; tap < taps; ++tap) {
+                // Distance from the position to this tap's frame
+                const double x = fraction + half - 1.0 - tap;
+                row[tap] = static_cast<float>(sinc(x) * kaiser_window(x / half, beta));
+                sum += row[tap];
+            }
+            for (int tap = 0; tap < taps; ++tap) {
+                row[tap] = static_cast<float>(row[tap] / sum);
+            }
+        }
+        return table;
+    }
+
+    const SincTable* sinc_table_for_mode(const int sampling_mode) {
+        // Wider windows get a steeper Kaiser window, so the extra taps go to stopband rejection
+        static const SincTable tables[3] = {
+            make_sinc_table(8, 5.0),
+            make_sinc_table(16, 7.0),
+            make_sinc_table(32, 9.0),
+        };
+        if (sampling_mode < SAMPLING_MODE_SINC_8 || sampling_mode > SAMPLING_MODE_SINC_32) {
+            return nullptr;
+        }
+        return &tables[sampling_mode - SAMPLING_MODE_SINC_8];
+    }
+
+    void init_sinc_tables() {
+        (void)sinc_table_for_mode(SAMPLING_MODE_SINC_8);
+    }
+
+#ifdef FLAN_SINC_SSE2
+    static float horizontal_sum(__m128 sum) {
+        __m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+        sum = _mm_add_ps(sum, shuffled);
+        shuffled = _mm_movehl_ps(shuffled, sum);
+        sum = _mm_add_ss(sum, shuffled);
+        return _mm_cvtss_f32(sum);
+    }
+#endif
+
+    float sinc_dot(const i16* samples, const float* coefficients, const int n) {
+#ifdef FLAN_SINC_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < n; i += 4) {
+            // Sign extend 4 samples to 32 bits by putting them in the top half and shifting them back down
+            const __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples + i));
+            const __m128i widened = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(widened), _mm_loadu_ps(coefficients + i)));
+        }
+        return horizontal_sum(sum);
+#else
+        float sum = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            sum += static_cast<float>(samples[i]) * coefficients[i];
+        }
+        return sum;
+#endif
+    }
+
+    float sinc_dot(const float* samples, const float* coefficients, const int n) {
+#ifdef FLAN_SINC_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < n; i += 4) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(coefficients + i)));
+        }
+        return horizontal_sum(sum);
+#else
+        float sum = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            sum += samples[i] * coefficients[i];
+        }
+        return sum;
+#endif
+    }
+}
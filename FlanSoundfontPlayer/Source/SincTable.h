@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+
+#include "../../SoundfontStudies/SoundfontStudies/structs.h"
+
+// Sampling modes past point, linear and gaussian: windowed sinc with 8, 16 or 32 taps
+#define SAMPLING_MODE_SINC_8 3
+#define SAMPLING_MODE_SINC_16 4
+#define SAMPLING_MODE_SINC_32 5
+#define N_SAMPLING_MODES 6
+
+// Fractional positions the coefficients are computed for, the ones in between are interpolated
+#define SINC_PHASES 256
+#define SINC_MAX_TAPS 32
+
+namespace Flan {
+    // Polyphase coefficients of a Kaiser windowed sinc. Row p holds the taps for a position p / SINC_PHASES past the
+    // frame, starting at frame - taps / 2 + 1. There's one row more than there are phases, so the last one can be
+    // interpolated towards too. Every row adds up to 1
+    struct SincTable {
+        int taps = 0;
+        std::vector<float> coefficients;
+
+        [[nodiscard]] const float* row(const int phase) const { return coefficients.data() + static_cast<size_t>(phase) * taps; }
+    };
+
+    // nullptr for the sampling modes that aren't sinc. The tables are built the first time they're asked for
+    [[nodiscard]] const SincTable* sinc_table_for_mode(int sampling_mode);
+
+    // Builds the tables now, so the first block that uses them doesn't have to
+    void init_sinc_tables();
+
+    // Dot product of `n` samples with `n` coefficients, `n` has to be a multiple of 4
+    [[nodiscard]] float sinc_dot(const i16* samples, const float* coefficients, int n);
+    [[nodiscard]] float sinc_dot(const float* samples, const float* coefficients, int n);
+}
@@ -0,0 +1,72 @@
+#include "SoundfontLoader.h"
+#include <algorithm>
+#include <thread>
+#include "Trace.h"
+
+namespace Flan {
+    SoundfontLoader& SoundfontLoader::instance() {
+        static SoundfontLoader loader;
+        return loader;
+    }
+
+    void SoundfontLoader::request(const void* owner, const LoadPriority priority, const LoadFunction& load) {
+        std::lock_guard guard(m_mutex);
+
+        // If this owner already has a load queued, only bump its priority
+        const auto queued = std::find_if(m_queue.begin(), m_queue.end(), [owner](const Request& request) {
+            return request.owner == owner;
+        });
+        if (queued != m_queue.end()) {
+            queued->priority = std::max(queued->priority, priority);
+            return;
+        }
+        m_queue.push_back({ owner, priority, m_next_order++, load });
+
+        // Start the worker if it isn't running. It stops by itself once the queue is empty, so idle instances
+        // don't keep a thread around. It's detached because it can outlive any single instance, and every
+        // instance cancels its own loads before it's destroyed.
+        if (!m_worker_running) {
+            m_worker_running = true;
+            std::thread(&SoundfontLoader::run, this).detach();
+        }
+    }
+
+    void SoundfontLoader::cancel(const void* owner) {
+        std::unique_lock lock(m_mutex);
+
+        // Remove the queued request
+        std::erase_if(m_queue, [owner](const Request& request) {
+            return request.owner == owner;
+        });
+
+        // Wait for the running one to finish
+        m_load_done.wait(lock, [this, owner]() {
+            return m_current_owner != owner;
+        });
+    }
+
+    void SoundfontLoader::run() {
+        trace_thread_name("soundfont loader");
+        std::unique_lock lock(m_mutex);
+        while (!m_queue.empty()) {
+            // Take the most urgent request, first come first serve if they're equally urgent
+            const auto next = std::min_element(m_queue.begin(), m_queue.end(), [](const Request& lhs, const Request& rhs) {
+                if (lhs.priority != rhs.priority) {
+                    return lhs.priority > rhs.priority;
+                }
+                return lhs.order < rhs.order;
+            });
+            const Request request = *next;
+            m_queue.erase(next);
+
+            // Load it without holding the lock, so new requests can come in while we're loading
+            m_current_owner = request.owner;
+            lock.unlock();
+            request.load();
+            lock.lock();
+            m_current_owner = nullptr;
+            m_load_done.notify_all();
+        }
+        m_worker_running = false;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace Flan {
+    // Higher priorities get loaded first
+    enum class LoadPriority {
+        background = 0, // Restored from a project, nobody is waiting for it yet
+        editor = 1,     // The editor was opened
+        note = 2,       // A note was played
+        user = 3,       // The user picked a new soundfont
+    };
+
+    // Loads soundfonts for all plugin instances on one shared thread, most urgent request first.
+    // Opening a project with lots of instances this way doesn't turn into a pile of competing file reads,
+    // and the instance that's actually being played or looked at doesn't have to wait for all the others.
+    class SoundfontLoader {
+    public:
+        using LoadFunction = std::function<void()>;
+
+        static SoundfontLoader& instance();
+
+        // Queue a load for `owner`, or raise the priority of the one that's already queued
+        void request(const void* owner, LoadPriority priority, const LoadFunction& load);
+
+        // Remove any queued load for `owner`, and wait for its current load to finish if there is one
+        void cancel(const void* owner);
+
+    private:
+        struct Request {
+            const void* owner;
+            LoadPriority priority;
+            size_t order;
+            LoadFunction load;
+        };
+
+        void run();
+
+        std::vector<Request> m_queue;
+        std::mutex m_mutex;
+        std::condition_variable m_load_done;
+        const void* m_current_owner = nullptr;
+        size_t m_next_order = 0;
+        bool m_worker_running = false;
+    };
+}
@@ -0,0 +1,1038 @@
+#include "Synth.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "FilterDesign.h"
+#include "FruityPlug/fp_extra.h"
+
+namespace Flan {
+    std::wstring preset_display_name(const PresetEntry& preset) {
+        // Get the bank and program for the current one
+        const auto bank = (preset.key & 0xFF00) >> 8;
+        const auto program = (preset.key & 0x00FF);
+
+        // Convert name to wstring
+        std::wstring name;
+        name.resize(preset.name.length() + 10);
+
+        // Add bank number and program number to the preset name
+        name[0] = L'0' + (bank / 100) % 10;
+        name[1] = L'0' + (bank / 10) % 10;
+        name[2] = L'0' + (bank / 1) % 10;
+        name[3] = ':';
+        name[4] = L'0' + (program / 100) % 10;
+        name[5] = L'0' + (program / 10) % 10;
+        name[6] = L'0' + (program / 1) % 10;
+        name[7] = ' ';
+        name[8] = '-';
+        name[9] = ' ';
+
+        // Add the actual name from the soundfont data
+        for (size_t i = 0; i < preset.name.length(); i++) {
+            name[i + 10] = preset.name[i];
+        }
+        return name;
+    }
+
+    Synth::~Synth() {
+        for (const auto* voice : active_voices) {
+            delete voice;
+        }
+    }
+
+    void Synth::set_sample_rate(const double sample_rate) {
+        std::lock_guard guard{ note_playing_mutex };
+        m_sample_rate = sample_rate;
+        m_sample_rate_inv = 1.0 / m_sample_rate;
+
+        // The one-shots were rendered at the old rate, and so were the resampled samples and what's on the half rate bus
+        m_one_shots.clear(active_voices);
+        m_half_rate_bus.clear();
+        if (m_host_rate_samples != nullptr && m_host_rate_samples->sample_rate() != sample_rate) {
+            silence_voices();
+            m_host_rate_samples.reset();
+        }
+    }
+
+    float midi_velocity_to_volume(const u8 velocity) {
+        return (powf(21.0f, static_cast<float>(velocity) / 127.0f) - 1.0f) / 10.0f;
+    }
+
+    Voice* Synth::trigger_voice(const VoiceParams* voice_params, const intptr_t voice_tag, const int offset) {
+        TraceScope trace("note_on", trace_instance, voice_tag);
+        return start_voice(voice_params, voice_tag, m_state.preset_key(), -1, offset);
+    }
+
+    Voice* Synth::start_voice(const VoiceParams* voice_params, const intptr_t voice_tag, u16 preset_key, const int midi_channel, const int offset) {
+        // Locked for the whole note, so the presets, samples and mips can't be replaced while it reads them, and we don't
+        // get any surprises from the render thread
+        std::lock_guard guard{ note_playing_mutex };
+
+        // Don't create a new voice if the bank and program don't exist in the soundfont. While a new one is on its way
+        // there's no telling yet, so the note waits for it
+        const PresetEntry* preset = nullptr;
+        if (!m_holding_notes) {
+            if (midi_channel >= 0) {
+                preset_key = playable_midi_preset(preset_key, midi_channel);
+            }
+            preset = presets.find(preset_key);
+            if (preset == nullptr) {
+                return nullptr;
+            }
+        }
+
+        // Create new voice. MIDI notes keep their own copy of the params, there's no host holding on to them
+        Voice* new_voice = new Voice();
+        new_voice->voice_tag = voice_tag;
+        new_voice->voice_params = voice_params;
+        new_voice->start_offset = std::max(offset, 0);
+        new_voice->preset_key = preset_key;
+        new_voice->midi_note = static_cast<u8>(static_cast<int>(60 + (voice_params->final_levels.pitch / 100)));
+        if (midi_channel >= 0) {
+            new_voice->midi_params = *voice_params;
+            new_voice->voice_params = &new_voice->midi_params;
+            new_voice->midi_channel = midi_channel;
+        }
+
+        if (preset == nullptr) {
+            trace_instant("note_waiting", trace_instance, voice_tag);
+            new_voice->waiting = true;
+        }
+        else {
+            start_oscillators(new_voice, *preset);
+        }
+        active_voices.push_back(new_voice);
+        return new_voice;
+    }
+
+    void Synth::start_oscillators(Voice* voice, const PresetEntry& preset) {
+        const VoiceParams* voice_params = voice->voice_params;
+
+        // Get midi information
+        //int vel = std::clamp(static_cast<int>(powf(voice_params->init_levels.vol / 2.0f, 0.5f) * 127.0f), 0, 127);
+        int vel = std::min(127, static_cast<int>(VolumeToMIDIVelocity(voice_params->init_levels.vol)));
+        int key = static_cast<int>(60 + (voice_params->final_levels.pitch / 100));
+        const double corrected_key = log2(m_scale[key]) * 12 + 60;
+        const OutputRouting& routing = m_state.output_routing.get();
+
+        // Loop over all preset zones to figure out for which ones the key and the velocity are inside the range
+        const std::span<const Zone> zones = presets.zones(preset);
+        for (size_t zone_index = 0; zone_index < zones.size(); ++zone_index) {
+            const Zone& zone = zones[zone_index];
+            // for the zones that fit that criteria:
+            if (static_cast<u8>(corrected_key) >= zone.key_range_low &&
+                static_cast<u8>(corrected_key) <= zone.key_range_high &&
+                vel >= zone.vel_range_low &&
+                vel <= zone.vel_range_high
+                ) {
+
+                // find a free wavetable oscillator spot in the array
+                auto p_wave_osc = new WavetableOscillator();
+                auto& wave_osc = *p_wave_osc;
+                voice->wave_oscs.push_back(p_wave_osc);
+
+                //m_curr_wave_osc_idx = (m_curr_wave_osc_idx + 1) % N_WAVE_OSCS;
+                {
+                    // init sample and preset pointers
+                    wave_osc.sample = soundfont.samples[zone.sample_index];
+                    wave_osc.preset_zone = zone;
+                    if (m_sample_mips != nullptr) {
+                        wave_osc.mips = m_sample_mips->find(wave_osc.sample.data);
+                        wave_osc.linked_mips = m_sample_mips->find(wave_osc.sample.linked);
+                    }
+
+                    // apply overrides
+                    if (m_state.volenv_delay != 0.0) {
+                        wave_osc.preset_zone.vol_env.delay = 1.0 / m_state.volenv_delay;
+                    }
+                    if (m_state.volenv_attack != 0.0) {
+                        wave_osc.preset_zone.vol_env.attack = 1.0 / m_state.volenv_attack;
+                    }
+                    if (m_state.volenv_hold != 0.0) {
+                        wave_osc.preset_zone.vol_env.hold = 1.0 / m_state.volenv_hold;
+                    }
+                    if (m_state.volenv_decay != 0.0) {
+                        wave_osc.preset_zone.vol_env.decay = 100.0 / m_state.volenv_decay;
+                    }
+                    if (m_state.volenv_sustain != 0.0) {
+                        wave_osc.preset_zone.vol_env.sustain = m_state.volenv_sustain;
+                    }
+                    if (m_state.volenv_release != 0.0) {
+                        wave_osc.preset_zone.vol_env.release = 100.0 / m_state.volenv_release;
+                    }
+
+                    // init sample position and adsr_volume to 0.0
+                    wave_osc.sample_position = 0.0;
+                    wave_osc.vol_env.value = 0.0;
+                    wave_osc.mod_env.value = 0.0;
+
+                    // init adsr_stage to Delay
+                    wave_osc.vol_env.stage = static_cast<double>(EnvStage::delay);
+                    wave_osc.mod_env.stage = static_cast<double>(EnvStage::delay);
+
+                    // init lfo
+                    wave_osc.vib_lfo.time = 0.0;
+                    wave_osc.vib_lfo.state = 0.0;
+                    wave_osc.mod_lfo.time = 0.0;
+                    wave_osc.mod_lfo.state = 0.0;
+
+                    // init filter
+                    wave_osc.filter = zone.filter;
+
+                    // set midi key, velocity to note_on event key, velocity
+                    wave_osc.midi_key = static_cast<u8>(key);
+                    wave_osc.output = static_cast<u8>(routing.output_for(static_cast<u8>(corrected_key), zone_index));
+                    if (zone.vel_override < 128)
+                        vel = zone.vel_override;
+                    wave_osc.initial_channel_pitch = static_cast<double>(voice_params->final_levels.pitch);
+                    wave_osc.channel_pitch = 0.0;
+
+                    // init sample_delta
+                    const double pitch_correction = (wave_osc.channel_pitch / 100.0) + static_cast<double>(zone.root_key_offset) + static_cast<double>(zone.tuning);
+                    if (zone.key_override < 128)
+                        key = zone.key_override;
+                    const double scaled_key = 60 + static_cast<double>(key - 60) * zone.scale_tuning;
+                    const double key_multiplier = lerp(
+                        m_scale[static_cast<size_t>(scaled_key)],
+                        m_scale[static_cast<size_t>(scaled_key) + 1],
+                        fmodf(scaled_key, 1.0));
+                    wave_osc.sample_delta = (static_cast<double>(wave_osc.sample.base_sample_rate) * key_multiplier * (pow(2.0, pitch_correction / 12.0))) * m_sample_rate_inv;
+                    wave_osc.preset_zone.vol_env.hold *= pow(2.0, wave_osc.preset_zone.key_to_vol_env_hold * static_cast<double>(key - 60) / 1200);
+                    wave_osc.preset_zone.vol_env.decay *= pow(2.0, wave_osc.preset_zone.key_to_vol_env_decay * static_cast<double>(key - 60) / 1200);
+                    wave_osc.preset_zone.mod_env.hold *= pow(2.0, wave_osc.preset_zone.key_to_mod_env_hold * static_cast<double>(key - 60) / 1200);
+                    wave_osc.preset_zone.mod_env.decay *= pow(2.0, wave_osc.preset_zone.key_to_mod_env_decay * static_cast<double>(key - 60) / 1200);
+                }
+            }
+        }
+
+        // The resampled samples can be swapped in from the background at any time, so they're picked here
+        if (m_host_rate_samples != nullptr) {
+            for (auto* osc : voice->wave_oscs) {
+                m_host_rate_samples->substitute(*osc);
+            }
+        }
+    }
+
+    void Synth::hold_notes() {
+        std::lock_guard guard{ note_playing_mutex };
+        m_holding_notes = true;
+    }
+
+    void Synth::start_waiting_voices() {
+        m_holding_notes = false;
+        for (auto* voice : active_voices) {
+            if (!voice->waiting) {
+                continue;
+            }
+
+            // Same as start_voice(), and they start right at the next block. The ones the new soundfont doesn't have a
+            // preset for are done
+            voice->waiting = false;
+            voice->start_offset = 0;
+            voice->levels_valid = false;
+            if (voice->midi_channel >= 0) {
+                voice->preset_key = playable_midi_preset(voice->preset_key, voice->midi_channel);
+            }
+            const PresetEntry* preset = presets.find(voice->preset_key);
+            if (preset == nullptr) {
+                voice->schedule_kill = true;
+                continue;
+            }
+            start_oscillators(voice, *preset);
+            if (voice->waiting_released) {
+                voice->release();
+            }
+        }
+    }
+
+    bool Synth::render(float* dest, const int length) {
+        return render(&dest, 1, length);
+    }
+
+    bool Synth::render(float* const* outputs, const int n_outputs, const int length) {
+        // Time the whole block, including waiting for the lock, since that counts towards a dropout too
+        profiler.begin_block();
+        TraceScope trace("render", trace_instance);
+        size_t n_voices;
+
+        // Exports aren't real-time, so they always get the full quality
+        const bool governed = m_state.adaptive_quality && !offline_rendering;
+        if (!governed) {
+            governor.reset();
+        }
+        {
+            // Lock the wavetables so we don't get any surprises from another thread
+            std::lock_guard guard{ note_playing_mutex };
+
+            // Nothing playing, so there's nothing to mix either, unless the half rate bus still has the end of a voice on it
+            if (active_voices.empty() && !m_half_rate_bus.live(m_frame)) {
+                for (int output = 0; output < n_outputs; ++output) {
+                    std::fill_n(outputs[output], static_cast<size_t>(length) * 2, 0.0f);
+                }
+                m_frame += length;
+                const double cost = profiler.end_block(length, m_sample_rate, 0);
+                if (governed) {
+                    governor.end_block(cost);
+                }
+                trace.set_value(0);
+                return false;
+            }
+
+            // Pick up level changes from FL and pitch wheel movements, once per block instead of every sample
+            for (auto* voice : active_voices) {
+                voice->update_levels(pitch_wheel_for(voice), host_applies_levels);
+
+                // A pitch bend or a slide can take a half rate voice past what fits in half the host rate
+                if (voice->half_rate && voice->full_rate_from < 0 && !still_fits_half_rate(voice)) {
+                    leave_half_rate(voice);
+                }
+            }
+
+            // New notes that are one-shots play from the cache, now that their levels are known, and the ones that don't
+            // need the full host rate render at half of it. Not when the host applies the levels, every voice is rendered
+            // on its own then and they can't share a render or the bus
+            const int sampling_mode = current_sampling_mode();
+            if (!host_applies_levels) {
+                for (auto* voice : active_voices) {
+                    if (voice->one_shot_checked || voice->waiting) {
+                        continue;
+                    }
+                    voice->one_shot_checked = true;
+                    for (auto* osc : voice->wave_oscs) {
+                        m_one_shots.attach(*osc, sampling_mode, m_sample_rate_inv);
+                    }
+                    if (m_state.multirate) {
+                        try_half_rate(voice);
+                    }
+                }
+            }
+
+            // Render the voices that matter least cheaper if the last blocks came close to the budget
+            govern_voices(sampling_mode);
+
+            // Fill buffer. The block is split at the frames where notes start or get released, so the per-frame loop
+            // doesn't have to check for them. Usually there are none, and it's rendered in one go
+            const double silence_gain = this->silence_gain();
+            int frame = 0;
+            while (frame < length) {
+                int next_frame = length;
+                m_mixing_voices.clear();
+                m_half_rate_voices.clear();
+                for (auto* voice : active_voices) {
+                    if (voice->release_offset == frame) {
+                        voice->release();
+                        voice->release_offset = -1;
+                    }
+                    if (voice->release_offset > frame) {
+                        next_frame = std::min(next_frame, voice->release_offset);
+                    }
+                    if (voice->waiting) {
+                        continue;
+                    }
+                    if (voice->start_offset > frame) {
+                        next_frame = std::min(next_frame, voice->start_offset);
+                        continue;
+                    }
+                    if (voice->half_rate) {
+                        if (voice->half_rate_position < 0) {
+                            start_half_rate(voice, m_frame + frame);
+                        }
+                        m_half_rate_voices.push_back(voice);
+                        continue;
+                    }
+                    m_mixing_voices.push_back(voice);
+                }
+                mix_frames(outputs, n_outputs, frame, next_frame, sampling_mode, silence_gain);
+                if (!m_half_rate_voices.empty() || m_half_rate_bus.live(m_frame + frame)) {
+                    mix_half_rate(outputs[0], frame, next_frame, sampling_mode, silence_gain);
+                }
+                frame = next_frame;
+            }
+
+            // Offsets past this block carry over to the next one, and released notes that stayed below the silence floor
+            // for all of it are done
+            for (auto* voice : active_voices) {
+                voice->end_block();
+                voice->start_offset = std::max(voice->start_offset - length, 0);
+                if (voice->release_offset >= 0) {
+                    voice->release_offset -= length;
+                }
+            }
+
+            // Take every voice that finished out of the active voices
+            m_finished_voices.clear();
+            std::erase_if(active_voices, [this](Voice* voice) {
+                if (!voice->schedule_kill) {
+                    return false;
+                }
+                detach_one_shots(voice);
+                m_finished_voices.push_back(voice);
+                return true;
+            });
+            n_voices = active_voices.size();
+            m_frame += length;
+        }
+
+        // Hand them over without holding the lock, the host is allowed to kill voices from inside its callback.
+        // MIDI notes are ours, the host doesn't know about them
+        for (Voice* voice : m_finished_voices) {
+            trace_instant("voice_kill", trace_instance, voice->voice_tag);
+            if (voice->midi_channel >= 0) {
+                delete voice;
+            }
+            else if (on_voice_killed) {
+                on_voice_killed(voice);
+            }
+        }
+
+        const double cost = profiler.end_block(length, m_sample_rate, n_voices);
+        if (governed) {
+            governor.end_block(cost);
+        }
+        trace.set_value(static_cast<int64_t>(n_voices));
+        return true;
+    }
+
+    void Synth::mix_frames(float* const* outputs, const int n_outputs, const int begin, const int end, const int sampling_mode, const double silence_gain) {
+        if (n_outputs == 1) {
+            float* dest = outputs[0];
+            for (int j = begin; j < end; j++) {
+                sample_t total_l = 0;
+                sample_t total_r = 0;
+                for (auto* voice : m_mixing_voices) {
+                    const int voice_mode = (voice->governed_sampling_mode >= 0) ? voice->governed_sampling_mode : sampling_mode;
+                    const BufferSample sample = voice->get_sample(m_sample_rate_inv, voice_mode, silence_gain);
+                    total_l += sample.left;
+                    total_r += sample.right;
+                }
+                dest[(j * 2) + 0] = total_l;
+                dest[(j * 2) + 1] = total_r;
+            }
+            return;
+        }
+
+        // Every voice is summed on its own first and then added to the totals, same as above, so a zone sounds
+        // exactly the same on its own output as it does on the main one
+        BufferSample totals[MAX_OUTPUTS];
+        BufferSample voice_samples[MAX_OUTPUTS];
+        const int n = std::min(n_outputs, MAX_OUTPUTS);
+        for (int j = begin; j < end; j++) {
+            std::fill_n(totals, n, BufferSample{ 0, 0 });
+            for (auto* voice : m_mixing_voices) {
+                std::fill_n(voice_samples, n, BufferSample{ 0, 0 });
+                const int voice_mode = (voice->governed_sampling_mode >= 0) ? voice->governed_sampling_mode : sampling_mode;
+                voice->get_samples(voice_samples, n, m_sample_rate_inv, voice_mode, silence_gain);
+                for (int output = 0; output < n; ++output) {
+                    totals[output].left += voice_samples[output].left;
+                    totals[output].right += voice_samples[output].right;
+                }
+            }
+            for (int output = 0; output < n; ++output) {
+                outputs[output][(j * 2) + 0] = totals[output].left;
+                outputs[output][(j * 2) + 1] = totals[output].right;
+            }
+        }
+    }
+
+    void Synth::mix_half_rate(float* dest, const int begin, const int end, const int sampling_mode, const double silence_gain) {
+        for (int chunk = begin; chunk < end; chunk += MULTIRATE_CHUNK) {
+            const int chunk_end = std::min(chunk + MULTIRATE_CHUNK, end);
+
+            // Everything the upsampler reads for these frames has to be on the bus, which goes a little past them
+            const int64_t bus_end = (m_frame + chunk_end + MULTIRATE_LOOKAHEAD + 1) & ~static_cast<int64_t>(1);
+            m_half_rate_bus.open_to(bus_end);
+            for (auto* voice : m_half_rate_voices) {
+                const int voice_mode = (voice->governed_sampling_mode >= 0) ? voice->governed_sampling_mode : sampling_mode;
+                if (voice->full_rate_from >= 0) {
+                    render_full_rate_ahead(voice, bus_end, voice_mode, silence_gain);
+                    continue;
+                }
+                const int64_t first = voice->half_rate_position;
+                int n = 0;
+                while (voice->half_rate_position < bus_end && !voice->schedule_kill) {
+                    m_half_rate_frames[n++] = voice->get_sample(m_sample_rate_inv * 2.0, voice_mode, silence_gain);
+                    voice->half_rate_position += 2;
+                }
+                m_half_rate_bus.add(first, m_half_rate_frames, n);
+            }
+            m_half_rate_bus.mix_into(dest + static_cast<size_t>(chunk) * 2, m_frame + chunk, m_frame + chunk_end);
+        }
+    }
+
+    void Synth::try_half_rate(Voice* voice) const {
+        if (voice->wave_oscs.empty()) {
+            return;
+        }
+        for (const auto* osc : voice->wave_oscs) {
+            if (osc->one_shot != nullptr || osc->output != 0 || !fits_half_rate(*osc, osc->sample_delta, m_sample_rate)) {
+                return;
+            }
+        }
+
+        // Every frame it renders now covers two host frames
+        voice->half_rate = true;
+        for (auto* osc : voice->wave_oscs) {
+            osc->sample_delta *= 2.0;
+        }
+    }
+
+    void Synth::start_half_rate(Voice* voice, const int64_t frame) {
+        // Its frames go on even host frames, so it starts on the first one from here. The oscillators move forward before they
+        // read, which a half rate frame does by two host frames, so line them up with where they'd be at the full rate
+        voice->half_rate_position = (frame + 1) & ~static_cast<int64_t>(1);
+        const double frames_ahead = static_cast<double>(voice->half_rate_position - frame) - 1.0;
+        for (auto* osc : voice->wave_oscs) {
+            osc->sample_position += frames_ahead * osc->sample_delta * 0.5 * osc->level_pitch_mul;
+        }
+    }
+
+    bool Synth::still_fits_half_rate(const Voice* voice) const {
+        for (const auto* osc : voice->wave_oscs) {
+            if (!fits_half_rate(*osc, osc->sample_delta * 0.5, m_sample_rate)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Synth::leave_half_rate(Voice* voice) {
+        for (auto* osc : voice->wave_oscs) {
+            osc->sample_delta *= 0.5;
+        }
+
+        // Not on the bus yet, so it can simply start at the full rate
+        if (voice->half_rate_position < 0) {
+            voice->half_rate = false;
+            return;
+        }
+
+        // The last frame it read is two host frames back from where it's up to, it carries on from the one right after that.
+        // It's ahead of the block, so it stays on the bus, with what's on it already fading out as the full rate fades in
+        voice->half_rate_position -= 1;
+        voice->full_rate_from = voice->half_rate_position;
+    }
+
+    void Synth::render_full_rate_ahead(Voice* voice, const int64_t end, const int sampling_mode, const double silence_gain) {
+        // While it fades in, the rest goes on the bus at half rate, so the upsampler doesn't see the half rate frames stop dead.
+        // The fade is a raised cosine, the upsampler would smear the corners of a straight one
+        const int64_t first = voice->half_rate_position;
+        const int64_t first_half_rate = (first + 1) & ~static_cast<int64_t>(1);
+        int n = 0;
+        int n_half_rate = 0;
+        while (voice->half_rate_position < end && !voice->schedule_kill) {
+            const BufferSample sample = voice->get_sample(m_sample_rate_inv, sampling_mode, silence_gain);
+            const int64_t faded = voice->half_rate_position - voice->full_rate_from;
+            if (faded >= MULTIRATE_FADE_FRAMES) {
+                m_full_rate_frames[n++] = sample;
+            }
+            else {
+                const float fade = 0.5f - 0.5f * cosf(static_cast<float>(pi) * static_cast<float>(faded) / MULTIRATE_FADE_FRAMES);
+                m_full_rate_frames[n++] = { sample.left * fade, sample.right * fade };
+                if ((voice->half_rate_position & 1) == 0) {
+                    m_half_rate_frames[n_half_rate++] = { sample.left * (1.0f - fade), sample.right * (1.0f - fade) };
+                }
+            }
+            ++voice->half_rate_position;
+        }
+        m_half_rate_bus.add(first_half_rate, m_half_rate_frames, n_half_rate);
+        m_half_rate_bus.add_full_rate(first, m_full_rate_frames, n);
+    }
+
+    bool Synth::render_voice(Voice* voice, float* dest, const int length) {
+        TraceScope trace("render_voice", trace_instance, voice->voice_tag);
+
+        // Other voices can render at the same time, we only need to keep the soundfont from being replaced
+        std::shared_lock guard{ note_playing_mutex };
+        voice->update_levels(pitch_wheel_for(voice), host_applies_levels);
+        const int sampling_mode = current_sampling_mode();
+        const double silence_gain = this->silence_gain();
+        for (int j = 0; j < length; j++) {
+            if (j == voice->release_offset) {
+                voice->release();
+            }
+            if (j < voice->start_offset || voice->waiting) {
+                dest[(j * 2) + 0] = 0.0f;
+                dest[(j * 2) + 1] = 0.0f;
+                continue;
+            }
+            const BufferSample sample = voice->get_sample(m_sample_rate_inv, sampling_mode, silence_gain);
+            dest[(j * 2) + 0] = sample.left;
+            dest[(j * 2) + 1] = sample.right;
+        }
+        voice->end_block();
+        voice->start_offset = std::max(voice->start_offset - length, 0);
+        voice->release_offset = (voice->release_offset >= length) ? voice->release_offset - length : -1;
+        return !voice->schedule_kill;
+    }
+
+    void Synth::process_midi(const u8 status, const u8 data1, const u8 data2, const int offset) {
+        const int channel = status & 0x0F;
+        switch (status & 0xF0) {
+        case 0x90:
+            if (data2 > 0) {
+                midi_note_on(channel, data1 & 0x7F, data2 & 0x7F, offset);
+                break;
+            }
+            [[fallthrough]];
+        case 0x80:
+            midi_note_off(channel, data1 & 0x7F, offset);
+            break;
+        case 0xB0:
+            midi_control_change(channel, data1 & 0x7F, data2 & 0x7F, offset);
+            break;
+        case 0xC0: {
+            std::lock_guard guard{ note_playing_mutex };
+            m_channels[channel].program = data1 & 0x7F;
+            break;
+        }
+        case 0xE0: {
+            std::lock_guard guard{ note_playing_mutex };
+            MidiChannel& midi_channel = m_channels[channel];
+            const int bend = (((data2 & 0x7F) << 7) | (data1 & 0x7F)) - 8192;
+            midi_channel.pitch_wheel = static_cast<double>(bend) / 8192.0 * midi_channel.bend_range;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void Synth::reset_midi_channels() {
+        std::lock_guard guard{ note_playing_mutex };
+        for (auto* voice : active_voices) {
+            if (voice->midi_channel >= 0) {
+                voice->stop();
+            }
+        }
+        for (MidiChannel& channel : m_channels) {
+            channel = MidiChannel();
+        }
+    }
+
+    void Synth::midi_note_on(const int channel, const u8 key, const u8 velocity, const int offset) {
+        const intptr_t voice_tag = m_next_midi_voice_tag--;
+        TraceScope trace("note_on", trace_instance, voice_tag);
+
+        // The same levels FL would give us for this note, with the channel volume and panning applied on top
+        VoiceParams params{};
+        u16 preset_key;
+        {
+            std::lock_guard guard{ note_playing_mutex };
+            const MidiChannel& midi_channel = m_channels[channel];
+            const float gain = static_cast<float>(midi_channel.volume * midi_channel.expression) / (127.0f * 127.0f);
+            params.init_levels = {
+                std::clamp(static_cast<float>(midi_channel.pan - 64) / 63.0f, -1.0f, 1.0f),
+                midi_velocity_to_volume(velocity),
+                static_cast<float>((key - 60) * 100),
+                0.0f,
+                0.0f,
+            };
+            params.final_levels = params.init_levels;
+            params.final_levels.vol *= gain * gain;
+            preset_key = midi_preset_key(channel);
+        }
+
+        start_voice(&params, voice_tag, preset_key, channel, offset);
+    }
+
+    void Synth::midi_note_off(const int channel, const u8 key, const int offset) {
+        std::lock_guard guard{ note_playing_mutex };
+        for (auto* voice : active_voices) {
+            if (voice->midi_channel != channel || voice->midi_note != key || voice->midi_released) {
+                continue;
+            }
+            trace_instant("note_off", trace_instance, voice->voice_tag);
+            voice->midi_released = true;
+            if (m_channels[channel].sustain) {
+                voice->midi_sustained = true;
+            }
+            else {
+                voice->release_after(offset);
+            }
+            return;
+        }
+    }
+
+    void Synth::midi_control_change(const int channel, const u8 controller, const u8 value, const int offset) {
+        std::lock_guard guard{ note_playing_mutex };
+        MidiChannel& midi_channel = m_channels[channel];
+        switch (controller) {
+        case 0:
+            midi_channel.bank = value;
+            break;
+        case 6:
+            // Data entry, only the pitch bend range is supported
+            if (midi_channel.rpn == 0) {
+                midi_channel.bend_range = value;
+            }
+            break;
+        case 7:
+            midi_channel.volume = value;
+            apply_channel_levels(channel);
+            break;
+        case 10:
+            midi_channel.pan = value;
+            apply_channel_levels(channel);
+            break;
+        case 11:
+            midi_channel.expression = value;
+            apply_channel_levels(channel);
+            break;
+        case 64:
+            midi_channel.sustain = value >= 64;
+            if (!midi_channel.sustain) {
+                for (auto* voice : active_voices) {
+                    if (voice->midi_channel == channel && voice->midi_sustained) {
+                        voice->midi_sustained = false;
+                        voice->release_after(offset);
+                    }
+                }
+            }
+            break;
+        case 100:
+            midi_channel.rpn = static_cast<u16>((midi_channel.rpn & 0x3F80) | value);
+            break;
+        case 101:
+            midi_channel.rpn = static_cast<u16>((midi_channel.rpn & 0x007F) | (value << 7));
+            break;
+        case 120:
+        case 123:
+            // All sound off cuts the notes, all notes off lets them release
+            for (auto* voice : active_voices) {
+                if (voice->midi_channel != channel) {
+                    continue;
+                }
+                voice->midi_released = true;
+                voice->midi_sustained = false;
+                if (controller == 120) {
+                    voice->stop();
+                }
+                else {
+                    voice->release();
+                }
+            }
+            break;
+        case 121:
+            // Reset all controllers, volume and pan stay where they are
+            midi_channel.expression = 127;
+            midi_channel.sustain = false;
+            midi_channel.rpn = 0x3FFF;
+            midi_channel.pitch_wheel = 0.0;
+            apply_channel_levels(channel);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Synth::apply_channel_levels(const int channel) {
+        // The voices pick this up on the next block, see Voice::update_levels
+        const MidiChannel& midi_channel = m_channels[channel];
+        const float gain = static_cast<float>(midi_channel.volume * midi_channel.expression) / (127.0f * 127.0f);
+        const float pan = std::clamp(static_cast<float>(midi_channel.pan - 64) / 63.0f, -1.0f, 1.0f);
+        for (auto* voice : active_voices) {
+            if (voice->midi_channel == channel) {
+                voice->midi_params.final_levels.vol = voice->midi_params.init_levels.vol * gain * gain;
+                voice->midi_params.final_levels.pan = pan;
+            }
+        }
+    }
+
+    u16 Synth::midi_preset_key(const int channel) const {
+        // Channel 10 plays the drum kits
+        const MidiChannel& midi_channel = m_channels[channel];
+        const u16 bank = (channel == 9) ? 128 : midi_channel.bank;
+        return static_cast<u16>((bank << 8) | midi_channel.program);
+    }
+
+    u16 Synth::playable_midi_preset(const u16 preset_key, const int channel) const {
+        // If a bank doesn't have the program, fall back to the General MIDI one
+        if (presets.contains(preset_key)) {
+            return preset_key;
+        }
+        return (channel == 9) ? static_cast<u16>(128 << 8) : static_cast<u16>(preset_key & 0xFF);
+    }
+
+    double Synth::pitch_wheel_for(const Voice* voice) const {
+        return (voice->midi_channel >= 0) ? m_channels[voice->midi_channel].pitch_wheel : m_pitch_wheel;
+    }
+
+    void Synth::stop_all_voices() {
+        std::lock_guard guard{ note_playing_mutex };
+        for (auto* voice : active_voices) {
+            voice->stop();
+        }
+        m_half_rate_bus.clear();
+    }
+
+    void Synth::kill_voice(Voice* voice) {
+        {
+            std::lock_guard guard{ note_playing_mutex };
+            std::erase(active_voices, voice);
+            detach_one_shots(voice);
+        }
+        delete voice;
+    }
+
+    void Synth::measure_memory(MemoryStats& stats) {
+        std::shared_ptr<const MemoryStats> soundfont_stats;
+        {
+            std::shared_lock guard{ note_playing_mutex };
+            soundfont_stats = m_soundfont_stats;
+            measure_voices(active_voices, stats);
+            stats.n_one_shots = m_one_shots.size();
+            stats.one_shot_bytes = m_one_shots.bytes();
+            stats.mip_bytes = (m_sample_mips != nullptr) ? m_sample_mips->bytes() : 0;
+            stats.host_rate_bytes = (m_host_rate_samples != nullptr) ? m_host_rate_samples->bytes() : 0;
+        }
+        copy_soundfont_stats((soundfont_stats != nullptr) ? *soundfont_stats : MemoryStats(), stats);
+        measure_residency(stats);
+    }
+
+    std::shared_ptr<const std::vector<std::wstring>> Synth::preset_names() {
+        std::shared_lock guard{ note_playing_mutex };
+        return m_preset_names;
+    }
+
+    void Synth::snapshot_soundfont() {
+        auto soundfont_stats = std::make_shared<MemoryStats>();
+        measure_soundfont(soundfont, presets, *soundfont_stats);
+        m_soundfont_stats = std::move(soundfont_stats);
+
+        auto names = std::make_shared<std::vector<std::wstring>>();
+        names->reserve(presets.size());
+        for (const PresetEntry& preset : presets) {
+            names->push_back(preset_display_name(preset));
+        }
+        m_preset_names = std::move(names);
+    }
+
+    void Synth::load_soundfont(const std::string& path) {
+        const auto start = std::chrono::steady_clock::now();
+
+        // The mips are freed once we're out of the lock
+        std::shared_ptr<const SampleMipTable> old_mips;
+
+        // Lock the wavetables so we don't surprise the audio render thread
+        std::lock_guard guard{ note_playing_mutex };
+
+        // Stop all audio, the voices point into the soundfont we're about to replace
+        silence_voices();
+        m_half_rate_bus.clear();
+        const auto voices_stopped = std::chrono::steady_clock::now();
+
+        // The cached one-shots point into it too
+        m_one_shots.clear(active_voices);
+
+        // Load soundfont
+        soundfont.clear();
+        presets.clear();
+        old_mips = std::move(m_sample_mips);
+        m_host_rate_samples.reset();
+        ++m_soundfont_loads;
+        soundfont.from_file(path);
+        presets.build(soundfont.presets);
+        const auto loaded = std::chrono::steady_clock::now();
+
+        // The mips aren't part of the load, see build_sample_mips()
+        m_load_timings.stop_voices = std::chrono::duration<double>(voices_stopped - start).count();
+        m_load_timings.from_file = std::chrono::duration<double>(loaded - voices_stopped).count();
+        m_load_timings.build_mips = 0.0;
+        trace_span("stop_voices", trace_instance, start.time_since_epoch().count(), voices_stopped.time_since_epoch().count());
+        trace_span("from_file", trace_instance, voices_stopped.time_since_epoch().count(), loaded.time_since_epoch().count(),
+            static_cast<int64_t>(presets.size()));
+
+        // measure_memory() and the editor's preset list only look at the soundfont once per load
+        snapshot_soundfont();
+
+        // The notes that came in while it was on its way can play now
+        start_waiting_voices();
+    }
+
+    void Synth::index_presets() {
+        std::lock_guard guard{ note_playing_mutex };
+        presets.build(soundfont.presets);
+        snapshot_soundfont();
+    }
+
+    void Synth::build_sample_mips() {
+        TraceScope trace("build_mips", trace_instance);
+        const auto start = std::chrono::steady_clock::now();
+
+        // Copy the sample headers, the data they point to stays put until the next soundfont load
+        std::vector<Sample> samples;
+        uint64_t soundfont_loads;
+        {
+            std::shared_lock guard{ note_playing_mutex };
+            if (m_sample_mips != nullptr || !m_state.sample_mipmaps) {
+                return;
+            }
+            samples = soundfont.samples;
+            soundfont_loads = m_soundfont_loads;
+        }
+
+        auto table = std::make_shared<SampleMipTable>();
+        table->build(samples);
+
+        std::lock_guard guard{ note_playing_mutex };
+        if (soundfont_loads != m_soundfont_loads || !m_state.sample_mipmaps) {
+            return;
+        }
+        m_sample_mips = std::move(table);
+        m_load_timings.build_mips = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void Synth::clear_sample_mips() {
+        // The mips are freed once we're out of the lock
+        std::shared_ptr<const SampleMipTable> old_mips;
+        std::lock_guard guard{ note_playing_mutex };
+        if (m_sample_mips == nullptr) {
+            return;
+        }
+
+        // The notes reading them carry on with the full rate sample. The one-shots were rendered from them
+        m_one_shots.clear(active_voices);
+        for (const auto* voice : active_voices) {
+            for (auto* osc : voice->wave_oscs) {
+                osc->mips = nullptr;
+                osc->linked_mips = nullptr;
+            }
+        }
+        old_mips = std::move(m_sample_mips);
+    }
+
+    void Synth::build_host_rate_samples() {
+        TraceScope trace("build_host_rate_samples", trace_instance);
+
+        // Copy the sample headers, the data they point to stays put until the next soundfont load
+        std::vector<Sample> samples;
+        double sample_rate;
+        uint64_t soundfont_loads;
+        {
+            std::shared_lock guard{ note_playing_mutex };
+            if (m_host_rate_samples != nullptr && m_host_rate_samples->sample_rate() == m_sample_rate) {
+                return;
+            }
+            samples = soundfont.samples;
+            sample_rate = m_sample_rate;
+            soundfont_loads = m_soundfont_loads;
+        }
+
+        auto table = std::make_shared<HostRateSampleTable>();
+        table->build(samples, sample_rate, m_state.sample_mipmaps);
+
+        std::lock_guard guard{ note_playing_mutex };
+        if (sample_rate != m_sample_rate || soundfont_loads != m_soundfont_loads) {
+            return;
+        }
+        m_host_rate_samples = std::move(table);
+    }
+
+    void Synth::render_one_shots() {
+        TraceScope trace("render_one_shots", trace_instance);
+
+        // Take the requests, and hold on to the mips and resampled samples they might play, those can be thrown away from
+        // another thread. The soundfont only changes on the thread that loads it, which is this one
+        std::vector<std::unique_ptr<OneShotRender>> renders;
+        std::shared_ptr<const SampleMipTable> sample_mips;
+        std::shared_ptr<const HostRateSampleTable> host_rate_samples;
+        uint64_t generation;
+        {
+            std::lock_guard guard{ note_playing_mutex };
+            renders = m_one_shots.take_requests(generation);
+            sample_mips = m_sample_mips;
+            host_rate_samples = m_host_rate_samples;
+        }
+
+        // Render them without holding the lock. The ones that are too long for the cache are thrown away
+        std::vector<std::unique_ptr<OneShotRender>> evicted;
+        for (auto& render : renders) {
+            if (!render->record(ONE_SHOT_CACHE_BUDGET / 4 / sizeof(BufferSample)) || render->bytes() > ONE_SHOT_CACHE_BUDGET / 4) {
+                evicted.push_back(std::move(render));
+            }
+        }
+        std::erase(renders, nullptr);
+        trace.set_value(static_cast<int64_t>(renders.size()));
+
+        // The evicted renders are freed once we're out of the lock
+        std::lock_guard guard{ note_playing_mutex };
+        for (auto& render : renders) {
+            m_one_shots.add(std::move(render), generation, evicted);
+        }
+    }
+
+    void Synth::clear_host_rate_samples() {
+        std::lock_guard guard{ note_playing_mutex };
+        if (m_host_rate_samples == nullptr) {
+            return;
+        }
+        m_one_shots.clear(active_voices);
+        silence_voices();
+        m_host_rate_samples.reset();
+    }
+
+    void Synth::silence_voices() const {
+        // The notes waiting for the soundfont are left alone, they don't play anything yet
+        for (const auto* voice : active_voices) {
+            for (auto* wave_osc : voice->wave_oscs) {
+                wave_osc->vol_env.stage = EnvStage::off;
+            }
+        }
+    }
+
+    void Synth::govern_voices(const int sampling_mode) {
+        const double quiet_gain = pow(10.0, GOVERNOR_QUIET_DB / 20.0);
+        size_t n_degraded = 0;
+        for (auto* voice : active_voices) {
+            if (voice->waiting) {
+                continue;
+            }
+
+            // Released notes are background, and so are held ones that decayed below the quiet level. Notes that are
+            // still starting up are quiet too, but they're about to be heard. Playing a cached one-shot is cheaper
+            // than any sampling mode, so those are left alone
+            bool background = true;
+            bool cached = false;
+            for (const auto* osc : voice->wave_oscs) {
+                const auto stage = static_cast<EnvStage>(osc->vol_env.stage);
+                cached = cached || osc->one_shot != nullptr;
+                if (stage == EnvStage::release || stage == EnvStage::off) {
+                    continue;
+                }
+                if (stage < EnvStage::decay || osc->level_gain * pow(2.0, osc->vol_env.value / 6.0) >= quiet_gain) {
+                    background = false;
+                }
+            }
+            const int steps = cached ? 0 : governor.steps(background);
+            voice->governed_sampling_mode = (steps > 0) ? QualityGovernor::degrade(sampling_mode, steps) : -1;
+            for (auto* osc : voice->wave_oscs) {
+                osc->filter_interval = (steps > 0) ? GOVERNOR_FILTER_INTERVAL : 1;
+            }
+            n_degraded += (steps > 0) ? 1 : 0;
+        }
+        if (n_degraded > 0) {
+            governor.count_degraded_voices(n_degraded);
+        }
+    }
+
+    void Synth::detach_one_shots(Voice* voice) {
+        // The voice is done, so there's nothing to carry on with live
+        for (auto* osc : voice->wave_oscs) {
+            if (osc->one_shot != nullptr) {
+                --osc->one_shot->n_users;
+                osc->one_shot = nullptr;
+            }
+        }
+    }
+
+    int Synth::current_sampling_mode() const {
+        if (offline_rendering && m_state.render_sampling_mode >= 0) {
+            return m_state.render_sampling_mode;
+        }
+        return m_state.sampling_mode;
+    }
+
+    double Synth::silence_gain() const {
+        return pow(10.0, m_state.silence_floor_db / 20.0);
+    }
+}
@@ -0,0 +1,245 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "Scale.h"
+#include "WavetableOscillator.h"
+#include "RenderProfiler.h"
+#include "QualityGovernor.h"
+#include "MemoryStats.h"
+#include "OneShotCache.h"
+#include "HostRateSamples.h"
+#include "HalfRateBus.h"
+#include "OutputRouting.h"
+#include "PresetDirectory.h"
+#include "Trace.h"
+#include "../../SoundfontStudies/SoundfontStudies/soundfont.h"
+
+// Everything the engine needs to know about the plugin settings. This used to live in the GUI value pool,
+// but the editor is only created when it's first shown, so the engine can't rely on it existing.
+struct PluginState {
+    std::wstring soundfont_path = L"C:/Windows/System32/drivers/gm.dls";
+    std::wstring scale_name = L"12-TET";
+    u16 bank = 0;
+    u16 program = 0;
+    double volenv_delay = 0.0;
+    double volenv_attack = 0.0;
+    double volenv_hold = 0.0;
+    double volenv_decay = 0.0;
+    double volenv_sustain = 0.0;
+    double volenv_release = 0.0;
+    int sampling_mode = 2;
+    int render_sampling_mode = -1; // Sampling mode while the host renders to a file, -1 to keep using sampling_mode
+    double silence_floor_db = -90.0; // Released notes quieter than this are stopped early
+    bool deferred_loading = true; // Only load the soundfont once a note is played or the editor is opened
+    bool multitimbral = false; // Play the MIDI input on all 16 channels, each with its own preset
+    bool sample_mipmaps = false; // Read notes pitched up by an octave or more from the filtered lower rate copies of the sample, built in the background
+    bool host_rate_samples = false; // Play copies of the samples resampled to the host's rate, built in the background
+    bool multirate = false; // Render voices with nothing above a fifth of the host rate at half rate, and upsample them together
+    bool adaptive_quality = true; // Render released and quiet voices cheaper while blocks get close to the real-time budget, never while exporting
+    Flan::SharedOutputRouting output_routing; // Which zones go to which output, only used when the host gives us more than one
+
+    [[nodiscard]] u16 preset_key() const { return static_cast<u16>((bank << 8) | (program & 0xFF)); }
+};
+
+namespace Flan {
+    // How long the last soundfont load took per phase, in seconds
+    struct SoundfontLoadTimings {
+        double stop_voices = 0.0;   // Waiting for the render thread and silencing the voices
+        double from_file = 0.0;     // Soundfont::from_file, which does the file I/O, chunk walk, hydra parse, zones and sample conversion
+        double build_mips = 0.0;    // Filtering the lower rate copies of every sample, which happens after the load, see build_sample_mips()
+    };
+
+    // "000:000 - Name", as shown in the preset dropdown menu
+    std::wstring preset_display_name(const PresetEntry& preset);
+
+    // Inverse of VolumeToMIDIVelocity from the FL SDK, for turning MIDI notes into the voice levels FL would give us
+    [[nodiscard]] float midi_velocity_to_volume(u8 velocity);
+
+    // State of one MIDI channel in multitimbral mode
+    struct MidiChannel {
+        u8 bank = 0;                // CC0
+        u8 program = 0;
+        u8 volume = 100;            // CC7
+        u8 pan = 64;                // CC10
+        u8 expression = 127;        // CC11
+        bool sustain = false;       // CC64
+        u16 rpn = 0x3FFF;           // Registered parameter selected with CC101 and CC100, 0x3FFF is none
+        double bend_range = 2.0;    // In semitones, set through RPN 0
+        double pitch_wheel = 0.0;   // In semitones
+    };
+
+    // The sound engine: the soundfont, the voices and the render loop. It doesn't know anything about FL Studio,
+    // Windows or the editor, so the plugin and the offline renderer can both drive it.
+    class Synth {
+    public:
+        // Called from render() for every voice that finished playing in that block, after it was removed from the active voices
+        // and the lock was released, so it's safe to call back into the synth from here
+        using VoiceKilledFunction = std::function<void(Voice*)>;
+
+        Synth(const PluginState& state, const Scale& scale) : m_state(state), m_scale(scale) {
+            m_finished_voices.reserve(256);
+            m_mixing_voices.reserve(256);
+            m_half_rate_voices.reserve(256);
+        }
+        ~Synth();
+
+        void set_sample_rate(double sample_rate);
+        [[nodiscard]] double sample_rate() const { return m_sample_rate; }
+
+        // Pitch wheel offset in semitones, applied to all voices
+        void set_pitch_wheel(const double semitones) { m_pitch_wheel = semitones; }
+
+        // Starts a voice for the currently selected preset. `voice_params` has to stay valid until the voice is killed.
+        // The note starts `offset` frames into the next rendered block, for hosts that know where in the block it falls.
+        // Returns nullptr if the selected preset doesn't exist in the soundfont, which isn't known yet while notes are held.
+        Voice* trigger_voice(const VoiceParams* voice_params, intptr_t voice_tag, int offset = 0);
+
+        // Renders `length` stereo samples, interleaved, into `dest`. Returns false if no voices were playing,
+        // in which case `dest` is simply cleared
+        bool render(float* dest, int length);
+
+        // Same, but with every zone going to the output it's routed to. `outputs` are `n_outputs` interleaved stereo buffers,
+        // zones routed past the last one go to the first one. Returns false if no voices were playing, and clears them all
+        bool render(float* const* outputs, int n_outputs, int length);
+
+        // Renders a single voice, for hosts that mix the voices themselves. Different voices can be rendered in parallel.
+        // Returns false once the voice has finished, it's up to the host to kill it then
+        bool render_voice(Voice* voice, float* dest, int length);
+
+        // Multitimbral mode: a raw MIDI channel message, like FL's MIDIIn gives us. Every channel has its own preset, levels
+        // and pitch wheel, and channel 10 plays the drum kits in bank 128. These voices are owned by the synth, they're
+        // deleted as soon as they finish instead of being handed to on_voice_killed
+        void process_midi(u8 status, u8 data1, u8 data2, int offset = 0);
+
+        // Stops the MIDI notes and puts every channel back to its defaults
+        void reset_midi_channels();
+
+        void stop_all_voices();
+
+        // Until the next load_soundfont(), new notes wait for it instead of playing the soundfont that's about to be replaced.
+        // They start as soon as it's loaded, and the ones it doesn't have a preset for are killed like any finished voice
+        void hold_notes();
+
+        // Removes the voice if it's still playing, and deletes it
+        void kill_voice(Voice* voice);
+        void load_soundfont(const std::string& path);
+
+        // Moves the soundfont's presets into the preset directory. load_soundfont() does this, call it after filling them in by hand
+        void index_presets();
+        [[nodiscard]] const SoundfontLoadTimings& load_timings() const { return m_load_timings; }
+
+        // Resamples every sample to the current sample rate, so notes played at their root key don't need interpolating.
+        // Slow, call it from a background thread. Notes started after it's done use them. Does nothing if they're
+        // already at this rate, and gives up if the sample rate or soundfont changed in the meantime
+        void build_host_rate_samples();
+
+        // Stops the notes that are playing the resampled samples, and throws them away
+        void clear_host_rate_samples();
+
+        // Filters the lower rate copies of every sample, for notes pitched up by an octave or more. Slow, call it from the
+        // thread that loads the soundfont, after loading it. Notes started after it's done use them. Does nothing if
+        // they're off or already built, and gives up if the soundfont changed in the meantime
+        void build_sample_mips();
+
+        // Throws the mips away, the notes that are reading them carry on with the full rate samples
+        void clear_sample_mips();
+
+        // Renders the one-shots render() asked for, so the next notes that play them can copy the frames. Slow, call it
+        // from the thread that loads the soundfont whenever one_shots_pending() says there's something to do
+        void render_one_shots();
+        [[nodiscard]] bool one_shots_pending() const { return m_one_shots.pending(); }
+
+        // The sampling mode blocks are rendered with right now, which is the render sampling mode while the host exports
+        [[nodiscard]] int current_sampling_mode() const;
+
+        // Fills in the sample pool, table and voice parts of `stats`. The soundfont is only walked once per load, this
+        // holds the lock shared while it measures the voices and caches, and the residency lookup happens after that
+        void measure_memory(MemoryStats& stats);
+
+        // preset_display_name() of every preset in directory order, so a row is also the preset's index in the directory.
+        // They're built once per load, the editor can copy them without holding the lock. nullptr until a soundfont is loaded
+        [[nodiscard]] std::shared_ptr<const std::vector<std::wstring>> preset_names();
+
+        Soundfont soundfont;            // The samples. Its presets are moved into `presets` once it's loaded
+        PresetDirectory presets;
+        std::vector<Voice*> active_voices;
+        std::shared_mutex note_playing_mutex;  // Shared while rendering single voices, exclusive for everything else
+        RenderProfiler profiler;
+        QualityGovernor governor;       // Only render() is governed, the per-voice rendering of hybrid generators is up to the host
+        VoiceKilledFunction on_voice_killed;
+        int trace_instance = 0;         // Which process this synth's events show up under in a trace
+        bool host_applies_levels = false;   // Leave the voice volume and panning to the host, it does that when it mixes the voices
+        std::atomic<bool> offline_rendering = false;    // The host is rendering to a file, not playing live
+
+    private:
+        Voice* start_voice(const VoiceParams* voice_params, intptr_t voice_tag, u16 preset_key, int midi_channel, int offset);
+
+        // Gives the voice an oscillator for every zone of the preset its key and velocity fall in
+        void start_oscillators(Voice* voice, const PresetEntry& preset);
+        void start_waiting_voices();
+        void mix_frames(float* const* outputs, int n_outputs, int begin, int end, int sampling_mode, double silence_gain);
+
+        // Renders the half rate voices far enough ahead, and adds the upsampled bus to `dest` for block frames `begin` up to `end`
+        void mix_half_rate(float* dest, int begin, int end, int sampling_mode, double silence_gain);
+
+        // Switches a new voice to half rate if all of its oscillators fit, before its first frame
+        void try_half_rate(Voice* voice) const;
+
+        // Puts a half rate voice on the bus, on the first half rate frame from host frame `frame`
+        static void start_half_rate(Voice* voice, int64_t frame);
+
+        // Whether a half rate voice still fits after its levels changed, and switches it back to the full rate if it doesn't
+        [[nodiscard]] bool still_fits_half_rate(const Voice* voice) const;
+        static void leave_half_rate(Voice* voice);
+
+        // Renders a voice that went back to the full rate up to host frame `end`, onto the bus like the half rate ones
+        void render_full_rate_ahead(Voice* voice, int64_t end, int sampling_mode, double silence_gain);
+        void midi_note_on(int channel, u8 key, u8 velocity, int offset);
+        void midi_note_off(int channel, u8 key, int offset);
+        void midi_control_change(int channel, u8 controller, u8 value, int offset);
+        void apply_channel_levels(int channel);
+        [[nodiscard]] u16 midi_preset_key(int channel) const;
+        [[nodiscard]] u16 playable_midi_preset(u16 preset_key, int channel) const;
+        [[nodiscard]] double pitch_wheel_for(const Voice* voice) const;
+        void silence_voices() const;
+
+        // Measures the soundfont for measure_memory() and names its presets for preset_names(), whenever it's been replaced
+        void snapshot_soundfont();
+
+        // Picks every voice's sampling mode and filter interval for this block, from the governor's level
+        void govern_voices(int sampling_mode);
+
+        // Stops the voice's oscillators from playing cached one-shots, so the cache can let go of them
+        static void detach_one_shots(Voice* voice);
+        [[nodiscard]] double silence_gain() const;
+
+        const PluginState& m_state;
+        const Scale& m_scale;
+        double m_pitch_wheel = 0.0;
+        double m_sample_rate = 1.0;
+        double m_sample_rate_inv = 1.0;
+        SoundfontLoadTimings m_load_timings;
+        std::vector<Voice*> m_finished_voices;  // Voices retired in the current block, kept around so it doesn't allocate
+        std::vector<Voice*> m_mixing_voices;    // Voices that have started by the current part of the block, same
+        std::vector<Voice*> m_half_rate_voices; // Same, for the ones that render at half rate
+        HalfRateBus m_half_rate_bus;
+        BufferSample m_half_rate_frames[MULTIRATE_CHUNK];   // What one voice renders for a chunk, before it goes on the bus
+        BufferSample m_full_rate_frames[MULTIRATE_CHUNK * 2];   // Same, for the voices that went back to the full rate
+        int64_t m_frame = 0;                    // Host frames rendered since the synth started, where the block starts
+        MidiChannel m_channels[16];
+        OneShotCache m_one_shots;
+        std::shared_ptr<const SampleMipTable> m_sample_mips;   // nullptr until build_sample_mips() is done. Shared with render_one_shots()
+        std::shared_ptr<const MemoryStats> m_soundfont_stats;  // Only the soundfont part is filled in, nullptr until one is loaded
+        std::shared_ptr<const std::vector<std::wstring>> m_preset_names;
+        std::shared_ptr<const HostRateSampleTable> m_host_rate_samples;  // Swapped in once it's built, nullptr until then. Shared with render_one_shots()
+        uint64_t m_soundfont_loads = 0;         // Counts soundfont loads, so a build that raced one can tell
+        bool m_holding_notes = false;           // See hold_notes()
+        intptr_t m_next_midi_voice_tag = -1;    // Counts down, so they never clash with the host's voice tags in a trace
+    };
+}
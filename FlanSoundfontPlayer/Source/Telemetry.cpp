@@ -0,0 +1,42 @@
+#include "Telemetry.h"
+#include <cwchar>
+
+namespace Flan {
+    void format_telemetry_event(const TelemetryEvent& event, const int64_t now, wchar_t* buffer, const size_t buffer_size) {
+        const std::chrono::duration<double> age = std::chrono::steady_clock::duration(now - event.time);
+        const float* final_levels = &event.levels[5];
+
+        switch (event.type) {
+        case TelemetryEventType::note_on:
+            swprintf(buffer, buffer_size, L"[-%.2fs] Note on (tag %lld): vel %.2f, vol %.2f, pan %+.2f, pitch %+.0f, cut %.2f, res %.2f",
+                age.count(), static_cast<long long>(event.voice_tag), event.levels[1],
+                final_levels[1], final_levels[0], final_levels[2], final_levels[3], final_levels[4]);
+            break;
+        case TelemetryEventType::tempo:
+            swprintf(buffer, buffer_size, L"[-%.2fs] Tempo changed to %f", age.count(), event.levels[0]);
+            break;
+        case TelemetryEventType::max_poly:
+            swprintf(buffer, buffer_size, L"[-%.2fs] Max polyphony changed to %i", age.count(), event.int_value);
+            break;
+        case TelemetryEventType::midi_pan:
+            swprintf(buffer, buffer_size, L"[-%.2fs] MIDI Pan changed to %i", age.count(), event.int_value);
+            break;
+        case TelemetryEventType::midi_vol:
+            swprintf(buffer, buffer_size, L"[-%.2fs] MIDI Vol changed to %i", age.count(), event.int_value);
+            break;
+        case TelemetryEventType::midi_pitch:
+            swprintf(buffer, buffer_size, L"[-%.2fs] MIDI Pitch changed to %i", age.count(), event.int_value);
+            break;
+        case TelemetryEventType::soundfont_loaded:
+            swprintf(buffer, buffer_size, L"[-%.2fs] Loaded %i presets: stopping voices %.1f ms, from_file %.1f ms, mips %.1f ms",
+                age.count(), event.int_value, event.levels[0], event.levels[1], event.levels[2]);
+            break;
+        case TelemetryEventType::preset_list_built:
+            swprintf(buffer, buffer_size, L"[-%.2fs] Built preset list of %i presets in %.1f ms", age.count(), event.int_value, event.levels[0]);
+            break;
+        case TelemetryEventType::quality_level:
+            swprintf(buffer, buffer_size, L"[-%.2fs] Quality level changed to %i, block took %.0f%% of the budget", age.count(), event.int_value, event.levels[0]);
+            break;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace Flan {
+    enum class TelemetryEventType : uint8_t {
+        note_on,
+        tempo,
+        max_poly,
+        midi_pan,
+        midi_vol,
+        midi_pitch,
+        soundfont_loaded,
+        preset_list_built,
+        quality_level,
+    };
+
+    // One event in binary form. The audio thread writes these as-is, they only get turned into text when the editor shows them
+    struct TelemetryEvent {
+        TelemetryEventType type = TelemetryEventType::note_on;
+        int64_t time = 0;           // steady_clock ticks, filled in by TelemetryRing::push
+        intptr_t voice_tag = 0;     // note_on only
+        int int_value = 0;          // max_poly, midi_pan, midi_vol, midi_pitch. soundfont_loaded, preset_list_built: number of presets
+                                    // quality_level: the governor's new level
+        float levels[10]{};         // note_on: InitLevels then FinalLevels as pan, vol, pitch, fcut, fres. tempo: bpm in levels[0]
+                                    // soundfont_loaded: milliseconds spent stopping voices, in from_file, then building mips. preset_list_built: milliseconds
+                                    // quality_level: cost of the block that made it change, in percent of the budget
+    };
+
+    // Fixed-size, lock-free ring of telemetry events. Any thread can push without allocating, formatting or blocking,
+    // and once it's full the oldest events get overwritten. Every slot has a sequence number that's odd while it's being
+    // written, so readers can copy events out and simply skip the ones that changed under their feet.
+    template <size_t capacity>
+    class TelemetryRing {
+    public:
+        void push(TelemetryEvent event) {
+            event.time = std::chrono::steady_clock::now().time_since_epoch().count();
+            const uint64_t index = m_write_index.fetch_add(1, std::memory_order_relaxed);
+            Slot& slot = m_slots[index % capacity];
+            slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.event = event;
+            slot.sequence.store(index * 2 + 2, std::memory_order_release);
+        }
+
+        // Total number of events pushed so far, so readers can tell whether there's anything new
+        [[nodiscard]] uint64_t count() const {
+            return m_write_index.load(std::memory_order_acquire);
+        }
+
+        // Copies up to `max_count` of the most recent events into `out`, newest first, and returns how many were copied
+        size_t read_latest(TelemetryEvent* out, const size_t max_count) const {
+            const uint64_t end = count();
+            const uint64_t n_available = std::min<uint64_t>(end, capacity);
+            size_t n_read = 0;
+            for (uint64_t i = 0; i < n_available && n_read < max_count; ++i) {
+                const uint64_t index = end - 1 - i;
+                const Slot& slot = m_slots[index % capacity];
+
+                // Skip slots that are still being written to, or that have been overwritten already
+                const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+                if (sequence != index * 2 + 2) {
+                    continue;
+                }
+                out[n_read] = slot.event;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+                    continue;
+                }
+                ++n_read;
+            }
+            return n_read;
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint64_t> sequence = 0;
+            TelemetryEvent event{};
+        };
+        Slot m_slots[capacity];
+        std::atomic<uint64_t> m_write_index = 0;
+    };
+
+    // Turns an event into a single line of text, with its age relative to `now` (steady_clock ticks)
+    void format_telemetry_event(const TelemetryEvent& event, int64_t now, wchar_t* buffer, size_t buffer_size);
+}
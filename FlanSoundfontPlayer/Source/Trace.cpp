@@ -0,0 +1,189 @@
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace Flan {
+    namespace {
+        struct ThreadBuffer {
+            TraceEvent events[TRACE_BUFFER_CAPACITY];
+            std::atomic<size_t> count = 0;      // Events before this are complete, only the owning thread writes it
+            std::atomic<bool> in_use = false;   // Whether a thread owns this buffer, buffers of threads that exited get reused
+            std::atomic<unsigned> session = 0;  // Trace the events belong to, so the owner knows when to start over
+            std::atomic<size_t> n_dropped = 0;
+            std::atomic<const char*> thread_name = nullptr;
+            int thread_id = 0;
+        };
+
+        // Buffers for every thread that can record, allocated by the first trace_start(). They're never freed, threads that
+        // exit hand theirs back for the next thread to use
+        std::mutex buffers_mutex;
+        std::atomic<ThreadBuffer*> buffers[TRACE_MAX_THREADS]{};
+        std::atomic<unsigned> current_session = 0;
+        std::atomic<size_t> n_dropped_threads = 0;  // Events of threads that didn't get a buffer, in the current trace
+        int64_t session_start = 0;
+
+        // Only ever called while tracing, so the buffers exist. Returns nullptr if every one of them is taken
+        ThreadBuffer* acquire_buffer() {
+            for (auto& slot : buffers) {
+                ThreadBuffer* buffer = slot.load(std::memory_order_acquire);
+                bool expected = false;
+                if (buffer != nullptr && buffer->in_use.compare_exchange_strong(expected, true)) {
+                    buffer->count.store(0, std::memory_order_relaxed);
+                    buffer->session.store(current_session.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    buffer->n_dropped.store(0, std::memory_order_relaxed);
+                    buffer->thread_name.store(nullptr, std::memory_order_relaxed);
+                    return buffer;
+                }
+            }
+            return nullptr;
+        }
+
+        // Gives the buffer back when the thread exits
+        struct ThreadBufferOwner {
+            ThreadBuffer* buffer = nullptr;
+            const char* name = nullptr;
+
+            ~ThreadBufferOwner() {
+                if (buffer != nullptr) {
+                    buffer->in_use.store(false, std::memory_order_release);
+                }
+            }
+        };
+        thread_local ThreadBufferOwner thread_buffer;
+
+        // Chrome traces are in microseconds
+        double to_microseconds(const int64_t ticks) {
+            using Ticks = std::chrono::steady_clock::duration;
+            return std::chrono::duration<double, std::micro>(Ticks(ticks)).count();
+        }
+    }
+
+    namespace trace_internal {
+        void record(const TraceEvent& event) {
+            if (thread_buffer.buffer == nullptr) {
+                thread_buffer.buffer = acquire_buffer();
+                if (thread_buffer.buffer == nullptr) {
+                    n_dropped_threads.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            ThreadBuffer& buffer = *thread_buffer.buffer;
+            buffer.thread_name.store(thread_buffer.name, std::memory_order_relaxed);
+
+            // A new trace was started since this thread last recorded something
+            const unsigned session = current_session.load(std::memory_order_acquire);
+            if (buffer.session.load(std::memory_order_relaxed) != session) {
+                buffer.session.store(session, std::memory_order_relaxed);
+                buffer.count.store(0, std::memory_order_relaxed);
+                buffer.n_dropped.store(0, std::memory_order_relaxed);
+            }
+
+            const size_t index = buffer.count.load(std::memory_order_relaxed);
+            if (index >= TRACE_BUFFER_CAPACITY) {
+                buffer.n_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            buffer.events[index] = event;
+            buffer.count.store(index + 1, std::memory_order_release);
+        }
+    }
+
+    void trace_start() {
+        std::lock_guard guard(buffers_mutex);
+        for (int i = 0; i < TRACE_MAX_THREADS; ++i) {
+            if (buffers[i].load(std::memory_order_relaxed) == nullptr) {
+                auto* buffer = new ThreadBuffer();
+                buffer->thread_id = i + 1;
+                buffers[i].store(buffer, std::memory_order_release);
+            }
+        }
+        n_dropped_threads.store(0, std::memory_order_relaxed);
+        session_start = trace_now();
+        current_session.fetch_add(1, std::memory_order_release);
+        trace_internal::enabled.store(true, std::memory_order_release);
+    }
+
+    namespace {
+        // Has to be called with buffers_mutex held, which keeps a new trace from starting while we read the buffers
+        bool write_trace(FILE* file) {
+            if (file == nullptr) {
+                return false;
+            }
+            fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+            bool first = true;
+            const unsigned session = current_session.load(std::memory_order_relaxed);
+            for (const auto& slot : buffers) {
+                // Buffers that weren't used during this trace still hold events from an older one
+                const ThreadBuffer* buffer = slot.load(std::memory_order_acquire);
+                if (buffer == nullptr || buffer->session.load(std::memory_order_relaxed) != session) {
+                    continue;
+                }
+                const size_t count = buffer->count.load(std::memory_order_acquire);
+                for (size_t i = 0; i < count; ++i) {
+                    const TraceEvent& event = buffer->events[i];
+                    const double start = to_microseconds(event.start - session_start);
+                    if (event.duration < 0) {
+                        fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %i, \"tid\": %i, \"args\": {\"value\": %lld}}",
+                            first ? "" : ",\n", event.name, start, event.instance, buffer->thread_id, static_cast<long long>(event.value));
+                    }
+                    else {
+                        fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %i, \"tid\": %i, \"args\": {\"value\": %lld}}",
+                            first ? "" : ",\n", event.name, start, to_microseconds(event.duration), event.instance, buffer->thread_id,
+                            static_cast<long long>(event.value));
+                    }
+                    first = false;
+                }
+
+                // Thread names are per process in the trace viewer, so name the thread in every instance it recorded for
+                const char* thread_name = buffer->thread_name.load(std::memory_order_relaxed);
+                if (count > 0 && thread_name != nullptr) {
+                    std::vector<int> instances;
+                    for (size_t i = 0; i < count; ++i) {
+                        if (std::find(instances.begin(), instances.end(), buffer->events[i].instance) == instances.end()) {
+                            instances.push_back(buffer->events[i].instance);
+                        }
+                    }
+                    for (const int instance : instances) {
+                        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %i, \"tid\": %i, \"args\": {\"name\": \"%s\"}}",
+                            instance, buffer->thread_id, thread_name);
+                    }
+                }
+
+                // Let whoever reads the trace know it's incomplete
+                const size_t n_dropped = buffer->n_dropped.load(std::memory_order_relaxed);
+                if (n_dropped > 0) {
+                    fprintf(file, "%s{\"name\": \"trace buffer full\", \"ph\": \"i\", \"s\": \"g\", \"ts\": %.3f, \"pid\": 0, \"tid\": %i, \"args\": {\"dropped\": %zu}}",
+                        first ? "" : ",\n", count > 0 ? to_microseconds(buffer->events[count - 1].start - session_start) : 0.0, buffer->thread_id, n_dropped);
+                    first = false;
+                }
+            }
+            if (n_dropped_threads.load(std::memory_order_relaxed) > 0) {
+                fprintf(file, "%s{\"name\": \"too many threads to trace\", \"ph\": \"i\", \"s\": \"g\", \"ts\": 0.0, \"pid\": 0, \"tid\": 0, \"args\": {\"dropped\": %zu}}",
+                    first ? "" : ",\n", n_dropped_threads.load(std::memory_order_relaxed));
+            }
+            fprintf(file, "\n]}\n");
+            fclose(file);
+            return true;
+        }
+    }
+
+    bool trace_stop(const std::string& path) {
+        trace_internal::enabled.store(false, std::memory_order_release);
+        std::lock_guard guard(buffers_mutex);
+        return write_trace(fopen(path.c_str(), "w"));
+    }
+
+#ifdef _WIN32
+    bool trace_stop(const std::wstring& path) {
+        trace_internal::enabled.store(false, std::memory_order_release);
+        std::lock_guard guard(buffers_mutex);
+        return write_trace(_wfopen(path.c_str(), L"w"));
+    }
+#endif
+
+    void trace_thread_name(const char* name) {
+        thread_buffer.name = name;
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// How many events every thread can record per trace. Once a thread's buffer is full, its newer events are dropped
+#define TRACE_BUFFER_CAPACITY 65536
+
+// How many threads can record at the same time. Their buffers are allocated when the first trace starts, the events of
+// any threads past this are dropped
+#define TRACE_MAX_THREADS 16
+
+namespace Flan {
+    // Timeline of what the engine was doing, written as a Chrome trace JSON file that chrome://tracing and Perfetto can open.
+    // Every thread records into its own fixed-size buffer, which trace_start() allocated, so recording an event never locks
+    // or allocates. When tracing is off, recording is a single atomic load.
+    // Event names have to be string literals, since only the pointer is stored.
+    struct TraceEvent {
+        const char* name = nullptr;
+        int64_t start = 0;          // steady_clock ticks
+        int64_t duration = -1;      // steady_clock ticks, -1 for instant events
+        int64_t value = 0;          // Shown as the event's argument
+        int instance = 0;           // Plugin instance, shows up as the process in the trace viewer
+    };
+
+    namespace trace_internal {
+        inline std::atomic<bool> enabled = false;
+        void record(const TraceEvent& event);
+    }
+
+    [[nodiscard]] inline bool trace_enabled() {
+        return trace_internal::enabled.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] inline int64_t trace_now() {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    // Starts a new trace, throwing away whatever was recorded before
+    void trace_start();
+
+    // Stops tracing and writes everything that was recorded to `path`. Returns false if the file couldn't be written
+    bool trace_stop(const std::string& path);
+#ifdef _WIN32
+    // Same, for the paths Windows gives us
+    bool trace_stop(const std::wstring& path);
+#endif
+
+    // Name for the current thread in the trace viewer, also a string literal
+    void trace_thread_name(const char* name);
+
+    // Something that happened at one point in time
+    inline void trace_instant(const char* name, const int instance, const int64_t value = 0) {
+        if (trace_enabled()) {
+            trace_internal::record({ name, trace_now(), -1, value, instance });
+        }
+    }
+
+    // A span that was timed some other way, `start` and `end` in steady_clock ticks
+    inline void trace_span(const char* name, const int instance, const int64_t start, const int64_t end, const int64_t value = 0) {
+        if (trace_enabled()) {
+            trace_internal::record({ name, start, end - start, value, instance });
+        }
+    }
+
+    // Records the time between its construction and destruction as a span
+    class TraceScope {
+    public:
+        TraceScope(const char* name, const int instance, const int64_t value = 0) {
+            if (trace_enabled()) {
+                m_event = { name, trace_now(), 0, value, instance };
+            }
+        }
+
+        ~TraceScope() {
+            if (m_event.name != nullptr && trace_enabled()) {
+                m_event.duration = trace_now() - m_event.start;
+                trace_internal::record(m_event);
+            }
+        }
+
+        // For values that are only known at the end, like how many voices are left after a render
+        void set_value(const int64_t value) { m_event.value = value; }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        TraceEvent m_event;
+    };
+}
@@ -1,8 +1,34 @@
 #include "WavetableOscillator.h"
+#include "OneShotCache.h"
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 
 namespace Flan {
-    BufferSample WavetableOscillator::get_sample(const double time_per_sample, const double pitch_wheel, const int filter_mode) {
+    void init_bell_curve() {
+        // Credit to https://problemkaputt.de/fullsnes.htm#snesaudioprocessingunitapu for providing the gauss table that is approximated below
+        // Formula was made through trial and error in geogebra
+        for (int ix = 0; ix < 512; ix++) {
+            const float x_270 = static_cast<float>(ix) / 270.f;
+            const float x_512 = static_cast<float>(ix) / 512.f;
+            const float result = powf(2.718281828f, -x_270 * x_270) * 1305.f * powf((1 - (x_512 * x_512)), 1.4f);
+            bell_curve[ix] = result / 2039.f; // magic number to make the volume similar to the other filtering modes
+        }
+    }
+
+    void WavetableOscillator::update_levels(const VoiceLevels& levels, const double pitch_wheel) {
+        channel_volume = static_cast<double>(levels.vol);
+        channel_panning = static_cast<double>(levels.pan);
+        channel_pitch = static_cast<double>(levels.pitch) - initial_channel_pitch;
+
+        zone_gain = pow(2.0, static_cast<double>(-preset_zone.init_attenuation) / 15.0);
+        level_gain = channel_volume * zone_gain;
+        level_gain_l = level_gain * ((-(channel_panning) + 1.0) / 2.0) * ((-static_cast<double>(preset_zone.pan) + 1.0) / 2.0);
+        level_gain_r = level_gain * ((+(channel_panning) + 1.0) / 2.0) * ((+static_cast<double>(preset_zone.pan) + 1.0) / 2.0);
+        level_pitch_mul = pow(2.0, (pitch_wheel / 12.0) + (channel_pitch / 1200.0));
+    }
+
+    BufferSample WavetableOscillator::get_sample(const double time_per_sample, const int filter_mode, const double silence_gain) {
         // Immediately skip inactive stage
         if (static_cast<EnvStage>(vol_env.stage) == off) {
             if (midi_key != 255) {
@@ -11,10 +37,9 @@ namespace Flan {
             return { static_cast<sample_t>(0.0f), static_cast<sample_t>(0.0f) };
         }
 
-        // Update note parameters
-        channel_volume = static_cast<double>(voice_params->FinalLevels.Vol);
-        channel_panning = static_cast<double>(voice_params->FinalLevels.Pan);
-        channel_pitch = static_cast<double>(voice_params->FinalLevels.Pitch) - initial_channel_pitch;
+        if (one_shot != nullptr) {
+            return get_one_shot_sample(time_per_sample, filter_mode, silence_gain);
+        }
 
         // Update envelopes
         vol_env.update(preset_zone.vol_env, time_per_sample, true);
@@ -24,13 +49,15 @@ namespace Flan {
         vib_lfo.update(preset_zone.vib_lfo, time_per_sample);
         mod_lfo.update(preset_zone.mod_lfo, time_per_sample);
 
-        // Handle sample progression
-        const double pitch_wheel_contrib = (pitch_wheel / 12.0);
-        const double channel_pitch_contrib = (channel_pitch / 1200.0);
-        const double mod_env_contrib = (((100.0 + mod_env.value) * static_cast<double>(preset_zone.mod_env_to_pitch)) / (1200.0 * 100.0));
-        const double mod_lfo_contrib = ((mod_lfo.state * static_cast<double>(preset_zone.mod_lfo_to_pitch)) / (1200.0));
-        const double vib_lfo_contrib = ((vib_lfo.state * static_cast<double>(preset_zone.vib_lfo_to_pitch)) / (1200.0));
-        sample_position += sample_delta * pow(2.0, pitch_wheel_contrib + channel_pitch_contrib +  mod_env_contrib + mod_lfo_contrib + vib_lfo_contrib);
+        // Handle sample progression, the pitch wheel and channel pitch are already in level_pitch_mul
+        double pitch_mul = level_pitch_mul;
+        if (preset_zone.mod_env_to_pitch != 0.0f || preset_zone.mod_lfo_to_pitch != 0.0f || preset_zone.vib_lfo_to_pitch != 0.0f) {
+            const double mod_env_contrib = (((100.0 + mod_env.value) * static_cast<double>(preset_zone.mod_env_to_pitch)) / (1200.0 * 100.0));
+            const double mod_lfo_contrib = ((mod_lfo.state * static_cast<double>(preset_zone.mod_lfo_to_pitch)) / (1200.0));
+            const double vib_lfo_contrib = ((vib_lfo.state * static_cast<double>(preset_zone.vib_lfo_to_pitch)) / (1200.0));
+            pitch_mul *= pow(2.0, mod_env_contrib + mod_lfo_contrib + vib_lfo_contrib);
+        }
+        sample_position += sample_delta * pitch_mul;
 
         // Handle offsets
         const u32 sample_start = preset_zone.sample_start_offset;
@@ -53,31 +80,53 @@ namespace Flan {
 
         // After a lot of headaches and comparing with a bunch of different SoundFont tools like Viena, FluidSynth, and
         // Fruity Soundfont Player, these are the dB to linear conversion magic numbers I've found.
-        const double corrected_adsr_volume = pow(2.0, (vol_env.value - (mod_lfo.state * static_cast<double>(preset_zone.mod_lfo_to_volume))) / 6.0)
-                                    * pow(2.0, static_cast<double>(-preset_zone.init_attenuation) / 15.0);
+        // The initial attenuation is in the level gains, see update_levels
+        const double corrected_adsr_volume = pow(2.0, (vol_env.value - (mod_lfo.state * static_cast<double>(preset_zone.mod_lfo_to_volume))) / 6.0);
 
-        // Calculate stereo volume factors, and calculate the center index
-        const double mul_base = corrected_adsr_volume * channel_volume;
-        const float mul_l = static_cast<float>(mul_base * ((-(channel_panning) + 1.0) / 2.0) * ((-static_cast<double>(preset_zone.pan) + 1.0) / 2.0));
-        const float mul_r = static_cast<float>(mul_base * ((+(channel_panning) + 1.0) / 2.0) * ((+static_cast<double>(preset_zone.pan) + 1.0) / 2.0));
-        const int index = static_cast<int>(sample_position) + static_cast<int>(sample_start);
+        // Released notes that faded below the silence floor get stopped at the end of the block, see end_block(). The
+        // channel volume is left out, the host can bring that back up
+        ++block_frames;
+        if (static_cast<EnvStage>(vol_env.stage) == release && corrected_adsr_volume * zone_gain < silence_gain) {
+            ++quiet_frames;
+        }
+
+        // Pitched up by an octave or more, read from the mip level that brings the step back below 2 frames
+        int mip = 0;
+        double read_position = sample_position;
+        int index;
+        if (mips != nullptr && sample_delta * pitch_mul >= 2.0) {
+            for (double step = sample_delta * pitch_mul; step >= 2.0 && mip < SAMPLE_MIP_LEVELS; step *= 0.5) {
+                ++mip;
+            }
+            read_position = ldexp(sample_position + static_cast<double>(sample_start), -mip);
+            index = static_cast<int>(read_position);
+            read_position -= static_cast<double>(sample_start >> mip);
+        }
+        else {
+            index = static_cast<int>(sample_position) + static_cast<int>(sample_start);
+        }
+
+        // Calculate stereo volume factors
+        const float mul_l = static_cast<float>(corrected_adsr_volume * level_gain_l);
+        const float mul_r = static_cast<float>(corrected_adsr_volume * level_gain_r);
 
         float sample_data = 0;
         float sample_link = 0;
-        // Point sampling (1-tap)
-        if (filter_mode == 0) {
-            sample_data = sample_from_index(index, false);
-            if (sample.type != monoSample) sample_link = sample_from_index(index, true);
+        // Point sampling (1-tap), and right on a frame, like every frame of a note played at the root key of a sample at
+        // the host rate. Linear and sinc would only give that frame back, the gaussian filter blurs even those
+        if (filter_mode == 0 || (filter_mode != 2 && read_position == floor(read_position))) {
+            sample_data = sample_from_index(index, false, mip);
+            if (sample.type != monoSample) sample_link = sample_from_index(index, true, mip);
         }
         // Linear filtering (2-tap)
         else if (filter_mode == 1) {
-            const float t = fmod(static_cast<float>(sample_position), 1.0f);
-            const float sample_data1 = sample_from_index(index, false);
-            const float sample_data2 = sample_from_index(index + 1, false);
+            const float t = fmod(static_cast<float>(read_position), 1.0f);
+            const float sample_data1 = sample_from_index(index, false, mip);
+            const float sample_data2 = sample_from_index(index + 1, false, mip);
             sample_data = lerp(sample_data1, sample_data2, t);
             if (sample.type != monoSample) {
-                const float sample_link1 = sample_from_index(index, true);
-                const float sample_link2 = sample_from_index(index + 1, true);
+                const float sample_link1 = sample_from_index(index, true, mip);
+                const float sample_link2 = sample_from_index(index + 1, true, mip);
                 sample_link = lerp(sample_link1, sample_link2, t);
             }
         }
@@ -88,13 +137,18 @@ namespace Flan {
                 const int sample_index = index + i;
 
                 // Get distance from sample_position
-                const double distance = abs(sample_position - static_cast<double>(sample_index));
+                const double distance = abs(read_position - static_cast<double>(sample_index));
 
                 // Index bell curve
-                sample_data += sample_from_index(sample_index, false) * bell_curve[static_cast<int>(distance * 256) % 512];
-                if (sample.type != monoSample) sample_link += sample_from_index(sample_index, false) * bell_curve[static_cast<int>(distance * 256) % 512];
+                sample_data += sample_from_index(sample_index, false, mip) * bell_curve[static_cast<int>(distance * 256) % 512];
+                if (sample.type != monoSample) sample_link += sample_from_index(sample_index, false, mip) * bell_curve[static_cast<int>(distance * 256) % 512];
             }
         }
+        // Windowed sinc (8, 16 or 32-tap)
+        else if (const SincTable* table = sinc_table_for_mode(filter_mode)) {
+            sample_data = sinc_from_index(*table, index, read_position, false, mip);
+            if (sample.type != monoSample) sample_link = sinc_from_index(*table, index, read_position, true, mip);
+        }
 
 
         float sample_l, sample_r;
@@ -114,22 +168,173 @@ namespace Flan {
             break;
         }
 
-        // Handle filter
+        // Handle filter, the cutoff holds in between updates when the filter interval is raised
         {
-            const double n_mod_env_contrib = (100 + std::clamp(mod_env.value, -100.0, 0.0)) * static_cast<double>(preset_zone.mod_env_to_filter) / 120000.0;
-            const double n_mod_lfo_contrib = mod_lfo.state * static_cast<double>(preset_zone.mod_lfo_to_filter) / 1200.0;
-            filter.cutoff = preset_zone.filter.cutoff * static_cast<float>(pow(2.0, n_mod_env_contrib + n_mod_lfo_contrib));
+            if (filter_countdown == 0) {
+                const double n_mod_env_contrib = (100 + std::clamp(mod_env.value, -100.0, 0.0)) * static_cast<double>(preset_zone.mod_env_to_filter) / 120000.0;
+                const double n_mod_lfo_contrib = mod_lfo.state * static_cast<double>(preset_zone.mod_lfo_to_filter) / 1200.0;
+                filter.cutoff = preset_zone.filter.cutoff * static_cast<float>(pow(2.0, n_mod_env_contrib + n_mod_lfo_contrib));
+                filter_countdown = filter_interval;
+            }
+            --filter_countdown;
             filter.update(time_per_sample, sample_l, sample_r);
         }
 
         return { static_cast<sample_t>(sample_l), static_cast<sample_t>(sample_r) };
     }
 
-    float WavetableOscillator::sample_from_index(int index, bool is_linked_sample) const {
+    BufferSample WavetableOscillator::get_one_shot_sample(const double time_per_sample, const int filter_mode, const double silence_gain) {
+        // The render holds the note at the pitch it started with. Volume, panning and the release are a gain on top of
+        // what was rendered, unless that was silent on a side
+        const WavetableOscillator& key = one_shot->key;
+        const bool same_gain = level_gain_l == key.level_gain_l && level_gain_r == key.level_gain_r;
+        if (level_pitch_mul != key.level_pitch_mul || filter_mode != one_shot->sampling_mode
+            || (!same_gain && (key.level_gain_l == 0.0 || key.level_gain_r == 0.0))) {
+            leave_one_shot();
+            return get_sample(time_per_sample, filter_mode, silence_gain);
+        }
+
+        if (one_shot_position >= one_shot->frames.size()) {
+            vol_env.stage = static_cast<double>(off);
+            return { static_cast<sample_t>(0.0f), static_cast<sample_t>(0.0f) };
+        }
+
+        // Released notes carry on from where the render's envelope is, same as the live envelope would
+        if (static_cast<EnvStage>(vol_env.stage) == release && !one_shot_released) {
+            vol_env = one_shot_env;
+            vol_env.stage = static_cast<double>(release);
+            one_shot_released = true;
+        }
+        one_shot_env.update(preset_zone.vol_env, time_per_sample, true);
+        const BufferSample frame = one_shot->frames[one_shot_position++];
+        ++block_frames;
+        double gain_l = same_gain ? 1.0 : level_gain_l / key.level_gain_l;
+        double gain_r = same_gain ? 1.0 : level_gain_r / key.level_gain_r;
+        if (one_shot_released) {
+            vol_env.update(preset_zone.vol_env, time_per_sample, true);
+
+            // Same early stop as a live release, without the modulation LFO's share of the volume
+            const double release_gain = pow(2.0, (vol_env.value - one_shot_env.value) / 6.0);
+            if (pow(2.0, vol_env.value / 6.0) * zone_gain < silence_gain) {
+                ++quiet_frames;
+            }
+            gain_l *= release_gain;
+            gain_r *= release_gain;
+        }
+        else if (same_gain) {
+            return frame;
+        }
+        return {
+            static_cast<sample_t>(frame.left * gain_l),
+            static_cast<sample_t>(frame.right * gain_r),
+        };
+    }
+
+    float WavetableOscillator::mip_from_index(int index, const bool is_linked_sample, const int mip) const {
+        // Same as the sample itself, with the loop points in the level's frames
+        const u32 loop_start = (sample.loop_start + preset_zone.sample_loop_start_offset) >> mip;
+        const u32 loop_end = (sample.loop_end + preset_zone.sample_loop_end_offset) >> mip;
+        if (preset_zone.loop_enable && index > static_cast<int>(loop_end) && loop_end > loop_start) {
+            index -= static_cast<int>(loop_start);
+            index %= static_cast<int>(loop_end - loop_start);
+            index += static_cast<int>(loop_start);
+        }
+
+        const SampleMips* source = is_linked_sample ? linked_mips : mips;
+        if (source == nullptr) {
+            return 0.0f;
+        }
+        const std::vector<i16>& level = source->levels[mip - 1];
+        if (index >= static_cast<int>(level.size())) {
+            return 0.0f;
+        }
+        return static_cast<float>(level[index]) / 32767.f;
+    }
+
+    float WavetableOscillator::sinc_from_index(const SincTable& table, const int index, const double read_position, const bool is_linked_sample, const int mip) const {
+        // Pick the two closest phases, and interpolate between what they give
+        const double phase_position = (read_position - floor(read_position)) * SINC_PHASES;
+        const int phase = static_cast<int>(phase_position);
+        const float t = static_cast<float>(phase_position - static_cast<double>(phase));
+        const int first = index - table.taps / 2 + 1;
+
+        // Find the frames this reads, so the window can be read straight from them when it doesn't cross an edge or the loop end
+        const i16* data;
+        int length;
+        if (mip == 0) {
+            data = is_linked_sample ? sample.linked : sample.data;
+            length = static_cast<int>(sample.length);
+        }
+        else {
+            const SampleMips* source = is_linked_sample ? linked_mips : mips;
+            data = (source != nullptr) ? source->levels[mip - 1].data() : nullptr;
+            length = (source != nullptr) ? static_cast<int>(source->levels[mip - 1].size()) : 0;
+        }
+        const int loop_end = static_cast<int>((sample.loop_end + preset_zone.sample_loop_end_offset) >> mip);
+        const int last = first + table.taps - 1;
+        if (data != nullptr && first >= 0 && last < length && (!preset_zone.loop_enable || last <= loop_end)) {
+            const float a = sinc_dot(data + first, table.row(phase), table.taps);
+            const float b = sinc_dot(data + first, table.row(phase + 1), table.taps);
+            return lerp(a, b, t) / 32767.f;
+        }
+
+        // Otherwise sample_from_index() takes care of the edges and the loop
+        float window[SINC_MAX_TAPS];
+        for (int i = 0; i < table.taps; ++i) {
+            window[i] = sample_from_index(first + i, is_linked_sample, mip);
+        }
+        const float a = sinc_dot(window, table.row(phase), table.taps);
+        const float b = sinc_dot(window, table.row(phase + 1), table.taps);
+        return lerp(a, b, t);
+    }
+
+    void WavetableOscillator::end_block() {
+        // The release only gets quieter from here, but a single quiet frame isn't enough to go on, the modulation LFO
+        // can still swing it back up
+        if (block_frames > 0 && quiet_frames == block_frames) {
+            vol_env.stage = static_cast<double>(off);
+        }
+        block_frames = 0;
+        quiet_frames = 0;
+    }
+
+    void WavetableOscillator::leave_one_shot() {
+        OneShotRender* render = one_shot;
+        one_shot = nullptr;
+        --render->n_users;
+
+        // Nothing to carry on with
+        const auto stage = static_cast<EnvStage>(vol_env.stage);
+        if (stage == off) {
+            return;
+        }
+
+        // The volume envelope is already where it should be, unless it's still the render's
+        if (!one_shot_released) {
+            vol_env = one_shot_env;
+            if (stage == release) {
+                vol_env.stage = static_cast<double>(release);
+            }
+        }
+
+        // Only take over the rest of what get_sample() moves forward, the levels and routing stay ours
+        const WavetableOscillator state = render->state_at(one_shot_position);
+        mod_env = state.mod_env;
+        vib_lfo = state.vib_lfo;
+        mod_lfo = state.mod_lfo;
+        filter = state.filter;
+        sample_position = state.sample_position;
+        filter_countdown = state.filter_countdown;
+    }
+
+    float WavetableOscillator::sample_from_index(int index, bool is_linked_sample, const int mip) const {
         // This is for interpolation, samples outside the range are zero
         if (index < 0) {
             return 0.0f;
         }
+        if (mip > 0) {
+            return mip_from_index(index, is_linked_sample, mip);
+        }
 
         // Handle looping
         const u32 loop_start = sample.loop_start + preset_zone.sample_loop_start_offset;
@@ -153,11 +358,40 @@ namespace Flan {
         }
     }
 
-    BufferSample Voice::get_sample(const double time_per_sample, const double pitch_wheel, const int filter_mode) {
+    Voice::~Voice() {
+        for (const auto osc : wave_oscs) {
+            if (osc->one_shot != nullptr) {
+                --osc->one_shot->n_users;
+            }
+            delete osc;
+        }
+    }
+
+    void Voice::update_levels(const double pitch_wheel, const bool host_applies_levels) {
+        if (voice_params == nullptr) {
+            return;
+        }
+        VoiceLevels levels = voice_params->final_levels;
+        if (host_applies_levels) {
+            levels.vol = 1.0f;
+            levels.pan = 0.0f;
+        }
+        if (levels_valid && pitch_wheel == cached_pitch_wheel && memcmp(&levels, &cached_levels, sizeof(VoiceLevels)) == 0) {
+            return;
+        }
+        cached_levels = levels;
+        cached_pitch_wheel = pitch_wheel;
+        levels_valid = true;
+        for (const auto osc : wave_oscs) {
+            osc->update_levels(cached_levels, pitch_wheel);
+        }
+    }
+
+    BufferSample Voice::get_sample(const double time_per_sample, const int filter_mode, const double silence_gain) {
         BufferSample sample = { 0, 0 };
         schedule_kill = true;
         for (const auto osc : wave_oscs) {
-            const BufferSample new_sample = osc->get_sample(time_per_sample, pitch_wheel, filter_mode);
+            const BufferSample new_sample = osc->get_sample(time_per_sample, filter_mode, silence_gain);
             sample.left += new_sample.left;
             sample.right += new_sample.right;
             if (osc->schedule_kill == false) {
@@ -166,4 +400,23 @@ namespace Flan {
         }
         return sample;
     }
+
+    void Voice::get_samples(BufferSample* outputs, const int n_outputs, const double time_per_sample, const int filter_mode, const double silence_gain) {
+        schedule_kill = true;
+        for (const auto osc : wave_oscs) {
+            const BufferSample new_sample = osc->get_sample(time_per_sample, filter_mode, silence_gain);
+            BufferSample& output = outputs[osc->output < n_outputs ? osc->output : 0];
+            output.left += new_sample.left;
+            output.right += new_sample.right;
+            if (osc->schedule_kill == false) {
+                schedule_kill = false;
+            }
+        }
+    }
+
+    void Voice::end_block() {
+        for (const auto osc : wave_oscs) {
+            osc->end_block();
+        }
+    }
 }
@@ -1,15 +1,36 @@
 #pragma once
 #include "../../SoundfontStudies/SoundfontStudies/structs.h"
-#include <FruityPlug/fp_plugclass.h>
+#include "SampleMips.h"
+#include "SincTable.h"
+#include <vector>
 using sample_t = float;
 
 namespace Flan {
+    // Same layout as FL Studio's TLevelParams and TVoiceParams, so the plugin can pass those straight through
+    struct VoiceLevels {
+        float pan;      // -1..1
+        float vol;      // 0.0 = -inf dB, 1.0 = 0 dB, can go above 1.0
+        float pitch;    // in cents, relative to middle C
+        float fcut;     // 0..1
+        float fres;     // 0..1
+    };
+
+    struct VoiceParams {
+        VoiceLevels init_levels;
+        VoiceLevels final_levels;
+    };
+
     struct BufferSample {
         sample_t left, right;
     };
 
     inline float bell_curve[512]{ 0.0f };
 
+    struct OneShotRender;
+
+    // Fills the bell curve lookup table used by the gaussian sampling mode, should be called once before rendering anything
+    void init_bell_curve();
+
     struct WavetableOscillator
     {
         // can even be made const, since we'll be using a vector of wave oscs, so we can set the const values on initialization.
@@ -27,24 +48,131 @@ namespace Flan {
         double initial_channel_pitch = 0.0;      // Pitch data supplied from external source like a DAW
         double channel_pitch = 0.0;      // Pitch data supplied from external source like a DAW
         u8 midi_key = 255;              // The current midi key that's playing
+        u8 output = 0;                  // Which of the plugin's outputs this zone is routed to
+        const SampleMips* mips = nullptr;           // Lower rate copies of the sample for high notes, nullptr to always read the sample
+        const SampleMips* linked_mips = nullptr;    // Same for the other half of a stereo sample
         bool schedule_kill = false;
-        PVoiceParams voice_params = nullptr;
 
-        BufferSample get_sample(double time_per_sample, double pitch_wheel, int filter_mode = true);
-        [[nodiscard]] float sample_from_index(int index, bool is_linked_sample) const;
+        // Derived from the levels and the pitch wheel by update_levels(), so the per-sample code doesn't have to
+        double zone_gain = 1.0;          // The zone's initial attenuation, the part of the level the host can't automate
+        double level_gain = 0.0;         // Channel volume times zone_gain
+        double level_gain_l = 0.0;       // Same, with the channel and zone panning applied
+        double level_gain_r = 0.0;
+        double level_pitch_mul = 1.0;    // Sample delta multiplier for the pitch wheel and channel pitch
+
+        // The filter cutoff follows the modulation envelope and LFO every this many samples. The quality governor
+        // raises it for voices it degrades, 1 is every sample
+        u16 filter_interval = 1;
+        u16 filter_countdown = 0;
+
+        // Set while the oscillator copies its frames from a cached render of its one-shot, see OneShotCache. The volume
+        // envelope keeps running next to the render's, so a release can be applied on top of the cached frames
+        OneShotRender* one_shot = nullptr;
+        u32 one_shot_position = 0;
+        EnvState one_shot_env{};        // The render's volume envelope, which never gets released
+        bool one_shot_released = false; // vol_env has taken over from one_shot_env
+
+        // Frames rendered since the last end_block(), and how many of them were released with the envelope below the
+        // silence floor
+        u32 block_frames = 0;
+        u32 quiet_frames = 0;
+
+        // Recomputes the derived level values, only needs to happen when the levels or the pitch wheel change
+        void update_levels(const VoiceLevels& levels, double pitch_wheel);
+
+        // Oscillators in their release stage that stay quieter than `silence_gain` (linear) for a whole block are turned off
+        // early by end_block(), 0 disables that
+        BufferSample get_sample(double time_per_sample, int filter_mode = true, double silence_gain = 0.0);
+
+        // Turns the oscillator off if it was released and below the silence floor at every frame it rendered this block
+        void end_block();
+        // `mip` 0 reads the sample itself, 1 and up the mip levels, with the index in that level's frames
+        [[nodiscard]] float sample_from_index(int index, bool is_linked_sample, int mip = 0) const;
+
+        // Stops copying from the cached render, and carries on rendering live from the frame it was at
+        void leave_one_shot();
+
+    private:
+        [[nodiscard]] float mip_from_index(int index, bool is_linked_sample, int mip) const;
+        [[nodiscard]] float sinc_from_index(const SincTable& table, int index, double read_position, bool is_linked_sample, int mip) const;
+        BufferSample get_one_shot_sample(double time_per_sample, int filter_mode, double silence_gain);
     };
 
     struct Voice {
         std::vector<WavetableOscillator*> wave_oscs;
+        const VoiceParams* voice_params = nullptr;
         intptr_t voice_tag = 0;
         bool schedule_kill = false;
 
-        [[nodiscard]] BufferSample get_sample(double time_per_sample, double pitch_wheel, int filter_mode = true);
+        // Where in the next rendered block the note starts and gets released, in frames. Both count down as blocks
+        // are rendered, -1 means the release isn't scheduled
+        int start_offset = 0;
+        int release_offset = -1;
+
+        // Notes that came in as MIDI in multitimbral mode. No host owns their params, so they keep their own
+        VoiceParams midi_params{};
+        int midi_channel = -1;          // -1 for notes the host started
+        u8 midi_note = 0;
+        bool midi_released = false;     // Got its note off
+        bool midi_sustained = false;    // Got its note off while the sustain pedal was down, so it's released when the pedal is
+
+        // The levels and pitch wheel the oscillators were last updated with
+        VoiceLevels cached_levels{};
+        double cached_pitch_wheel = 0.0;
+        bool levels_valid = false;
 
-        void release() const {
+        bool one_shot_checked = false;  // Whether the oscillators were looked up in the one-shot cache yet
+        int governed_sampling_mode = -1;    // What the quality governor turned this voice's sampling mode down to, -1 if it didn't
+
+        // Notes that came in while the soundfont was about to be replaced wait for it without any oscillators, and get
+        // them once it's loaded, see Synth::hold_notes()
+        bool waiting = false;
+        bool waiting_released = false;  // Got released while it was waiting, so it's released as soon as it starts
+        u16 preset_key = 0;
+
+        // Voices with nothing high enough to need the full host rate render at half of it, onto the synth's half rate bus.
+        // They run ahead of the others by the upsampler's lookahead, this is the host frame they've rendered up to
+        bool half_rate = false;
+        int64_t half_rate_position = -1;
+        int64_t full_rate_from = -1;    // Host frame it went back to the full rate at after getting bent up, it stays on the bus
+
+        ~Voice();
+
+        // FL changes the levels in place when a note slides or gets automated, without telling us. Call this once per block,
+        // it compares them against the cached ones and only updates the oscillators if something actually changed.
+        // When the host applies volume and panning itself, only the pitch is taken from the levels
+        void update_levels(double pitch_wheel, bool host_applies_levels = false);
+
+        [[nodiscard]] BufferSample get_sample(double time_per_sample, int filter_mode = true, double silence_gain = 0.0);
+
+        // Same, but adds every oscillator to the output it's routed to. Oscillators routed past `n_outputs` go to output 0
+        void get_samples(BufferSample* outputs, int n_outputs, double time_per_sample, int filter_mode = true, double silence_gain = 0.0);
+
+        // Call this after every block, see WavetableOscillator::end_block()
+        void end_block();
+
+        void release() {
+            waiting_released = waiting;
             for (const auto osc : wave_oscs) {
                 osc->vol_env.stage = Flan::EnvStage::release;
             }
         }
+
+        // Cuts the note off without a release. Notes that are still waiting for the soundfont are dropped
+        void stop() {
+            schedule_kill = schedule_kill || waiting;
+            for (const auto osc : wave_oscs) {
+                osc->vol_env.stage = Flan::EnvStage::off;
+            }
+        }
+
+        // Releases the note `offset` frames into the next rendered block, or right away if that's 0
+        void release_after(const int offset) {
+            if (offset <= 0) {
+                release();
+                return;
+            }
+            release_offset = offset;
+        }
     };
 }
\ No newline at end of file